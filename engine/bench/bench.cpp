@@ -0,0 +1,270 @@
+// In-process benchmarks of the store and the record codecs.
+//
+//   bench micro [seconds_per_case] [value_bytes]
+//       ops/s and ns/op of GlobalStore produce / fetch / commit_offset and
+//       of frame encoding, CRC32C, LZ4 batches, JSON record output and
+//       request parsing, and fsyncs of several files one by one against
+//       one disk_io batch
+//   bench scaling [max_partitions] [seconds_per_step] [value_bytes]
+//       how produce+fetch throughput scales with the number of partitions:
+//       for each partition count P, P threads each append to and read back
+//       from their own partition of one topic
+//
+// The store writes under ./data, so both run in a scratch directory.
+
+#include "crc32c.h"
+#include "disk_io.h"
+#include "flat_request.h"
+#include "json.hpp"
+#include "json_writer.h"
+#include "log_file.h"
+#include "record.h"
+#include "record_batch.h"
+#include "store.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+static double seconds_since(std::chrono::steady_clock::time_point t0) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// ---- micro ----
+
+// Calls op (which does ops_per_call operations of bytes_per_op bytes) until
+// seconds have passed, after a short warm-up.
+template <typename F>
+static void measure(const char* name, double seconds, uint64_t ops_per_call, uint64_t bytes_per_op, F&& op) {
+  for (int i = 0; i < 16; i++) op();
+
+  uint64_t calls = 0;
+  auto t0 = std::chrono::steady_clock::now();
+  double elapsed = 0;
+  do {
+    for (int i = 0; i < 16; i++) op();
+    calls += 16;
+    elapsed = seconds_since(t0);
+  } while (elapsed < seconds);
+
+  double ops = (double)(calls * ops_per_call);
+  std::printf("%-28s %14.0f %12.1f", name, ops / elapsed, elapsed * 1e9 / ops);
+  if (bytes_per_op) std::printf(" %10.1f", ops * (double)bytes_per_op / elapsed / (1 << 20));
+  std::printf("\n");
+}
+
+static std::string event_value(size_t i, size_t bytes) {
+  std::string v = "{\"user\":\"u";
+  v += std::to_string(i % 1000);
+  v += "\",\"action\":\"click\",\"n\":";
+  v += std::to_string(i);
+  v += ",\"pad\":\"";
+  while (v.size() + 2 < bytes) v.push_back((char)('a' + i++ % 26));
+  v += "\"}";
+  return v;
+}
+
+static int run_micro(double seconds, size_t value_bytes) {
+  auto& store = GlobalStore::instance();
+  store.create_topic("micro", 1);
+  store.create_topic("micro-lz4", 1, [] { TopicConfig c; c.compression = Codec::Lz4; return c; }());
+
+  std::vector<std::string> values, keys;
+  std::vector<KeyValue> batch;
+  for (size_t i = 0; i < 100; i++) {
+    values.push_back(event_value(i, value_bytes));
+    keys.push_back("k");
+    keys.back() += std::to_string(i);
+  }
+  for (size_t i = 0; i < 100; i++) batch.push_back({keys[i], values[i]});
+  uint64_t record_bytes = value_bytes + 3;
+
+  std::printf("%-28s %14s %12s %10s\n", "case", "ops/s", "ns/op", "MiB/s");
+
+  measure("store produce", seconds, 1, record_bytes, [&] { store.produce("micro", keys[0], values[0], 0); });
+  measure("store produce_batch x100", seconds, 100, record_bytes, [&] { store.produce_batch("micro", batch, 0); });
+  measure("store produce_batch lz4", seconds, 100, record_bytes, [&] { store.produce_batch("micro-lz4", batch, 0); });
+
+  uint64_t end = store.end_offset("micro", 0);
+  uint64_t at = 0;
+  measure("store fetch x100", seconds, 100, record_bytes, [&] {
+    auto r = store.fetch("micro", 0, at, 100);
+    at = r.next_offset < end ? r.next_offset : 0;
+  });
+  uint64_t end_lz4 = store.end_offset("micro-lz4", 0);
+  at = 0;
+  measure("store fetch lz4 x100", seconds, 100, record_bytes, [&] {
+    auto r = store.fetch("micro-lz4", 0, at, 100);
+    at = r.next_offset < end_lz4 ? r.next_offset : 0;
+  });
+  uint64_t next = 0;
+  measure("store commit_offset", seconds, 1, 0, [&] { store.commit_offset("bench", "micro", 0, ++next % end); });
+
+  // what the Interval flusher does for 8 dirty partitions
+  fs::create_directories("data/_bench_sync");
+  std::vector<std::unique_ptr<LogFile>> files;
+  std::vector<LogFile*> raw;
+  for (int i = 0; i < 8; i++) {
+    files.push_back(std::make_unique<LogFile>("data/_bench_sync/" + std::to_string(i) + ".log"));
+    raw.push_back(files.back().get());
+  }
+  std::string page(4096, 's');
+  auto dirty_all = [&] {
+    for (auto* f : raw) { f->append(page.data(), page.size()); f->flush(); }
+  };
+  measure("fsync x8 one by one", seconds, raw.size(), page.size(), [&] {
+    dirty_all();
+    for (auto* f : raw) f->sync();
+  });
+  std::string name = "fsync x8 batch (";
+  name += disk_io::backend_name();
+  name += ")";
+  measure(name.c_str(), seconds, raw.size(), page.size(), [&] {
+    dirty_all();
+    LogFile::sync_all(raw);
+  });
+
+  char header[record_format::kHeaderSize];
+  measure("encode_header (crc)", seconds, 1, record_bytes, [&] {
+    record_format::encode_header(header, 1, 2, keys[0], values[0]);
+    asm volatile("" : : "r"(header) : "memory");
+  });
+  std::string block(4096, 'x');
+  volatile uint32_t sink = 0;
+  measure("crc32c 4KiB", seconds, 1, block.size(), [&] { sink = sink + crc32c(block.data(), block.size()); });
+
+  std::vector<BatchRecord> recs;
+  for (size_t i = 0; i < 100; i++) recs.push_back({i, keys[i], values[i]});
+  std::string payload;
+  measure("lz4 batch encode x100", seconds, 100, record_bytes, [&] {
+    payload.clear();
+    encode_batch_payload(Codec::Lz4, recs.data(), recs.size(), payload);
+  });
+  std::string scratch;
+  std::vector<BatchRecord> decoded;
+  measure("lz4 batch decode x100", seconds, 100, record_bytes, [&] {
+    decode_batch_payload(0, Codec::Lz4, payload, scratch, decoded);
+  });
+
+  FetchResult fetched = store.fetch("micro", 0, 0, 100);
+  std::string out;
+  measure("json records x100", seconds, fetched.records.size(), record_bytes, [&] {
+    out.clear();
+    json_append_records(out, fetched, 0);
+  });
+
+  std::string line = "{\"type\":\"PRODUCE\",\"topic\":\"micro\",\"key\":\"k1\",\"value\":";
+  json_append_string(line, values[0]);
+  line += ",\"partition\":0}";
+  Arena arena;
+  FlatRequest flat;
+  measure("parse PRODUCE (flat)", seconds, 1, line.size(), [&] {
+    arena.reset();
+    if (!flat.parse(line, arena)) std::abort();
+  });
+  measure("parse PRODUCE (json)", seconds, 1, line.size(), [&] {
+    auto j = nlohmann::json::parse(line);
+    asm volatile("" : : "r"(&j) : "memory");
+  });
+  return 0;
+}
+
+// ---- scaling ----
+
+struct StepResult {
+  uint64_t produced = 0;
+  uint64_t fetched = 0;
+  double seconds = 0;
+};
+
+static StepResult run_step(int partitions, double seconds, size_t value_bytes) {
+  std::string topic = "scale-";
+  topic += std::to_string(partitions);
+  GlobalStore::instance().create_topic(topic, partitions);
+
+  std::atomic<bool> stop{false};
+  std::vector<uint64_t> produced(partitions, 0), fetched(partitions, 0);
+  std::vector<std::thread> threads;
+
+  auto t0 = std::chrono::steady_clock::now();
+  for (int p = 0; p < partitions; p++) {
+    threads.emplace_back([&, p] {
+      auto& store = GlobalStore::instance();
+      std::string value(value_bytes, 'x');
+      std::string key = "k";
+      key += std::to_string(p);
+      uint64_t n = 0, f = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        auto [part, off] = store.produce(topic, key, value, p);
+        (void)part;
+        n++;
+        // one fetch of the most recent records for every 10 appends
+        if (n % 10 == 0) f += store.fetch(topic, p, off >= 100 ? off - 100 : 0, 100).records.size();
+      }
+      produced[p] = n;
+      fetched[p] = f;
+    });
+  }
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  stop = true;
+  for (auto& t : threads) t.join();
+
+  StepResult r;
+  r.seconds = seconds_since(t0);
+  for (int p = 0; p < partitions; p++) { r.produced += produced[p]; r.fetched += fetched[p]; }
+  return r;
+}
+
+static int run_scaling(int max_partitions, double seconds, size_t value_bytes) {
+  std::cout << "partitions  produce/s     fetched rec/s  speedup\n";
+  double base = 0;
+  for (int p = 1; p <= max_partitions; p *= 2) {
+    auto r = run_step(p, seconds, value_bytes);
+    double rate = r.produced / r.seconds;
+    if (base == 0) base = rate;
+    std::printf("%10d  %12.0f  %13.0f  %6.2fx\n", p, rate, r.fetched / r.seconds, rate / base);
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  std::string cmd = argc > 1 ? argv[1] : "";
+  if (cmd != "micro" && cmd != "scaling") {
+    std::cerr << "Usage: bench micro [seconds_per_case] [value_bytes]\n"
+                 "       bench scaling [max_partitions] [seconds_per_step] [value_bytes]\n";
+    return 1;
+  }
+
+  fs::path dir = fs::temp_directory_path() / ("pulsestream-bench-" + std::to_string(::getpid()));
+  fs::create_directories(dir);
+  fs::current_path(dir);
+
+  int rc;
+  if (cmd == "micro") {
+    double seconds = argc > 2 ? std::atof(argv[2]) : 1.0;
+    size_t value_bytes = argc > 3 ? (size_t)std::atoll(argv[3]) : 100;
+    rc = run_micro(seconds, std::max<size_t>(value_bytes, 48));
+  } else {
+    int max_partitions = argc > 2 ? std::atoi(argv[2]) : (int)std::max(1u, std::thread::hardware_concurrency());
+    double seconds = argc > 3 ? std::atof(argv[3]) : 2.0;
+    size_t value_bytes = argc > 4 ? (size_t)std::atoll(argv[4]) : 100;
+    rc = run_scaling(max_partitions, seconds, value_bytes);
+  }
+
+  fs::current_path(fs::temp_directory_path());
+  fs::remove_all(dir);
+  return rc;
+}
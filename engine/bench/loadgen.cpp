@@ -0,0 +1,287 @@
+// Network load generator: drives a running engine over the binary protocol
+// and reports throughput and latency.
+//
+//   loadgen [--host 127.0.0.1] [--port 9000] [--topic loadgen] [--partitions 8]
+//           [--producers 4] [--consumers 2] [--rate 0] [--size 100] [--batch 1]
+//           [--seconds 10]
+//
+// Each producer owns a connection and sends PRODUCE requests of --batch
+// keyless records of --size bytes, waiting for each ack; --rate caps its
+// records per second (0 = as fast as acks come back). Consumers split the
+// partitions between them and long-poll FETCH from the end offsets at the
+// start. Every value starts with its send time, so consumers measure
+// end-to-end latency as well.
+
+#include "binary_protocol.h"
+#include "json.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using json = nlohmann::json;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 9000;
+  std::string topic = "loadgen";
+  int partitions = 8;
+  int producers = 4;
+  int consumers = 2;
+  uint64_t rate = 0;      // records/s per producer; 0 = unthrottled
+  size_t size = 100;      // value bytes
+  uint32_t batch = 1;     // records per PRODUCE
+  double seconds = 10;
+};
+
+static void die(const std::string& msg) {
+  std::cerr << "Error: " << msg << "\n";
+  std::exit(1);
+}
+
+static uint64_t now_ns() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One binary protocol connection; requests are answered in order.
+class Connection {
+public:
+  Connection(const std::string& host, int port) {
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0) die("socket() failed");
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    if (::inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) die("bad host " + host);
+    if (::connect(fd_, (sockaddr*)&addr, sizeof(addr)) < 0) die(std::string("connect failed: ") + std::strerror(errno));
+    int yes = 1;
+    ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    send_all(std::string(binproto::kMagic, sizeof(binproto::kMagic)));
+    if (recv_exact(sizeof(binproto::kMagic)) != std::string(binproto::kMagic, sizeof(binproto::kMagic))) {
+      die("engine did not answer the binary handshake");
+    }
+  }
+  ~Connection() { ::close(fd_); }
+
+  // Sends a frame built with begin_frame/finish_frame and returns the
+  // response body ([op][status][payload]).
+  std::string call(const std::string& frame) {
+    send_all(frame);
+    std::string len = recv_exact(4);
+    uint32_t n;
+    std::memcpy(&n, len.data(), 4);
+    std::string body = recv_exact(n);
+    if (body.size() < 2 || body[1] != binproto::kOk) die("request failed: " + body.substr(std::min<size_t>(2, body.size())));
+    return body;
+  }
+
+  json call_json(const json& req) {
+    std::string out;
+    size_t at = binproto::begin_frame(out);
+    binproto::put_u8(out, binproto::kJson);
+    out += req.dump();
+    binproto::finish_frame(out, at);
+    return json::parse(call(out).substr(2));
+  }
+
+private:
+  void send_all(const std::string& out) {
+    size_t done = 0;
+    while (done < out.size()) {
+      ssize_t n = ::send(fd_, out.data() + done, out.size() - done, MSG_NOSIGNAL);
+      if (n < 0) { if (errno == EINTR) continue; die("send failed"); }
+      done += (size_t)n;
+    }
+  }
+
+  std::string recv_exact(size_t len) {
+    std::string buf(len, '\0');
+    size_t got = 0;
+    while (got < len) {
+      ssize_t n = ::recv(fd_, &buf[got], len - got, 0);
+      if (n == 0) die("connection closed");
+      if (n < 0) { if (errno == EINTR) continue; die("recv failed"); }
+      got += (size_t)n;
+    }
+    return buf;
+  }
+
+  int fd_ = -1;
+};
+
+// latencies in microseconds, one vector per thread, merged at the end
+struct Samples {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  std::vector<uint32_t> latency_us;
+
+  void add(uint64_t ns) { latency_us.push_back((uint32_t)std::min<uint64_t>(ns / 1000, UINT32_MAX)); }
+};
+
+static void producer(const Options& o, std::atomic<bool>& stop, Samples& s) {
+  using namespace binproto;
+  Connection conn(o.host, o.port);
+  std::string value(std::max<size_t>(o.size, 8), 'x');
+  uint64_t interval_ns = o.rate ? 1000000000ULL * o.batch / o.rate : 0;
+  uint64_t next_send = now_ns();
+
+  std::string frame;
+  while (!stop.load(std::memory_order_relaxed)) {
+    if (interval_ns) {
+      uint64_t now = now_ns();
+      if (now < next_send) std::this_thread::sleep_for(std::chrono::nanoseconds(next_send - now));
+      next_send += interval_ns;
+    }
+
+    uint64_t t0 = now_ns();
+    frame.clear();
+    size_t at = begin_frame(frame);
+    put_u8(frame, kProduce);
+    put_str16(frame, o.topic);
+    put_i32(frame, -1);
+    put_u32(frame, o.batch);
+    for (uint32_t i = 0; i < o.batch; i++) {
+      std::memcpy(value.data(), &t0, 8);
+      put_u32(frame, 0);
+      put_u32(frame, (uint32_t)value.size());
+      frame += value;
+    }
+    finish_frame(frame, at);
+    conn.call(frame);
+
+    s.add(now_ns() - t0);
+    s.records += o.batch;
+    s.bytes += (uint64_t)o.batch * value.size();
+  }
+}
+
+static void consumer(const Options& o, std::vector<int> parts, std::vector<uint64_t> offsets,
+                     std::atomic<bool>& stop, Samples& s) {
+  using namespace binproto;
+  if (parts.empty()) return;
+  Connection conn(o.host, o.port);
+
+  std::string frame;
+  for (size_t k = 0; !stop.load(std::memory_order_relaxed); k = (k + 1) % parts.size()) {
+    frame.clear();
+    size_t at = begin_frame(frame);
+    put_u8(frame, kFetch);
+    put_str16(frame, o.topic);
+    put_i32(frame, parts[k]);
+    put_u64(frame, offsets[k]);
+    put_u32(frame, 10000);
+    put_u32(frame, 4u << 20);
+    put_u32(frame, parts.size() == 1 ? 100 : 10); // max_wait_ms: short when other partitions wait
+    put_u32(frame, 1);
+    finish_frame(frame, at);
+
+    std::string body = conn.call(frame);
+    Reader r(std::string_view(body).substr(2));
+    r.i32();
+    r.u64();
+    offsets[k] = r.u64();
+    uint32_t n = r.u32();
+    uint64_t now = now_ns();
+    for (uint32_t i = 0; i < n && !r.failed(); i++) {
+      r.u64(); r.u64();
+      uint32_t klen = r.u32(), vlen = r.u32();
+      r.u32();
+      r.bytes(klen);
+      auto v = r.bytes(vlen);
+      if (v.size() >= 8) {
+        uint64_t sent;
+        std::memcpy(&sent, v.data(), 8);
+        if (sent <= now) s.add(now - sent);
+      }
+      s.records++;
+      s.bytes += vlen;
+    }
+  }
+}
+
+static void report(const char* what, const char* latency, std::vector<Samples>& all, double seconds) {
+  Samples total;
+  for (auto& s : all) {
+    total.records += s.records;
+    total.bytes += s.bytes;
+    total.latency_us.insert(total.latency_us.end(), s.latency_us.begin(), s.latency_us.end());
+  }
+  auto& l = total.latency_us;
+  std::sort(l.begin(), l.end());
+  auto q = [&](double p) { return l.empty() ? 0.0 : l[std::min(l.size() - 1, (size_t)(p * (double)l.size()))] / 1000.0; };
+  std::printf("%-8s %12.0f rec/s %9.2f MiB/s   %s p50 %8.3f ms  p99 %8.3f ms  p999 %8.3f ms  max %8.3f ms\n",
+              what, total.records / seconds, total.bytes / seconds / (1 << 20), latency,
+              q(0.5), q(0.99), q(0.999), l.empty() ? 0.0 : l.back() / 1000.0);
+}
+
+int main(int argc, char** argv) {
+  Options o;
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    if (i + 1 >= argc) die("missing value for " + a);
+    std::string v = argv[++i];
+    if (a == "--host") o.host = v;
+    else if (a == "--port") o.port = std::atoi(v.c_str());
+    else if (a == "--topic") o.topic = v;
+    else if (a == "--partitions") o.partitions = std::atoi(v.c_str());
+    else if (a == "--producers") o.producers = std::atoi(v.c_str());
+    else if (a == "--consumers") o.consumers = std::atoi(v.c_str());
+    else if (a == "--rate") o.rate = std::strtoull(v.c_str(), nullptr, 10);
+    else if (a == "--size") o.size = (size_t)std::atoll(v.c_str());
+    else if (a == "--batch") o.batch = (uint32_t)std::max(1, std::atoi(v.c_str()));
+    else if (a == "--seconds") o.seconds = std::atof(v.c_str());
+    else die("unknown option " + a);
+  }
+
+  // the topic may exist already (with its own partition count)
+  std::vector<uint64_t> ends;
+  {
+    Connection admin(o.host, o.port);
+    admin.call_json({{"type","CREATE_TOPIC"},{"topic",o.topic},{"partitions",o.partitions}});
+    json topics = admin.call_json(json::object({{"type","TOPICS"}}));
+    for (auto& t : topics["topics"]) {
+      if (t.value("topic", "") != o.topic) continue;
+      for (auto& p : t["partition_stats"]) ends.push_back(p.value("end_offset", 0ULL));
+    }
+    if (ends.empty()) die("topic " + o.topic + " not found");
+  }
+
+  std::atomic<bool> stop{false};
+  std::vector<Samples> produced(o.producers), consumed(o.consumers);
+  std::vector<std::thread> threads;
+  auto t0 = std::chrono::steady_clock::now();
+  for (int c = 0; c < o.consumers; c++) {
+    std::vector<int> parts;
+    std::vector<uint64_t> offsets;
+    for (int p = c; p < (int)ends.size(); p += o.consumers) { parts.push_back(p); offsets.push_back(ends[p]); }
+    threads.emplace_back(consumer, std::cref(o), parts, offsets, std::ref(stop), std::ref(consumed[c]));
+  }
+  for (int p = 0; p < o.producers; p++) threads.emplace_back(producer, std::cref(o), std::ref(stop), std::ref(produced[p]));
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(o.seconds));
+  stop = true;
+  for (auto& t : threads) t.join();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+  std::printf("topic %s: %zu partitions, %d producers (batch %u, %zu B values), %d consumers, %.1f s\n",
+              o.topic.c_str(), ends.size(), o.producers, o.batch, o.size, o.consumers, seconds);
+  report("produce", "ack", produced, seconds);
+  if (o.consumers > 0) report("consume", "e2e", consumed, seconds);
+  return 0;
+}
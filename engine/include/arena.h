@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Bump allocator for memory that lives as long as one request. Allocating
+// is a pointer increment; reset() drops everything at once but keeps the
+// memory, so once the arena has grown to fit the requests it serves it no
+// longer touches the heap. Only for trivially destructible objects: nothing
+// is ever destroyed.
+class Arena {
+public:
+  explicit Arena(size_t block_size = 16 * 1024) : block_size_(block_size) {}
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  void* allocate(size_t n, size_t align = alignof(std::max_align_t));
+
+  template <typename T>
+  T* allocate_array(size_t n) { return static_cast<T*>(allocate(n * sizeof(T), alignof(T))); }
+
+  // Copies s into the arena.
+  std::string_view copy(std::string_view s);
+
+  // Frees everything allocated. If the last round needed more than one
+  // block they are merged into one that fits it, up to kMaxKeep bytes.
+  void reset();
+
+  size_t capacity() const;
+
+  static constexpr size_t kMaxKeep = 1 << 20;
+
+private:
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size = 0;
+  };
+
+  void* allocate_slow(size_t n, size_t align);
+
+  size_t block_size_;
+  std::vector<Block> blocks_;
+  size_t current_ = 0; // block being filled
+  size_t used_ = 0;    // bytes of it in use
+};
+
+inline void* Arena::allocate(size_t n, size_t align) {
+  if (current_ < blocks_.size()) {
+    size_t at = (used_ + align - 1) & ~(align - 1);
+    if (at + n <= blocks_[current_].size) {
+      used_ = at + n;
+      return blocks_[current_].data.get() + at;
+    }
+  }
+  return allocate_slow(n, align);
+}
@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+// Compact length-prefixed protocol, spoken on the same port as NDJSON. A
+// client selects it by sending kBinaryMagic as the first bytes of the
+// connection; the server echoes the magic back and every message after
+// that is a frame. All integers are little-endian.
+//
+//   request:  [u32 len][u8 op][payload]              len = 1 + payload
+//   response: [u32 len][u8 op|0x80][u8 status][payload]  len = 2 + payload
+//
+// A non-zero status carries an error string as payload. Requests execute
+// and are answered in order.
+//
+//   PING         -> (empty)
+//   PRODUCE      [str16 topic][i32 partition (-1 = by key)][u32 n] n x ([u32 klen][u32 vlen][k][v])
+//                -> [u32 ranges] ranges x ([i32 partition][u64 base_offset][u64 count])
+//   FETCH        [str16 topic][i32 partition][u64 offset][u32 limit][u32 max_bytes]
+//                ([u32 max_wait_ms][u32 min_bytes] ([u8 flags]))
+//                -> [i32 partition][u64 first_offset][u64 next_offset][u32 n][frames]
+//   COMMIT       [str16 group][str16 topic][i32 partition][u64 next_offset]
+//                ([str16 member_id][u64 generation])
+//                -> [u64 committed_next_offset]
+//   FETCH_GROUP  [str16 group][str16 topic][i32 partition][u32 limit][u32 max_bytes][u8 auto_commit]
+//                ([u32 max_wait_ms][u32 min_bytes] ([u8 flags] ([str16 member_id][u64 generation])))
+//                -> same as FETCH
+//   JSON         [NDJSON request text] -> [JSON response text]
+//
+// The optional fetch fields long-poll: with no records (or fewer than
+// min_bytes) at the end of the partition, the server holds the response
+// for up to max_wait_ms until more are appended. Later requests on the
+// connection wait behind it.
+//
+// COMMIT and FETCH_GROUP that name a group member are fenced as their JSON
+// forms are: a stale generation or a partition the member does not own is
+// refused with kBadRequest and the error (unknown_member,
+// rebalance_in_progress, not_assigned).
+//
+// FETCH frames are the records exactly as stored in a log segment:
+// [u64 offset][u64 ts][u32 klen][u32 vlen][u32 crc][k][v], crc being the
+// CRC32C of the first 24 bytes, k and v (see record.h). Offsets ascend
+// from first_offset but may skip on compacted topics.
+//
+// With kAcceptBatches in flags, n also counts compressed batch frames
+// (klen has kBatchFlag set, see record.h). A leading batch may start
+// before first_offset; its records below first_offset are to be skipped.
+// Batches are sent whole, so more than limit records may arrive.
+// Without the flag, batches are decompressed by the server and sent as
+// single record frames.
+namespace binproto {
+
+inline constexpr char kMagic[4] = {'P', 'S', 'B', '1'};
+inline constexpr uint32_t kMaxFrame = 64u * 1024 * 1024;
+
+enum Op : uint8_t {
+  kPing = 1,
+  kProduce = 2,
+  kFetch = 3,
+  kCommit = 4,
+  kFetchGroup = 5,
+  kJson = 6,
+};
+
+inline constexpr uint8_t kResponseBit = 0x80;
+
+// FETCH flags
+inline constexpr uint8_t kAcceptBatches = 0x01;
+
+enum Status : uint8_t {
+  kOk = 0,
+  kBadRequest = 1,
+  kUnknownOp = 2,
+  kInternal = 3,
+};
+
+inline void put_u8(std::string& out, uint8_t v) { out.push_back((char)v); }
+inline void put_u16(std::string& out, uint16_t v) { out.append((const char*)&v, 2); }
+inline void put_u32(std::string& out, uint32_t v) { out.append((const char*)&v, 4); }
+inline void put_u64(std::string& out, uint64_t v) { out.append((const char*)&v, 8); }
+inline void put_i32(std::string& out, int32_t v) { out.append((const char*)&v, 4); }
+inline void put_str16(std::string& out, std::string_view s) { put_u16(out, (uint16_t)s.size()); out.append(s); }
+
+// Starts a frame in out; finish_frame() fills in its length once the
+// payload has been appended.
+inline size_t begin_frame(std::string& out) { size_t at = out.size(); put_u32(out, 0); return at; }
+inline void finish_frame(std::string& out, size_t at) {
+  uint32_t len = (uint32_t)(out.size() - at - 4);
+  std::memcpy(&out[at], &len, 4);
+}
+
+// Bounds-checked cursor over a received payload. Any read past the end
+// sets failed() and yields zeros / empty views.
+class Reader {
+public:
+  explicit Reader(std::string_view buf) : buf_(buf) {}
+
+  uint8_t u8() { uint8_t v = 0; get(&v, 1); return v; }
+  uint16_t u16() { uint16_t v = 0; get(&v, 2); return v; }
+  uint32_t u32() { uint32_t v = 0; get(&v, 4); return v; }
+  uint64_t u64() { uint64_t v = 0; get(&v, 8); return v; }
+  int32_t i32() { int32_t v = 0; get(&v, 4); return v; }
+
+  std::string_view bytes(size_t n) {
+    if (failed_ || buf_.size() - pos_ < n) { failed_ = true; return {}; }
+    auto v = buf_.substr(pos_, n);
+    pos_ += n;
+    return v;
+  }
+  std::string_view str16() { return bytes(u16()); }
+  std::string_view rest() { return bytes(buf_.size() - pos_); }
+
+  bool failed() const { return failed_; }
+  bool done() const { return pos_ == buf_.size(); }
+
+private:
+  void get(void* dst, size_t n) {
+    if (failed_ || buf_.size() - pos_ < n) { failed_ = true; return; }
+    std::memcpy(dst, buf_.data() + pos_, n);
+    pos_ += n;
+  }
+
+  std::string_view buf_;
+  size_t pos_ = 0;
+  bool failed_ = false;
+};
+
+} // namespace binproto
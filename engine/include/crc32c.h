@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli), as used by iSCSI and ext4. Chains: passing the
+// result of one call as crc continues the checksum over the next bytes.
+// Uses the SSE4.2 / ARMv8 crc32c instructions when the CPU has them and a
+// slicing-by-8 table otherwise.
+uint32_t crc32c(const void* data, size_t len, uint32_t crc = 0);
+
+// "hardware" or "software", for diagnostics
+const char* crc32c_impl();
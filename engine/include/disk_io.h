@@ -0,0 +1,51 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// One operation of a disk_io::run() batch.
+struct DiskOp {
+  enum Kind : uint8_t { Read, Write, Sync };
+  static constexpr uint64_t kAppend = UINT64_MAX; // Write: at the end of an O_APPEND file
+
+  Kind kind = Read;
+  bool link = false; // the next op starts only after this one did all its bytes
+  int fd = -1;
+  void* buf = nullptr;
+  size_t len = 0;
+  uint64_t pos = 0;
+  int64_t result = 0; // bytes transferred, or -errno (-ECANCELED after a broken link)
+
+  static DiskOp read(int fd, void* buf, size_t len, uint64_t pos) { return {Read, false, fd, buf, len, pos}; }
+  static DiskOp append(int fd, const void* buf, size_t len) {
+    return {Write, false, fd, const_cast<void*>(buf), len, kAppend};
+  }
+  static DiskOp sync(int fd) { return {Sync, false, fd}; } // fdatasync
+};
+
+// Batched disk I/O. With io_uring (set up through the raw system calls)
+// each thread gets a ring of its own and a batch is one io_uring_enter():
+// the kernel works on all of its operations at once, fsyncs of different
+// files included, and the thread sleeps until the last one completes.
+// Where io_uring is unavailable (old kernels, seccomp filters, disabled by
+// sysctl), and on a thread whose ring has failed, the operations of a
+// batch are spread over a small pool of threads doing pread / write /
+// fdatasync. A batch of one is a plain system call on the calling thread
+// either way.
+//
+// Reads and writes may transfer fewer bytes than asked, as pread() and
+// write() may; callers finish them.
+namespace disk_io {
+
+enum class Backend { Uring, Threads };
+
+// Picks the backend (io_uring unless it is unavailable or not allowed).
+// Optional: the first run() picks with io_uring allowed.
+void init(bool allow_uring = true);
+Backend backend();
+const char* backend_name();
+
+// Runs ops and returns once all have completed; each gets its result.
+// Linked ops run in order, the others in any order.
+void run(DiskOp* ops, size_t n);
+
+} // namespace disk_io
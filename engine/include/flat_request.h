@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "arena.h"
+
+// Hand-rolled reader for the NDJSON requests on the hot path. It takes one
+// shape of line only: a single object whose members are strings, integers
+// or booleans, at most kMaxFields of them. Keys and strings are views into
+// the line, or into the arena where escapes had to be undone; nothing else
+// is allocated.
+//
+// Lines of any other shape (nested values, floats, nulls, integers of more
+// than 18 digits, invalid JSON) fail to parse and are left to
+// nlohmann::json, as are members of the wrong type for a getter, so a
+// request gets the same answer whichever parser reads it.
+class FlatRequest {
+public:
+  static constexpr size_t kMaxFields = 16;
+
+  struct Field {
+    enum Kind : uint8_t { String, Int, Bool };
+    std::string_view key;
+    Kind kind = String;
+    std::string_view str; // String
+    int64_t num = 0;      // Int; Bool as 0 / 1
+  };
+
+  // Returns false if line is not such an object.
+  bool parse(std::string_view line, Arena& arena);
+
+  // The member named key (the last one if repeated, as json::parse keeps
+  // it), or null.
+  const Field* find(std::string_view key) const;
+
+  // Like json::value(key, default): out keeps its default if the member is
+  // absent. False if it is there with another type or out of range.
+  bool get(std::string_view key, std::string_view& out) const;
+  bool get(std::string_view key, int& out) const;
+  bool get(std::string_view key, long long& out) const;
+  bool get(std::string_view key, uint64_t& out) const;
+  bool get(std::string_view key, bool& out) const;
+
+private:
+  Field fields_[kMaxFields];
+  size_t count_ = 0;
+};
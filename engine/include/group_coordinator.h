@@ -0,0 +1,95 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "json.hpp"
+#include "string_map.h"
+
+// Consumer group membership and partition assignment. Members JOIN_GROUP
+// with the topics they consume and get a share of those topics' partitions;
+// any change to the live membership (a join, a leave, a member missing its
+// session timeout, a subscribed topic gaining partitions) starts a new
+// generation with a fresh assignment. Other members learn of it from their
+// next HEARTBEAT and join again to fetch their new share. Commits that name
+// a member and generation are fenced: they must come from the current
+// generation and for a partition the member owns.
+//
+// Membership lives in memory only; after a restart members simply join again.
+class GroupCoordinator {
+public:
+  // range:  each topic's partitions in contiguous runs over the members, by member id
+  // sticky: balanced as range, but partitions stay with their previous owner where possible
+  enum class Strategy { Range, Sticky };
+
+  enum class Status { Ok, UnknownMember, RebalanceInProgress, NotAssigned };
+
+  // topic -> partitions owned
+  using Assignment = std::map<std::string, std::vector<int>, std::less<>>;
+
+  struct JoinResult {
+    std::string member_id;
+    uint64_t generation = 0;
+    Assignment assignment;
+    size_t members = 0;
+    Strategy strategy = Strategy::Range;
+  };
+
+  static constexpr uint32_t kDefaultSessionMs = 10000;
+  static constexpr uint32_t kMinSessionMs = 1000;
+  static constexpr uint32_t kMaxSessionMs = 300000;
+
+  // partitions(topic): current partition count, 0 if the topic does not exist
+  explicit GroupCoordinator(std::function<int(const std::string&)> partitions);
+
+  // Adds a member (empty member_id) or refreshes one. The group's strategy
+  // is set by its first member. Returns false with err set for an unknown
+  // member_id.
+  bool join(const std::string& group, const std::string& member_id, std::vector<std::string> topics,
+            Strategy strategy, uint32_t session_ms, JoinResult& out, std::string& err);
+  // Keeps the member alive. RebalanceInProgress: generation is stale, join again.
+  Status heartbeat(const std::string& group, const std::string& member_id, uint64_t generation);
+  bool leave(const std::string& group, const std::string& member_id);
+
+  // Whether member_id of generation may commit (or consume) topic/partition.
+  Status check(std::string_view group, std::string_view member_id, uint64_t generation,
+               std::string_view topic, int partition);
+
+  // Called periodically: drops members past their session timeout and
+  // rebalances groups whose topics changed partition count.
+  void expire();
+
+  // {"generation","strategy","members":[{"member_id","topics","assignment"}]}, or null
+  nlohmann::json describe(const std::string& group);
+
+private:
+  struct Member {
+    std::vector<std::string> topics;  // sorted
+    uint32_t session_ms = kDefaultSessionMs;
+    uint64_t last_seen_ms = 0;
+    uint64_t generation = 0;          // generation it last joined in
+    Assignment owned;
+  };
+  struct Group {
+    Strategy strategy = Strategy::Range;
+    uint64_t generation = 0;
+    std::map<std::string, Member, std::less<>> members;     // ordered by id: range assignment relies on it
+    std::map<std::string, int> partition_counts; // as of the last rebalance
+  };
+
+  void rebalance_locked(Group& g);
+  std::string new_member_id(const std::string& group);
+
+  std::function<int(const std::string&)> partitions_;
+  std::mutex mu_;
+  StringMap<Group> groups_;
+  uint64_t member_seq_ = 0;
+};
+
+const char* strategy_name(GroupCoordinator::Strategy s);
+bool parse_strategy(const std::string& s, GroupCoordinator::Strategy& out);
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "store.h"
+
+// Helpers that serialize straight into an output buffer for the hot
+// response paths, instead of building a nlohmann::json tree and dumping it.
+
+// Appends s as a quoted JSON string. Invalid UTF-8 bytes become U+FFFD.
+void json_append_string(std::string& out, std::string_view s);
+void json_append_uint(std::string& out, uint64_t v);
+void json_append_int(std::string& out, int64_t v);
+
+// Length of the valid UTF-8 sequence starting at p (left bytes available),
+// or 0 if it is invalid: truncated, overlong, a surrogate or out of range.
+size_t utf8_sequence_length(const unsigned char* p, size_t left);
+
+// Appends `[{"partition":..,"offset":..,"ts_ms":..,"key":..,"value":..},...]`.
+void json_append_records(std::string& out, const FetchResult& r, int partition);
@@ -0,0 +1,70 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Persistent handle on one partition log. The file is opened once
+// (O_RDWR | O_APPEND) and kept for the life of the partition. Appends are
+// staged in a user-space buffer and handed to the kernel with a single
+// write() on flush(); positions are tracked in memory instead of asking the
+// kernel. Reads use pread() on the same fd and may run concurrently with
+// appends as long as they only touch flushed bytes.
+class LogFile {
+public:
+  explicit LogFile(const std::string& path);
+  ~LogFile();
+
+  LogFile(const LogFile&) = delete;
+  LogFile& operator=(const LogFile&) = delete;
+
+  // Stages bytes for appending; returns the file position they will land at.
+  // Writer only (callers serialize appends).
+  // Writes out what is already staged first once the buffer is full; if
+  // that throws, nothing of data is staged.
+  uint64_t append(const void* data, size_t len);
+  // Drops the bytes staged from pos on, undoing appends that have not been
+  // written out since (pos at or past size() is a no-op).
+  void unstage(uint64_t pos);
+  void flush();
+  void sync();  // fdatasync; may run without the writer's lock
+
+  // flush() of several files (null ones skipped) as one disk_io batch.
+  // Throws the first failure once all are done; the files that failed keep
+  // their staged bytes.
+  static void flush_all(std::initializer_list<LogFile*> files);
+  // sync() of several files as one batch, so the device works on them
+  // together; returns whether each succeeded.
+  static std::vector<bool> sync_all(const std::vector<LogFile*>& files);
+  // Drops staged bytes and cuts the file to size (recovery, and the bytes
+  // of a failed Batch fsync). Not while readers may touch bytes past size.
+  void truncate(uint64_t size);
+
+  uint64_t size() const { return size_; }          // including staged bytes
+  uint64_t flushed_size() const { return flushed_.load(std::memory_order_relaxed); } // any thread
+
+  // Reads up to len bytes at pos; returns the number of bytes read (short
+  // only at end of file).
+  size_t read_at(uint64_t pos, void* buf, size_t len) const;
+
+  const std::string& path() const { return path_; }
+  uint64_t id() const { return id_; } // unique among the files opened by this process
+  int fd() const { return fd_; } // for sendfile(); flushed bytes only
+
+private:
+  static constexpr size_t kFlushThreshold = 64 * 1024;
+
+  std::string path_;
+  uint64_t id_;
+  int fd_ = -1;
+  std::string buf_;
+  uint64_t size_ = 0;
+  std::atomic<uint64_t> flushed_{0};
+};
+
+// true if name is non-empty and all decimal digits, like the numbers that
+// name segment files, partition directories and offset log generations
+bool all_digits(std::string_view name);
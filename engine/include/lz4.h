@@ -0,0 +1,13 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// Self-contained LZ4 block format codec (no frame format): compatible with
+// LZ4_compress_default / LZ4_decompress_safe, so clients may use liblz4.
+
+// Appends the compressed form of src to out.
+void lz4_compress(const char* src, size_t len, std::string& out);
+
+// Decompresses a block that must expand to exactly dst_len bytes. Returns
+// false on malformed input; never reads or writes out of bounds.
+bool lz4_decompress(const char* src, size_t len, char* dst, size_t dst_len);
@@ -0,0 +1,98 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "json.hpp"
+
+// Engine-wide counters and latency histograms. Each thread records into a
+// slab of its own with plain relaxed stores: no locks, no read-modify-write
+// instructions, no cache lines shared between writers. A snapshot sums the
+// slabs (plus those of threads that have exited).
+//
+// Histograms are log-linear like HdrHistogram: values (nanoseconds) fall in
+// 16 sub-buckets per power of two, so a quantile read from them is within
+// about 3% of the true value.
+namespace metrics {
+
+enum Counter : uint8_t {
+  kProduceRecords,
+  kProduceBytes,
+  kFetchRecords,
+  kFetchBytes,
+  kCommits,
+  kRequests,
+  kDiskWriteBytes,
+  kDiskSyncs,
+  kTailHits,         // partition reads served from the tail buffer
+  kTailMisses,       // ... and from the segment files
+  kBlockCacheHits,
+  kBlockCacheMisses,
+  kCounterCount
+};
+
+enum Histogram : uint8_t {
+  kProduce,     // GlobalStore::produce / produce_batch, durability wait included
+  kFetch,       // GlobalStore::fetch / locate_frames
+  kCommit,      // GlobalStore::commit_offset
+  kDiskWrite,   // LogFile::flush (write())
+  kDiskSync,    // LogFile::sync (fdatasync())
+  kParse,       // NDJSON request parse
+  kSerialize,   // NDJSON response serialization
+  kRequest,     // one request, start to response, on a worker
+  kHistogramCount
+};
+
+const char* counter_name(Counter c);
+const char* histogram_name(Histogram h);
+
+void add(Counter c, uint64_t n = 1);
+void record(Histogram h, uint64_t ns);
+
+inline uint64_t now_ns() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Records the lifetime of the scope into a histogram.
+class Timer {
+public:
+  explicit Timer(Histogram h) : h_(h), start_(now_ns()) {}
+  ~Timer() { record(h_, now_ns() - start_); }
+
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+private:
+  Histogram h_;
+  uint64_t start_;
+};
+
+inline constexpr int kSubBits = 4;
+inline constexpr size_t kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+struct HistogramSnapshot {
+  uint64_t count = 0, sum_ns = 0, max_ns = 0;
+  std::vector<uint64_t> buckets = std::vector<uint64_t>(kBuckets);
+
+  uint64_t quantile_ns(double q) const; // q in [0, 1]; 0 if empty
+};
+
+struct Snapshot {
+  uint64_t counters[kCounterCount] = {};
+  HistogramSnapshot histograms[kHistogramCount];
+};
+
+Snapshot snapshot();
+
+// Point-in-time values the caller samples, e.g. queue depths.
+using Gauges = std::vector<std::pair<std::string, uint64_t>>;
+
+// {"counters": {...}, "gauges": {...}, "latency_us": {name: {count, mean, p50, ...}}}
+nlohmann::json to_json(const Snapshot& s, const Gauges& gauges);
+// Prometheus text exposition format, version 0.0.4
+std::string to_prometheus(const Snapshot& s, const Gauges& gauges);
+
+} // namespace metrics
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "log_file.h"
+#include "string_map.h"
+
+// Committed consumer group offsets. The table lives in memory; every commit
+// is one small record appended to a commit log, so its cost does not depend
+// on how many groups and topics exist. Once the log grows past
+// kSnapshotBytes the store switches to a new log and writes the table as a
+// snapshot; older logs and snapshots are then deleted.
+//
+// Files in dir, per generation N (20 digits):
+//   N.log       commits made since generation N started
+//   N.snapshot  the whole table as of the start of N.log
+// Both start with an 8-byte header "POFS" [u32 format version] and hold
+// records [u32 crc][u16 glen][u16 tlen][u32 partition][u64 next_offset][group][topic]
+// (little-endian), crc being the CRC32C of everything after it. Loading
+// reads the newest snapshot and replays the logs from its generation on;
+// each file is read up to its first torn or corrupt record, and the active
+// log is cut there. A file without the header fails the load.
+class OffsetStore {
+public:
+  static constexpr uint64_t kSnapshotBytes = 4ULL << 20;
+  // partitions per topic a record may name; more than any topic can have
+  static constexpr uint32_t kMaxPartitions = 4096;
+
+  // topic -> committed next_offset per partition
+  using GroupOffsets = StringMap<std::vector<uint64_t>>;
+
+  // legacy_json: the pre-log _offsets.json; imported once, then removed.
+  OffsetStore(const std::string& dir, const std::string& legacy_json);
+
+  OffsetStore(const OffsetStore&) = delete;
+  OffsetStore& operator=(const OffsetStore&) = delete;
+
+  // Returns false if group or topic is too long to record.
+  bool commit(std::string_view group, std::string_view topic, int partition, uint64_t next_offset);
+  uint64_t get(std::string_view group, std::string_view topic, int partition) const;
+  GroupOffsets group(const std::string& group) const;
+
+  // Called periodically: rolls to a new generation and snapshots the table
+  // if the current log has grown large enough.
+  void maybe_snapshot();
+
+private:
+  using Table = StringMap<GroupOffsets>;
+
+  std::string path_for(uint64_t gen, const char* ext) const;
+  void apply(std::string_view group, std::string_view topic, uint32_t partition, uint64_t next_offset);
+  uint64_t replay(const std::string& path); // returns bytes of the header and the intact records
+  std::unique_ptr<LogFile> open_log(uint64_t gen) const; // with its header written
+  void import_json(const std::string& path);
+  void write_snapshot(uint64_t gen, const Table& table) const;
+  void remove_before(uint64_t gen) const;
+
+  std::string dir_;
+  mutable std::mutex mu_;
+  Table table_;
+  std::unique_ptr<LogFile> log_;
+  uint64_t gen_ = 1;
+
+  std::mutex snapshot_mu_; // one snapshot at a time
+};
@@ -0,0 +1,121 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "json.hpp"
+#include "record.h"
+#include "string_map.h"
+
+// Continuous aggregation attached to a topic. Every record appended to the
+// topic is folded into the operator's current window as it is produced, so
+// a query or an emitted window costs a merge of a few panes rather than a
+// scan of the log.
+//
+// Windows are made of panes slide_ms long: a window covers window_ms /
+// slide_ms consecutive panes and a new one closes at every pane boundary
+// (tumbling when slide_ms == window_ms). Each pane keeps count, sum, min,
+// max and a quantile sketch per group key.
+struct OperatorSpec {
+  std::string name;
+  uint64_t window_ms = 60000;
+  uint64_t slide_ms = 0;        // 0 = window_ms (tumbling)
+  std::string field;            // numeric field of a JSON value; empty = the value is a number
+  bool by_key = false;          // one aggregate per record key instead of one per topic
+  std::string output_topic;     // closed windows are produced here; empty = query only
+};
+
+// Reads a CREATE_OPERATOR request (or a stored spec). Returns false with err set.
+bool operator_spec_from_json(const nlohmann::json& j, OperatorSpec& spec, std::string& err);
+nlohmann::json operator_spec_to_json(const OperatorSpec& spec);
+
+// Log-bucketed quantile sketch: values land in buckets whose bounds grow by
+// a factor of (1 + a) / (1 - a), so any quantile is within relative error a
+// of the true value, in memory that grows with the value range only.
+class QuantileSketch {
+public:
+  static constexpr double kRelativeError = 0.01;
+
+  void add(double v);
+  void merge(const QuantileSketch& other);
+  double quantile(double q) const; // q in [0, 1]; 0 if empty
+  uint64_t count() const { return count_; }
+
+private:
+  int bucket(double v) const;        // v > 0
+  double value_of(int bucket) const;
+
+  std::map<int, uint64_t> positive_, negative_; // negative_ is keyed by the bucket of -v
+  uint64_t zero_ = 0;
+  uint64_t count_ = 0;
+};
+
+struct WindowAggregate {
+  uint64_t count = 0;     // records
+  uint64_t numeric = 0;   // records with a numeric value
+  double sum = 0;
+  double min = 0, max = 0;
+  QuantileSketch sketch;
+
+  void add(const double* v);  // nullptr: record without a numeric value
+  void merge(const WindowAggregate& other);
+  nlohmann::json to_json() const;
+};
+
+// Parses the value (or its top-level `"field": <number>`) as a number.
+bool extract_number(std::string_view value, std::string_view field, double& out);
+
+class StreamOperator {
+public:
+  static constexpr size_t kMaxKeys = 100000;       // further keys aggregate under kOverflowKey
+  static constexpr const char* kOverflowKey = "__other__";
+  static constexpr uint64_t kMaxPanes = 1000;      // window_ms / slide_ms
+
+  // A closed window to append to the output topic.
+  struct Output {
+    std::string key;
+    std::string value;
+  };
+
+  explicit StreamOperator(OperatorSpec spec);
+
+  StreamOperator(const StreamOperator&) = delete;
+  StreamOperator& operator=(const StreamOperator&) = delete;
+
+  const OperatorSpec& spec() const { return spec_; }
+
+  // Folds appended records into the current pane. Windows that closed
+  // before now_ms are added to out when the spec has an output topic.
+  void add(const KeyValue* recs, size_t n, uint64_t now_ms, std::vector<Output>& out);
+  // Closes windows when no records arrive. Called periodically.
+  void tick(uint64_t now_ms, std::vector<Output>& out);
+
+  // The window ending at the current pane's end, as of now_ms.
+  nlohmann::json query(uint64_t now_ms) const;
+
+private:
+  struct Pane {
+    uint64_t start = 0;
+    WindowAggregate agg;
+  };
+  void advance_locked(uint64_t now_ms, std::vector<Output>& out);
+  void emit_locked(uint64_t window_end, std::vector<Output>& out) const;
+  WindowAggregate window_locked(const std::deque<Pane>& panes, uint64_t window_end) const;
+  nlohmann::json window_json(uint64_t window_end) const;
+
+  OperatorSpec spec_;
+  uint64_t slide_ms_;
+
+  mutable std::mutex mu_;
+  StringMap<std::deque<Pane>> keys_;
+  uint64_t current_pane_ = 0; // start of the pane records go to
+};
+
+// Operators attached to a topic, stored in <topic dir>/_operators.json.
+std::vector<OperatorSpec> load_operator_specs(const std::string& topic_dir);
+void save_operator_specs(const std::string& topic_dir, const std::vector<OperatorSpec>& specs);
@@ -0,0 +1,238 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "log_file.h"
+#include "record.h"
+#include "record_cache.h"
+#include "record_filter.h"
+#include "topic_config.h"
+
+// Sparse index entry: the record with this offset starts at file position pos.
+struct IndexEntry {
+  uint64_t offset = 0;
+  uint64_t pos = 0;
+};
+
+// Time index entry: every record of the segment before offset was appended
+// at or before ts. ts is the running maximum, so entries never go back in
+// time even when the wall clock does.
+struct TimeIndexEntry {
+  uint64_t ts = 0;
+  uint64_t offset = 0;
+};
+
+// Sparse index of one segment: an entry for its first record, then one for
+// the first record past every kIndexIntervalBytes of log. Entries that were
+// on disk when the segment was opened are read straight from the mmap'd
+// index file; entries added later by the writer go to fixed-size chunks, so
+// readers take a snapshot and never block the writer.
+template <typename Entry>
+class SparseIndex {
+public:
+  static constexpr unsigned kChunkBits = 10;
+  static constexpr uint64_t kChunkSize = 1ULL << kChunkBits;
+
+  using Chunks = std::vector<std::shared_ptr<Entry[]>>;
+
+  struct Snapshot {
+    const Entry* mapped = nullptr;
+    uint64_t mapped_count = 0;
+    std::shared_ptr<const Chunks> chunks;
+    uint64_t size = 0;
+
+    Entry at(uint64_t i) const {
+      if (i < mapped_count) return mapped[i];
+      i -= mapped_count;
+      return (*chunks)[i >> kChunkBits][i & (kChunkSize - 1)];
+    }
+    // number of leading entries for which below(entry) holds; entries are
+    // ordered, so those are a prefix
+    template <typename Below>
+    uint64_t count_below(Below below) const {
+      uint64_t lo = 0, hi = size;
+      while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (below(at(mid))) lo = mid + 1;
+        else hi = mid;
+      }
+      return lo;
+    }
+  };
+
+  SparseIndex();
+  ~SparseIndex();
+
+  SparseIndex(const SparseIndex&) = delete;
+  SparseIndex& operator=(const SparseIndex&) = delete;
+
+  // Maps the first count entries of an index file. Before the segment is shared only.
+  void map(int fd, uint64_t count);
+
+  uint64_t size() const { return mapped_count_ + appended_.load(std::memory_order_acquire); }
+  Snapshot snapshot() const;
+  void push_back(const Entry& e); // writer only
+
+private:
+  const Entry* mapped_ = nullptr;
+  uint64_t mapped_count_ = 0;
+  std::atomic<std::shared_ptr<const Chunks>> chunks_; // replaced when a chunk is added
+  std::atomic<uint64_t> appended_{0};
+};
+
+using OffsetIndex = SparseIndex<IndexEntry>;
+using TimeIndex = SparseIndex<TimeIndexEntry>;
+
+// One file of a partition log, named after the first offset it may hold
+// (<20-digit base offset>.log, with its sparse indexes in <base>.index and
+// <base>.timeindex). Only the newest segment is appended to; older ones are
+// immutable until retention deletes or compaction rewrites them as a whole.
+struct Segment {
+  static constexpr uint64_t kIndexIntervalBytes = 4096;
+
+  uint64_t base_offset = 0;
+  std::shared_ptr<LogFile> file;
+  OffsetIndex index;
+  TimeIndex time_index;                // one entry per index entry, same offsets
+  std::atomic<uint64_t> end_offset{0}; // offset after the last published record
+  std::atomic<uint64_t> end_pos{0};    // file position after it (published before end_offset)
+  std::atomic<uint64_t> max_ts{0};
+
+  // writer only (active segment)
+  std::unique_ptr<LogFile> index_file, time_index_file;
+  uint64_t last_indexed_pos = 0;       // 0 = nothing indexed yet
+
+  // file position to start a forward scan for offset from
+  uint64_t seek(uint64_t offset) const;
+  // offset to start a forward scan for the first record at or after ts from
+  uint64_t seek_time(uint64_t ts) const;
+};
+
+// One partition: an ordered list of segments plus the append path with its
+// durability handling. Appends serialize on the partition lock; readers work
+// from an immutable snapshot of the segment list and never block them.
+class PartitionLog {
+public:
+  // Opens (or creates) the partition in dir. A legacy single-file log at
+  // legacy_path is converted into the first segment.
+  PartitionLog(const std::string& dir, const std::string& legacy_path, const TopicConfig& cfg);
+
+  PartitionLog(const PartitionLog&) = delete;
+  PartitionLog& operator=(const PartitionLog&) = delete;
+
+  // Appends records under one lock and returns the offset of the first once
+  // the topic's durability level is reached.
+  uint64_t append(const KeyValue* recs, size_t n);
+  // appends in progress, waiting ones included
+  uint32_t queue_depth() const { return queued_.load(std::memory_order_relaxed); }
+
+  // Reads of records still in the tail buffer touch no file; older ones go
+  // through the block cache.
+  //
+  // Copies up to limit records at or after offset into out. With a filter
+  // only matching records are copied (and only the projected parts), and
+  // the scan stops after kMaxFilterScan bytes; out.next_offset is where the
+  // next read resumes either way. With verify, every record's crc is
+  // checked and the read stops before the first that fails (out.corrupt).
+  static constexpr uint64_t kMaxFilterScan = 16 << 20;
+  void read(uint64_t offset, int limit, FetchResult& out, const RecordFilter* filter = nullptr,
+            bool verify = false) const;
+
+  // Locates up to limit records (at most max_bytes, but always at least one)
+  // at or after offset without reading them. The range never spans two
+  // segments, or two chunks of the tail buffer.
+  FrameRange locate(uint64_t offset, int limit, uint64_t max_bytes) const;
+
+  uint64_t start_offset() const;
+  uint64_t end_offset() const;
+  // Offset of the first record appended at or after ts_ms, or the end
+  // offset if there is none yet.
+  uint64_t offset_for_time(uint64_t ts_ms) const;
+  uint64_t size_bytes() const;
+  size_t segment_count() const;
+  uint64_t tail_bytes() const { return tail_.bytes(); }
+
+  // Calls fn once the end offset passes after_offset: right away (returning
+  // 0) if it already has, otherwise on the appending thread right after the
+  // records are published. fn must be cheap and must not append. The token
+  // returned cancels it via unwatch().
+  uint64_t watch(uint64_t after_offset, std::function<void()> fn);
+  void unwatch(uint64_t token);
+
+  // Interval durability: the active segment's file if it is dirty and the
+  // interval has elapsed, for the caller to fsync (along with those of other
+  // partitions) and report back through sync_done(); otherwise null. Lowers
+  // next_due to when it next needs a call.
+  std::shared_ptr<LogFile> sync_due(uint64_t now_ms, uint64_t& next_due);
+  void sync_done(bool ok); // a failed fsync is retried at the next call
+
+  // Deletes whole segments past retention_ms / retention_bytes.
+  void enforce_retention(uint64_t now_ms);
+  // Rewrites closed segments keeping only the latest record per key.
+  void compact();
+
+private:
+  using SegmentList = std::vector<std::shared_ptr<Segment>>;
+
+  std::shared_ptr<Segment> open_segment(const std::string& path, uint64_t base_offset);
+  std::shared_ptr<Segment> create_segment(uint64_t base_offset);
+  std::string segment_path(uint64_t base_offset) const;
+  void convert_legacy(const std::string& legacy_path);
+  void upgrade_segment(const std::string& path);
+  void roll_locked();
+  void sync_pending_locked(std::unique_lock<std::mutex>& lock);
+  void fail_sync_locked(Segment& seg);
+  void check_failed_locked() const; // throws once a Batch round has failed
+  void flush_pending_locked();
+  void unstage_locked(Segment& seg);
+  void publish(SegmentList list);
+  void notify_watchers(uint64_t end_offset);
+
+  std::string dir_;
+  TopicConfig cfg_;
+
+  std::atomic<std::shared_ptr<const SegmentList>> segments_; // oldest first; back() is active
+  TailBuffer tail_; // the newest frames, copied in as they are staged
+
+  std::mutex append_mu_;        // serializes appends and segment list changes
+  std::atomic<uint32_t> queued_{0};
+  std::shared_ptr<Segment> active_;
+  uint64_t next_offset_ = 0;    // offset the next staged record gets
+
+  // records staged in the active segment but not yet published (Batch: not
+  // yet written+fsynced), and the index entries that come with them
+  struct PendingIndex {
+    IndexEntry index;
+    TimeIndexEntry time;
+  };
+  std::condition_variable synced_cv_;
+  std::vector<PendingIndex> pending_index_;
+  uint64_t appended_seq_ = 0;
+  uint64_t durable_seq_ = 0;
+  bool syncing_ = false;
+  bool failed_ = false; // appends refused; see fail_sync_locked() and unstage_locked()
+
+  // Interval: written since the last background fsync
+  bool dirty_ = false;
+  uint64_t last_sync_ms_ = 0;
+
+  // compaction: end of the closed segments at the last pass
+  uint64_t compacted_end_ = 0;
+
+  // long-polling readers waiting for the end offset to pass a mark
+  struct Watcher {
+    uint64_t after_offset;
+    std::function<void()> fn;
+  };
+  std::mutex watch_mu_;
+  std::unordered_map<uint64_t, Watcher> watchers_;
+  std::atomic<size_t> watcher_count_{0}; // lets appends skip watch_mu_ when nobody waits
+  uint64_t next_watch_ = 1;
+};
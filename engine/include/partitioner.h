@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+// How a topic spreads the records of a produce that names no partition.
+// Keyed records always go to hash(key) % partitions; the strategies differ
+// in where keyless records go:
+//   Hash      - each produce to the next partition in turn (round robin)
+//   Sticky    - one partition until sticky_bytes have gone to it, then the
+//               next, so keyless producers build large batches there
+//   LoadAware - the partition with the fewest appends in flight
+//   Explicit  - nowhere: every produce must name its partition
+enum class Partitioning { Hash, Sticky, LoadAware, Explicit };
+enum class KeyHash { Fnv1a, Murmur2 };
+
+bool parse_partitioning(const std::string& s, Partitioning& out);
+const char* partitioning_name(Partitioning p);
+bool parse_key_hash(const std::string& s, KeyHash& out);
+const char* key_hash_name(KeyHash h);
+
+uint64_t fnv1a_64(std::string_view s);
+uint64_t murmur2_64(std::string_view s); // MurmurHash64A, seed 0
+
+// Per-topic partition choice. Thread-safe; the shared state is a few
+// relaxed atomics, so concurrent producers never wait on each other here.
+class Partitioner {
+public:
+  // depth(p) is the number of appends queued on partition p (LoadAware)
+  Partitioner(Partitioning kind, KeyHash hash, uint64_t sticky_bytes, int partitions,
+              std::function<uint32_t(int)> depth);
+
+  Partitioner(const Partitioner&) = delete;
+  Partitioner& operator=(const Partitioner&) = delete;
+
+  bool needs_partition() const { return kind_ == Partitioning::Explicit; }
+
+  int for_key(std::string_view key) const;
+  // Partition for the keyless records of one produce, bytes long in total.
+  // Explicit topics get -1.
+  int for_keyless(uint64_t bytes);
+
+private:
+  Partitioning kind_;
+  KeyHash hash_;
+  uint64_t sticky_bytes_;
+  int partitions_;
+  std::function<uint32_t(int)> depth_;
+
+  std::atomic<uint64_t> rr_{0};
+  std::atomic<int> sticky_{0};
+  std::atomic<uint64_t> sticky_used_{0}; // bytes sent to sticky_ so far
+};
@@ -0,0 +1,126 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "crc32c.h"
+
+class LogFile;
+
+// Segment file layout: an 8-byte header "PSEG" [u32 format version],
+// followed by record frames
+//   [u64 offset][u64 ts_ms][u32 klen][u32 vlen][u32 crc][key][value]
+// All integers are little-endian. Frames carry their own offset, so a
+// compacted segment can skip offsets and still be read sequentially. crc
+// is the CRC32C of the first 24 header bytes, the key and the value.
+//
+// A batch frame holds several records compressed together:
+//   [u64 base_offset][u64 ts_ms][u32 kBatchFlag | codec][u32 len][u32 crc]
+//   [u32 count][u32 last_delta][u32 raw_len][compressed records]
+// with the len bytes after the header covered by crc. Decompressed, the
+// records are count x [u32 offset_delta][u32 klen][u32 vlen][key][value],
+// offsets base_offset + offset_delta, all appended at ts_ms.
+//
+// Version 1 frames had no crc; such segments are rewritten when opened.
+// Version 2 segments hold no batches but are otherwise the same.
+namespace record_format {
+
+inline constexpr char kSegmentMagic[4] = {'P', 'S', 'E', 'G'};
+inline constexpr uint32_t kVersion = 3;
+inline constexpr size_t kSegmentHeaderSize = 8;
+inline constexpr size_t kHeaderSize = 28;
+inline constexpr size_t kCrcPos = 24;
+inline constexpr uint32_t kMaxKey = 10 * 1024 * 1024;
+inline constexpr uint32_t kMaxValue = 50 * 1024 * 1024;
+inline constexpr uint32_t kBatchFlag = 0x80000000u;
+inline constexpr size_t kBatchPrefix = 12; // count, last_delta, raw_len
+
+inline uint32_t frame_crc(const char* header, std::string_view key, std::string_view value) {
+  return crc32c(value.data(), value.size(), crc32c(key.data(), key.size(), crc32c(header, kCrcPos)));
+}
+
+inline void encode_header(char* out, uint64_t offset, uint64_t ts, std::string_view key, std::string_view value) {
+  uint32_t klen = (uint32_t)key.size(), vlen = (uint32_t)value.size();
+  std::memcpy(out, &offset, 8);
+  std::memcpy(out + 8, &ts, 8);
+  std::memcpy(out + 16, &klen, 4);
+  std::memcpy(out + 20, &vlen, 4);
+  uint32_t crc = frame_crc(out, key, value);
+  std::memcpy(out + kCrcPos, &crc, 4);
+}
+
+// true if a whole stored frame matches its crc
+inline bool frame_intact(std::string_view frame) {
+  if (frame.size() < kHeaderSize) return false;
+  uint32_t stored;
+  std::memcpy(&stored, frame.data() + kCrcPos, 4);
+  return crc32c(frame.data() + kHeaderSize, frame.size() - kHeaderSize, crc32c(frame.data(), kCrcPos)) == stored;
+}
+
+// Frame length from its header, or 0 if the header is implausible.
+inline uint64_t frame_size(const char* header) {
+  uint32_t klen, vlen;
+  std::memcpy(&klen, header + 16, 4);
+  std::memcpy(&vlen, header + 20, 4);
+  if (klen & kBatchFlag) return vlen >= kBatchPrefix && vlen <= kMaxValue ? kHeaderSize + vlen : 0;
+  if (klen > kMaxKey || vlen > kMaxValue) return 0;
+  return kHeaderSize + klen + vlen;
+}
+
+} // namespace record_format
+
+// Compression of batch frames; the value is stored in the frame header.
+enum class Codec : uint8_t { None = 0, Lz4 = 1 };
+
+struct KeyValue {
+  std::string_view key;
+  std::string_view value;
+};
+
+// Contiguous offsets [base_offset, base_offset + count) appended to one partition.
+struct AppendedRange {
+  int partition = 0;
+  uint64_t base_offset = 0;
+  uint64_t count = 0;
+};
+
+struct FetchedRecord {
+  uint64_t offset = 0;
+  uint64_t ts_ms = 0;
+  size_t key_pos = 0, key_len = 0;     // into FetchResult::data
+  size_t value_pos = 0, value_len = 0;
+};
+
+// Records are returned as a flat list plus one buffer holding all keys and
+// values back to back, so a fetch does a single growing allocation instead
+// of one JSON object per record.
+struct FetchResult {
+  std::vector<FetchedRecord> records;
+  std::string data;
+  uint64_t next_offset = 0;
+  bool keys = true, values = true; // false when projected away by a filter
+  bool corrupt = false;            // verifying read stopped at a record failing its crc
+
+  std::string_view key(const FetchedRecord& r) const { return std::string_view(data).substr(r.key_pos, r.key_len); }
+  std::string_view value(const FetchedRecord& r) const { return std::string_view(data).substr(r.value_pos, r.value_len); }
+};
+
+// A run of frames holding count records, stored as bytes
+// [pos, pos + len) of one segment file. Holding the range keeps the file
+// open (even if retention deletes it), so it can be sent to a socket later
+// without copying. Frames found in the partition's tail buffer are bytes of
+// one of its chunks instead (mem, kept alive by the range; file is null).
+struct FrameRange {
+  std::shared_ptr<const LogFile> file;
+  std::shared_ptr<const char[]> mem;
+  uint64_t pos = 0, len = 0;
+  uint64_t first_offset = 0; // a leading batch may start before it
+  uint64_t count = 0;        // records
+  uint64_t frames = 0;
+  bool batches = false;      // some frames are compressed batches
+  uint64_t next_offset = 0;
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "record.h"
+
+// Compressed record batches: several records stored (and shipped to
+// clients that accept them) as one frame. See record.h for the layout.
+
+struct BatchRecord {
+  uint64_t offset = 0;
+  std::string_view key, value;
+};
+
+bool parse_codec(const std::string& s, Codec& out);
+const char* codec_name(Codec c);
+
+// Appends the payload of a batch frame holding recs, whose offsets ascend
+// and are stored relative to recs[0].offset. Returns false (out unchanged)
+// if the batch would not be smaller than the records as separate frames.
+bool encode_batch_payload(Codec codec, const BatchRecord* recs, size_t n, std::string& out);
+
+// Fills the frame header for a batch payload, crc included.
+void encode_batch_header(char* header, uint64_t base_offset, uint64_t ts, Codec codec, std::string_view payload);
+
+// Decompresses a batch payload into scratch and lists its records, whose
+// views point into scratch. Returns false if the payload is malformed.
+bool decode_batch_payload(uint64_t base_offset, Codec codec, std::string_view payload,
+                          std::string& scratch, std::vector<BatchRecord>& out);
@@ -0,0 +1,129 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "log_file.h"
+
+// The newest frames of a partition, byte for byte as in its segments, so
+// that consumers near the end of the log are served from memory. Frames
+// are copied in as they are staged, in offset order, into chunks that are
+// only ever appended to; readers take a snapshot of the chunk list and read
+// whole frames below the partition's published end offset, so they never
+// block the writer. Once the chunks hold more than the capacity the oldest
+// ones are dropped (readers still holding them keep them alive), and so are
+// those compaction has rewritten on disk.
+class TailBuffer {
+public:
+  struct Chunk {
+    std::shared_ptr<char[]> data;
+    size_t capacity = 0;
+    uint64_t first_offset = 0;   // of its first frame
+    std::atomic<size_t> used{0}; // bytes of whole frames
+
+    std::string_view frames() const { return {data.get(), used.load(std::memory_order_acquire)}; }
+  };
+  using Chunks = std::vector<std::shared_ptr<const Chunk>>;
+
+  // capacity in bytes; 0 keeps nothing
+  explicit TailBuffer(uint64_t capacity);
+
+  TailBuffer(const TailBuffer&) = delete;
+  TailBuffer& operator=(const TailBuffer&) = delete;
+
+  // Writer only: copies one frame (its parts back to back) whose first
+  // record has offset. A frame larger than the capacity empties the buffer.
+  void append(uint64_t offset, std::string_view a, std::string_view b, std::string_view c = {});
+  // Writer only: drops every chunk holding frames below offset, so that
+  // reads of those offsets go to the segments.
+  void drop_before(uint64_t offset);
+  // Writer only: drops every chunk (staged frames that were never published
+  // and are to be appended again under the same offsets).
+  void clear();
+
+  std::shared_ptr<const Chunks> snapshot() const { return chunks_.load(std::memory_order_acquire); }
+  // index of the chunk holding the frame with offset, or chunks.size() if
+  // offset is older than the buffer
+  static size_t find(const Chunks& chunks, uint64_t offset);
+
+  uint64_t bytes() const { return held_.load(std::memory_order_relaxed); }
+
+private:
+  uint64_t capacity_;
+  size_t chunk_size_;
+  std::atomic<std::shared_ptr<const Chunks>> chunks_; // oldest first
+  std::shared_ptr<Chunk> current_;                    // writer: back() of chunks_
+  std::atomic<uint64_t> held_{0};                     // capacity of the chunks listed
+};
+
+// LRU cache of fixed-size blocks of segment files, shared by all
+// partitions, for the reads the tail buffers do not cover. Only the flushed
+// part of a file is cached: those bytes never change (a file is only ever
+// appended to; compaction and upgrades write new files), so entries need no
+// invalidation and those of deleted files just age out. A file's last block
+// is cached as far as it goes and read again once a reader needs more of
+// it. Blocks missed are read in one batch, with the next kReadahead blocks
+// for a reader working forward. Split into shards, each with its own lock
+// and LRU list.
+class BlockCache {
+public:
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  static BlockCache& instance();
+
+  // 0 (the default) disables the cache. Before serving only.
+  void set_capacity(uint64_t bytes);
+  uint64_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+  uint64_t bytes() const;
+
+  // Like file.read_at(), through the cache where it can.
+  size_t read(const LogFile& file, uint64_t pos, void* buf, size_t len);
+
+private:
+  static constexpr size_t kShards = 16;
+
+  struct Key {
+    uint64_t file = 0, block = 0;
+    bool operator==(const Key&) const = default;
+  };
+  struct KeyHash {
+    size_t operator()(const Key& k) const { return (size_t)((k.file * 0x9E3779B97F4A7C15ULL) ^ k.block); }
+  };
+  struct Entry {
+    Key key;
+    std::shared_ptr<const char[]> data;
+    size_t size = 0; // bytes of the block read
+  };
+  struct Shard {
+    mutable std::mutex mu;
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map;
+    uint64_t bytes = 0;
+  };
+
+  static constexpr uint64_t kReadahead = 2; // blocks read along with a miss
+
+  // a block to read, for slot of the blocks being looked up (SIZE_MAX: readahead)
+  struct Load {
+    uint64_t index;
+    size_t slot;
+  };
+
+  Shard& shard_of(const Key& key) { return shards_[KeyHash{}(key) % kShards]; }
+  // the block if it is cached with at least need bytes
+  std::shared_ptr<const char[]> find(const LogFile& file, uint64_t index, size_t need);
+  bool contains(const LogFile& file, uint64_t index) const;
+  // reads the blocks in one disk_io batch and caches them
+  void load(const LogFile& file, uint64_t flushed, const std::vector<Load>& loads,
+            std::vector<std::shared_ptr<const char[]>>& blocks);
+  void insert(const Key& key, std::shared_ptr<const char[]> data, size_t size);
+
+  std::atomic<uint64_t> capacity_{0};
+  Shard shards_[kShards];
+};
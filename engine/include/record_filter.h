@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+#include "json.hpp"
+#include "string_map.h"
+
+// Predicates a FETCH applies while it scans the log, plus which parts of a
+// matching record it returns. All predicates that are set must hold.
+//
+//   key / key_prefix / keys   exact key, key prefix, or key in a set
+//   ts_from, ts_to            append time in [ts_from, ts_to)
+//   contains                  value contains these bytes
+//   field + equals            the value (a flat JSON object) has "field": equals
+struct RecordFilter {
+  enum class Projection { All, Keys, Meta }; // Keys: no values; Meta: offsets and timestamps only
+
+  bool has_key = false;
+  std::string key;
+  std::string key_prefix;
+  std::unordered_set<std::string, StringHash, std::equal_to<>> keys;
+  uint64_t ts_from = 0, ts_to = UINT64_MAX;
+  std::string contains;
+  std::string field;
+  std::string field_token;   // JSON text of `equals` as it appears in the value
+  double field_number = 0;
+  bool field_is_number = false;
+
+  Projection projection = Projection::All;
+
+  // true if no predicate is set (the projection may still be)
+  bool match_all() const;
+  bool matches(uint64_t ts, std::string_view key, std::string_view value) const;
+};
+
+// Reads "filter" and "project" of a FETCH request. Returns false with err set.
+bool record_filter_from_json(const nlohmann::json& req, RecordFilter& filter, std::string& err);
+
+// Position of the first occurrence of needle in hay, or npos. Vectorized
+// (16 bytes per step) where SSE2 is available.
+size_t find_bytes(std::string_view hay, std::string_view needle);
+
+// The value token that follows the first `"field":` in a flat JSON object
+// (a number, literal, or quoted string with its quotes), or empty if absent.
+std::string_view json_field_token(std::string_view value, std::string_view field);
@@ -1,14 +1,101 @@
 #pragma once
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "metrics.h"
+
+struct ServerConfig {
+  uint16_t port = 9000;
+  int io_threads = 0;       // epoll loops; 0 = derive from core count
+  int worker_threads = 0;   // store work; 0 = derive from core count
+  int max_connections = 1024;
+  size_t max_request_bytes = 2 * 1024 * 1024;
+  size_t max_queued_requests = 256; // per connection; reading pauses beyond this
+};
+
+class IoLoop;
+class LogFile;
+class WorkerPool;
+
+// What request handlers produce: response bytes, plus (for zero-copy
+// fetches) ranges of partition log files that go to the socket with
+// sendfile() instead of being copied through user space.
+class ResponseBuffer {
+public:
+  struct Chunk {
+    std::string data;
+    std::shared_ptr<const LogFile> file; // set for a file range
+    uint64_t file_pos = 0, file_len = 0;
+    uint64_t size() const { return file ? file_len : data.size(); }
+  };
+
+  std::string& text(); // text chunk to append to
+  void append_file(std::shared_ptr<const LogFile> file, uint64_t pos, uint64_t len);
+
+  std::deque<Chunk>& chunks() { return chunks_; }
+
+private:
+  std::deque<Chunk> chunks_;
+};
+
+// Long-poll state of one FETCH / FETCH_GROUP. A handler given a FetchWait
+// may park its request instead of answering: it sets parked and what to
+// wait for, appends nothing, and the connection runs the request again
+// once the partition grows past after_offset or deadline_ms is reached.
+// After the deadline the handler answers with whatever there is.
+struct FetchWait {
+  uint64_t deadline_ms = 0;   // steady clock; set when the request first parks
+  bool parked = false;
+  std::string topic;
+  int partition = 0;
+  uint64_t after_offset = 0;
+};
+
+// A change to the subscriptions of an NDJSON connection. The handler
+// validates and acknowledges SUBSCRIBE / UNSUBSCRIBE / CREDIT; the
+// connection applies the op after the acknowledgement is queued, so pushed
+// records always follow it.
+struct StreamOp {
+  enum Kind { Subscribe, Unsubscribe, Credit };
+  Kind kind = Subscribe;
+  std::string topic;
+  std::vector<int> partitions;    // Subscribe
+  std::vector<uint64_t> offsets;  // Subscribe: first offset to push, per partition
+  uint64_t credit = 0;            // records the client accepts on top of what it already granted
+};
 
 class PulseStreamServer {
 public:
-  explicit PulseStreamServer(uint16_t port);
+  explicit PulseStreamServer(const ServerConfig& cfg);
   ~PulseStreamServer();
-  void run(); // blocking
+  void run(); // blocking; returns after stop()
+  void stop();
+
+  // Executes one NDJSON request and appends the response line to out.
+  // Without wait, long-poll fetches answer immediately; without stream,
+  // subscription requests are refused.
+  void handle_request(const std::string& line, std::string& out, FetchWait* wait = nullptr,
+                      std::vector<StreamOp>* stream = nullptr);
+  // Executes one binary frame (op + payload) and appends the response frame.
+  void handle_binary(std::string_view frame, ResponseBuffer& out, FetchWait* wait = nullptr);
+  // Answers one HTTP request head (a GET) with the Prometheus metrics page.
+  void handle_http(std::string_view request, std::string& out);
 
 private:
+  friend class IoLoop;
+
+  metrics::Gauges metrics_gauges() const;
+
+  ServerConfig cfg_;
   int listen_fd_;
-  uint16_t port_;
-  void handle_client(int client_fd);
+  std::atomic<bool> stopping_{false};
+  std::atomic<int> connections_{0};
+  std::unique_ptr<WorkerPool> workers_;
+  std::vector<std::unique_ptr<IoLoop>> loops_;
 };
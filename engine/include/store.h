@@ -1,55 +1,157 @@
 #pragma once
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <thread>
+#include <unordered_set>
 #include <vector>
 
+#include "group_coordinator.h"
 #include "json.hpp"
-
-struct FetchResult {
-  nlohmann::json records;   // JSON array
-  uint64_t next_offset;
-};
+#include "offset_store.h"
+#include "operators.h"
+#include "partition_log.h"
+#include "record.h"
+#include "record_filter.h"
+#include "string_map.h"
+#include "topic_config.h"
 
 class GlobalStore {
 public:
   static GlobalStore& instance();
+  ~GlobalStore();
+
+  bool create_topic(const std::string& topic, int partitions, const TopicConfig& cfg = {});
+
+  // Returns {partition, offset}. partition -1 lets the topic's partitioner
+  // pick one (see partitioner.h); {-1, 0} if the topic takes explicit
+  // partitions only, or partition is not one of the topic's.
+  std::pair<int, uint64_t> produce(std::string_view topic,
+                                  std::string_view key,
+                                  std::string_view value,
+                                  int partition = -1);
 
-  bool create_topic(const std::string& topic, int partitions);
+  // Appends many records with one locked append per partition touched.
+  // Keyed records are hashed to their partition; keyless records of one
+  // batch all go to the partition the partitioner picks for them. Empty
+  // if the topic takes explicit partitions only and none was given, or
+  // partition (other than -1) is not one of the topic's.
+  std::vector<AppendedRange> produce_batch(std::string_view topic,
+                                           const std::vector<KeyValue>& records,
+                                           int partition = -1);
 
-  // Returns {partition, offset}
-  std::pair<int, uint64_t> produce(const std::string& topic,
-                                  const std::string& key,
-                                  const std::string& value);
+  // Records at or after offset; with a filter only the matching ones (see PartitionLog::read).
+  FetchResult fetch(std::string_view topic, int partition, uint64_t offset, int limit,
+                    const RecordFilter* filter = nullptr, bool verify = false);
+  // Same, into out: cleared first, its buffers reused.
+  void fetch(std::string_view topic, int partition, uint64_t offset, int limit, FetchResult& out,
+             const RecordFilter* filter = nullptr, bool verify = false);
 
-  FetchResult fetch(const std::string& topic, int partition, uint64_t offset, int limit);
+  // Locates up to limit records (and at most max_bytes, but always at least
+  // one) without reading them; the bytes are the on-disk frames of one
+  // segment (see record.h).
+  FrameRange locate_frames(const std::string& topic, int partition, uint64_t offset,
+                           int limit, uint64_t max_bytes);
+
+  // 0 if the topic does not exist (unlike fetch, these do not create it)
+  int partition_count(std::string_view topic);
+  uint64_t start_offset(const std::string& topic, int partition);
+  uint64_t end_offset(std::string_view topic, int partition);
+  // first offset appended at or after ts_ms (see PartitionLog::offset_for_time)
+  uint64_t offset_for_time(const std::string& topic, int partition, uint64_t ts_ms);
+
+  // Long polling: calls fn once the partition's end offset passes
+  // after_offset (see PartitionLog::watch). Returns a token for unwatch(),
+  // or 0 if fn already ran or never will (no such partition).
+  uint64_t watch(const std::string& topic, int partition, uint64_t after_offset, std::function<void()> fn);
+  void unwatch(const std::string& topic, int partition, uint64_t token);
 
   // Consumer group offsets
-  bool commit_offset(const std::string& group, const std::string& topic, int partition, uint64_t next_offset);
-  uint64_t get_committed_offset(const std::string& group, const std::string& topic, int partition);
+  bool commit_offset(std::string_view group, std::string_view topic, int partition, uint64_t next_offset);
+  uint64_t get_committed_offset(std::string_view group, std::string_view topic, int partition);
+
+  // Streaming operators (see operators.h). Attached operators see every
+  // record produced to the topic from then on; they are kept in the topic's
+  // _operators.json, their window state only in memory.
+  bool create_operator(const std::string& topic, const OperatorSpec& spec, std::string& err);
+  bool drop_operator(const std::string& topic, const std::string& name);
+  nlohmann::json query_operator(const std::string& topic, const std::string& name); // null if none
+  nlohmann::json list_operators(const std::string& topic);
+
+  // Consumer group membership and assignment
+  GroupCoordinator& groups() { return *groups_; }
 
   // Stats
+  struct RecoveryStats {
+    size_t topics = 0;
+    size_t partitions = 0;
+    double total_ms = 0;
+    std::string slowest;   // "<topic>/p<N>"
+    double slowest_ms = 0;
+  };
+  // What the startup scan of data/ found and how long it took.
+  const RecoveryStats& recovery_stats() const { return recovery_; }
+
   nlohmann::json list_topics();
+  // appends in progress or waiting, over all partitions
+  uint64_t append_queue_depth();
+  // memory held by the partitions' tail buffers
+  uint64_t tail_cache_bytes();
   nlohmann::json group_stats(const std::string& group);
 
 private:
   GlobalStore();
-  void ensure_loaded_topic_locked(const std::string& topic);
-  void load_offsets_locked();
-  void persist_offsets_locked();
 
   struct TopicState {
     int partitions = 3;
-    uint64_t rr_counter = 0;
-    std::vector<std::string> log_paths;
-    std::vector<std::vector<uint64_t>> index_pos; // byte positions for each record
+    TopicConfig config;
+    std::unique_ptr<Partitioner> partitioner;
+    std::vector<std::unique_ptr<PartitionLog>> parts;
+    std::vector<double> recovery_ms; // time spent opening each partition
+
+    // replaced as a whole on change, so produce reads it without a lock
+    std::atomic<std::shared_ptr<const std::vector<std::shared_ptr<StreamOperator>>>> operators;
+    std::mutex operators_mu; // serializes changes and _operators.json
   };
 
-  std::mutex mu_;
-  std::unordered_map<std::string, TopicState> topics_;
+  std::shared_ptr<TopicState> prepare_topic(const std::string& topic, int partitions, const TopicConfig* cfg);
+  void open_partition(TopicState& st, const std::string& topic, int partition);
+  std::shared_ptr<TopicState> load_topic(const std::string& topic, int partitions, const TopicConfig* cfg);
+  void recover_topics();
+  void flusher_loop();
+  void cleaner_loop();
+  std::shared_ptr<TopicState> find_topic(std::string_view topic);
+  std::shared_ptr<TopicState> ensure_topic(std::string_view topic);
+  std::pair<std::shared_ptr<TopicState>, bool> add_topic(const std::string& topic, int partitions, const TopicConfig* cfg);
+  std::vector<std::pair<std::string, std::shared_ptr<TopicState>>> snapshot_topics();
+  void run_operators(const TopicState& st, const KeyValue* recs, size_t n);
+  void emit(const StreamOperator& op, const std::vector<StreamOperator::Output>& windows);
+
+  // Topic map is read-mostly: lookups take a shared lock, only topic
+  // creation takes it exclusively. Per-partition state has its own lock.
+  std::shared_mutex topics_mu_;
+  StringMap<std::shared_ptr<TopicState>> topics_;
+  // names of topics being opened by add_topic(), outside topics_mu_
+  std::mutex loading_mu_;
+  std::condition_variable loading_cv_;
+  std::unordered_set<std::string> loading_;
+
+  // committed consumer group offsets (data/_offsets/)
+  std::unique_ptr<OffsetStore> offsets_;
+  std::unique_ptr<GroupCoordinator> groups_;
+
+  // background fsync for Interval topics, and retention / compaction
+  std::mutex flusher_mu_;
+  std::condition_variable flusher_cv_;
+  bool stopping_ = false;
+  std::thread flusher_;
+  std::thread cleaner_;
 
-  // group -> topic -> vector(committed next_offset per partition)
-  std::unordered_map<std::string, std::unordered_map<std::string, std::vector<uint64_t>>> committed_;
-  bool offsets_loaded_ = false;
+  RecoveryStats recovery_;
 };
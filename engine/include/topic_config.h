@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+#include "json.hpp"
+#include "partitioner.h"
+#include "record.h"
+
+// When a PRODUCE is acknowledged:
+//   None     - once the record is handed to the kernel (no fsync)
+//   Interval - same, and a background flusher fsyncs dirty partitions every
+//              fsync_interval_ms
+//   Batch    - once the record is fsynced; concurrent producers on a
+//              partition share one write+fsync (group commit). A failed
+//              fsync fails the partition's appends until it is reopened
+enum class Durability { None, Interval, Batch };
+
+bool parse_durability(const std::string& s, Durability& out);
+const char* durability_name(Durability d);
+
+struct TopicConfig {
+  Durability durability = Durability::None;
+  uint32_t fsync_interval_ms = 1000;
+
+  uint64_t segment_bytes = 64ULL << 20; // roll to a new segment beyond this
+  uint64_t retention_ms = 0;            // delete segments older than this; 0 = forever
+  uint64_t retention_bytes = 0;         // per partition; 0 = unlimited
+  bool compact = false;                 // cleanup_policy "compact": keep the latest record per key
+  Codec compression = Codec::None;      // produced batches are stored as compressed batch frames
+  uint64_t tail_cache_bytes = 1 << 20;  // newest frames of each partition kept in memory; 0 = none
+
+  Partitioning partitioner = Partitioning::Hash; // see partitioner.h
+  KeyHash key_hash = KeyHash::Fnv1a;
+  uint64_t sticky_bytes = 16 << 10;     // Sticky: keyless bytes per partition before moving on
+};
+
+// Reads the settings present in j (a CREATE_TOPIC request or a stored
+// config) over cfg. Returns false with err set on an invalid value.
+bool topic_config_from_json(const nlohmann::json& j, TopicConfig& cfg, std::string& err);
+nlohmann::json topic_config_to_json(const TopicConfig& cfg);
+
+// data/<topic>/_topic.json. Loading a topic without one gives the
+// defaults; one that cannot be read or parsed throws rather than silently
+// turning into the defaults. Saving fsyncs it and renames it into place.
+TopicConfig load_topic_config(const std::string& topic_dir);
+void save_topic_config(const std::string& topic_dir, const TopicConfig& cfg);
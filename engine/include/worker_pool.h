@@ -0,0 +1,32 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running submitted tasks in FIFO order. Keeps store
+// work (disk reads, fsync waits) off the network event loops.
+class WorkerPool {
+public:
+  explicit WorkerPool(int threads);
+  ~WorkerPool(); // finishes queued tasks, then joins
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  void submit(std::function<void()> task);
+  size_t queue_depth() const;
+  size_t size() const { return threads_.size(); }
+
+private:
+  void loop();
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+  std::vector<std::thread> threads_;
+};
@@ -0,0 +1,42 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cstring>
+
+void* Arena::allocate_slow(size_t n, size_t align) {
+  Block b;
+  b.size = std::max(block_size_, n + align);
+  b.data.reset(new char[b.size]);
+  blocks_.push_back(std::move(b));
+  current_ = blocks_.size() - 1;
+  used_ = 0;
+  return allocate(n, align);
+}
+
+std::string_view Arena::copy(std::string_view s) {
+  if (s.empty()) return {};
+  char* p = static_cast<char*>(allocate(s.size(), 1));
+  std::memcpy(p, s.data(), s.size());
+  return {p, s.size()};
+}
+
+void Arena::reset() {
+  if (blocks_.size() > 1) {
+    size_t total = std::min(capacity(), kMaxKeep);
+    blocks_.clear();
+    Block b;
+    b.size = std::max(block_size_, total);
+    b.data.reset(new char[b.size]);
+    blocks_.push_back(std::move(b));
+  } else if (!blocks_.empty() && blocks_[0].size > kMaxKeep) {
+    blocks_.clear(); // one huge request; start small again
+  }
+  current_ = 0;
+  used_ = 0;
+}
+
+size_t Arena::capacity() const {
+  size_t n = 0;
+  for (auto& b : blocks_) n += b.size;
+  return n;
+}
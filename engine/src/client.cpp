@@ -1,3 +1,6 @@
+#include "binary_protocol.h"
+#include "crc32c.h"
+#include "record_batch.h"
 #include "json.hpp"
 
 #include <arpa/inet.h>
@@ -60,14 +63,192 @@ static std::string recv_line(int fd) {
   return line;
 }
 
+static void send_all(int fd, const std::string& out) {
+  const char* p = out.data();
+  size_t left = out.size();
+  while (left > 0) {
+    ssize_t n = ::send(fd, p, left, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      die("send failed");
+    }
+    p += n;
+    left -= (size_t)n;
+  }
+}
+
+static std::string recv_exact(int fd, size_t len) {
+  std::string buf(len, '\0');
+  size_t got = 0;
+  while (got < len) {
+    ssize_t n = ::recv(fd, &buf[got], len - got, 0);
+    if (n == 0) die("connection closed (engine running?)");
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      die("recv failed");
+    }
+    got += (size_t)n;
+  }
+  return buf;
+}
+
+// Maps a JSON request onto the binary protocol; requests without a native
+// op are tunnelled as JSON.
+static std::string encode_binary(const json& req) {
+  using namespace binproto;
+  std::string out;
+  size_t at = begin_frame(out);
+  std::string type = req.value("type", "");
+
+  if (type == "PING") put_u8(out, kPing);
+
+  else if (type == "PRODUCE" || type == "PRODUCE_BATCH") {
+    put_u8(out, kProduce);
+    put_str16(out, req.value("topic", ""));
+    put_i32(out, req.value("partition", -1));
+    json records = type == "PRODUCE" ? json::array({req}) : req["records"];
+    put_u32(out, (uint32_t)records.size());
+    for (auto& r : records) {
+      std::string k = r.value("key", ""), v = r.value("value", "");
+      put_u32(out, (uint32_t)k.size());
+      put_u32(out, (uint32_t)v.size());
+      out += k;
+      out += v;
+    }
+  }
+
+  else if (type == "FETCH" || type == "FETCH_GROUP") {
+    bool group = type == "FETCH_GROUP";
+    put_u8(out, group ? kFetchGroup : kFetch);
+    if (group) put_str16(out, req.value("group", ""));
+    put_str16(out, req.value("topic", ""));
+    put_i32(out, req.value("partition", 0));
+    if (!group) put_u64(out, req.value("offset", 0ULL));
+    put_u32(out, req.value("limit", 10u));
+    put_u32(out, 1u << 20);
+    if (group) put_u8(out, req.value("auto_commit", true) ? 1 : 0);
+    put_u32(out, req.value("max_wait_ms", 0u));
+    put_u32(out, req.value("min_bytes", 0u));
+    put_u8(out, kAcceptBatches);
+    if (group && req.contains("member_id")) {
+      put_str16(out, req.value("member_id", ""));
+      put_u64(out, req.value("generation", 0ULL));
+    }
+  }
+
+  else if (type == "COMMIT") {
+    put_u8(out, kCommit);
+    put_str16(out, req.value("group", ""));
+    put_str16(out, req.value("topic", ""));
+    put_i32(out, req.value("partition", 0));
+    put_u64(out, req.value("next_offset", 0ULL));
+    if (req.contains("member_id")) {
+      put_str16(out, req.value("member_id", ""));
+      put_u64(out, req.value("generation", 0ULL));
+    }
+  }
+
+  else {
+    put_u8(out, kJson);
+    out += req.dump();
+  }
+
+  finish_frame(out, at);
+  return out;
+}
+
+// Renders a binary response as JSON so both protocols print alike.
+static json decode_binary(const std::string& body) {
+  using namespace binproto;
+  Reader r(body);
+  uint8_t op = r.u8() & ~kResponseBit;
+  uint8_t status = r.u8();
+  if (status != kOk) return {{"ok",false},{"error",std::string(r.rest())},{"status",status}};
+
+  json res = {{"ok",true}};
+  switch (op) {
+    case kPing:
+      res["type"] = "PONG";
+      break;
+
+    case kProduce: {
+      json ranges = json::array();
+      uint32_t n = r.u32();
+      for (uint32_t i = 0; i < n; i++) {
+        int p = r.i32();
+        uint64_t base = r.u64(), count = r.u64();
+        ranges.push_back({{"partition",p},{"base_offset",base},{"count",count}});
+      }
+      res["ranges"] = ranges;
+      break;
+    }
+
+    case kFetch:
+    case kFetchGroup: {
+      int partition = r.i32();
+      uint64_t first = r.u64(); // a leading batch may hold records before it
+      uint64_t next = r.u64();
+      uint32_t n = r.u32();
+      json records = json::array();
+      std::string scratch;
+      std::vector<BatchRecord> batch;
+      for (uint32_t i = 0; i < n && !r.failed(); i++) {
+        uint64_t offset = r.u64(), ts = r.u64();
+        uint32_t klen = r.u32(), vlen = r.u32(), crc = r.u32();
+        bool is_batch = klen & record_format::kBatchFlag;
+        std::string_view k = r.bytes(is_batch ? 0 : klen), v = r.bytes(vlen);
+        char header[24];
+        std::memcpy(header, &offset, 8);
+        std::memcpy(header + 8, &ts, 8);
+        std::memcpy(header + 16, &klen, 4);
+        std::memcpy(header + 20, &vlen, 4);
+        bool intact = crc32c(v.data(), v.size(), crc32c(k.data(), k.size(), crc32c(header, sizeof(header)))) == crc;
+
+        batch.clear();
+        if (!is_batch) batch.push_back({offset, k, v});
+        else if (!intact || !decode_batch_payload(offset, (Codec)(klen & 0xff), v, scratch, batch)) {
+          records.push_back({{"partition",partition},{"offset",offset},{"ts_ms",ts},{"corrupt",true}});
+          continue;
+        }
+        for (auto& b : batch) {
+          if (b.offset < first) continue;
+          json rec = {{"partition",partition},{"offset",b.offset},{"ts_ms",ts},{"key",b.key},{"value",b.value}};
+          if (!intact) rec["corrupt"] = true;
+          records.push_back(rec);
+        }
+      }
+      res["partition"] = partition;
+      res["next_offset"] = next;
+      res["records"] = records;
+      break;
+    }
+
+    case kCommit:
+      res["committed_next_offset"] = r.u64();
+      break;
+
+    case kJson:
+      try { return json::parse(r.rest()); }
+      catch (...) { res["raw"] = std::string(r.rest()); }
+      break;
+  }
+  return res;
+}
+
 int main(int argc, char** argv) {
+  bool binary = false;
+  if (argc >= 2 && std::string(argv[1]) == "--binary") { binary = true; argv++; argc--; }
+  long long wait_ms = 0;
+  if (argc >= 3 && std::string(argv[1]) == "--wait") { wait_ms = std::stoll(argv[2]); argv += 2; argc -= 2; }
+
   if (argc < 2) {
     std::cerr <<
-      "Usage:\n"
+      "Usage: client [--binary] [--wait <ms>] <command>   (--wait: long-poll fetches)\n"
       "  client ping\n"
-      "  client create-topic <topic> <partitions>\n"
+      "  client create-topic <topic> <partitions> [none|interval|batch] [fsync_interval_ms]\n"
       "  client topics\n"
       "  client produce <topic> <key> <value>\n"
+      "  client produce-batch <topic> <key> <value> [<key> <value> ...]\n"
       "  client fetch <topic> <partition> <offset> <limit>\n"
       "  client commit <group> <topic> <partition> <next_offset>\n"
       "  client group-stats <group>\n"
@@ -83,6 +264,8 @@ int main(int argc, char** argv) {
   else if (cmd == "create-topic") {
     if (argc < 4) die("create-topic needs <topic> <partitions>");
     req = {{"type","CREATE_TOPIC"},{"topic",argv[2]},{"partitions",std::stoi(argv[3])}};
+    if (argc >= 5) req["durability"] = argv[4];
+    if (argc >= 6) req["fsync_interval_ms"] = std::stoi(argv[5]);
   }
 
   else if (cmd == "topics") req = {{"type","TOPICS"}};
@@ -92,6 +275,13 @@ int main(int argc, char** argv) {
     req = {{"type","PRODUCE"},{"topic",argv[2]},{"key",argv[3]},{"value",argv[4]}};
   }
 
+  else if (cmd == "produce-batch") {
+    if (argc < 5 || (argc - 3) % 2 != 0) die("produce-batch needs <topic> followed by <key> <value> pairs");
+    json records = json::array();
+    for (int i = 3; i + 1 < argc; i += 2) records.push_back({{"key",argv[i]},{"value",argv[i + 1]}});
+    req = {{"type","PRODUCE_BATCH"},{"topic",argv[2]},{"records",records}};
+  }
+
   else if (cmd == "fetch") {
     if (argc < 6) die("fetch needs <topic> <partition> <offset> <limit>");
     req = {{"type","FETCH"},{"topic",argv[2]},{"partition",std::stoi(argv[3])},
@@ -127,7 +317,21 @@ int main(int argc, char** argv) {
     die("unknown command");
   }
 
+  if (wait_ms > 0 && (cmd == "fetch" || cmd == "fetch-group")) req["max_wait_ms"] = wait_ms;
+
   int fd = connect_to("127.0.0.1", 9000);
+
+  if (binary) {
+    send_all(fd, std::string(binproto::kMagic, sizeof(binproto::kMagic)) + encode_binary(req));
+    if (recv_exact(fd, 4) != std::string(binproto::kMagic, 4)) die("engine does not speak the binary protocol");
+    uint32_t len;
+    std::memcpy(&len, recv_exact(fd, 4).data(), 4);
+    json res = decode_binary(recv_exact(fd, len));
+    ::close(fd);
+    std::cout << res.dump(2, ' ', false, json::error_handler_t::replace) << "\n";
+    return 0;
+  }
+
   send_line(fd, req.dump());
   std::string res = recv_line(fd);
   ::close(fd);
@@ -0,0 +1,97 @@
+#include "crc32c.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define PS_CRC32C_X86 1
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define PS_CRC32C_ARM 1
+#endif
+
+static constexpr uint32_t kPoly = 0x82F63B78; // reflected Castagnoli polynomial
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+static constexpr Tables make_tables() {
+  Tables t{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; k++) c = (c >> 1) ^ ((c & 1) ? kPoly : 0);
+    t[0][i] = c;
+  }
+  for (uint32_t i = 0; i < 256; i++) {
+    for (size_t s = 1; s < 8; s++) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+  }
+  return t;
+}
+
+static constexpr Tables kTables = make_tables();
+
+// crc here is the raw register, without the final inversion
+static uint32_t crc32c_sw(uint32_t crc, const unsigned char* p, size_t n) {
+  while (n >= 8) {
+    uint32_t lo, hi;
+    std::memcpy(&lo, p, 4);
+    std::memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = kTables[7][lo & 0xFF] ^ kTables[6][(lo >> 8) & 0xFF] ^ kTables[5][(lo >> 16) & 0xFF] ^ kTables[4][lo >> 24] ^
+          kTables[3][hi & 0xFF] ^ kTables[2][(hi >> 8) & 0xFF] ^ kTables[1][(hi >> 16) & 0xFF] ^ kTables[0][hi >> 24];
+    p += 8;
+    n -= 8;
+  }
+  while (n--) crc = (crc >> 8) ^ kTables[0][(crc ^ *p++) & 0xFF];
+  return crc;
+}
+
+#if defined(PS_CRC32C_X86)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+#if defined(__x86_64__)
+  uint64_t c = crc;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+  crc = (uint32_t)c;
+#endif
+  for (; n >= 4; p += 4, n -= 4) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    crc = _mm_crc32_u32(crc, v);
+  }
+  while (n--) crc = _mm_crc32_u8(crc, *p++);
+  return crc;
+}
+
+static const bool kHardware = [] { __builtin_cpu_init(); return __builtin_cpu_supports("sse4.2") != 0; }();
+#elif defined(PS_CRC32C_ARM)
+static uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    crc = __crc32cd(crc, v);
+  }
+  while (n--) crc = __crc32cb(crc, *p++);
+  return crc;
+}
+
+static const bool kHardware = true;
+#else
+static const bool kHardware = false;
+#endif
+
+uint32_t crc32c(const void* data, size_t len, uint32_t crc) {
+  auto p = (const unsigned char*)data;
+#if defined(PS_CRC32C_X86) || defined(PS_CRC32C_ARM)
+  if (kHardware) return ~crc32c_hw(~crc, p, len);
+#endif
+  return ~crc32c_sw(~crc, p, len);
+}
+
+const char* crc32c_impl() {
+  return kHardware ? "hardware" : "software";
+}
@@ -0,0 +1,307 @@
+#include "disk_io.h"
+#include "worker_pool.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+namespace disk_io {
+namespace {
+
+int64_t run_one(const DiskOp& op) {
+  while (true) {
+    ssize_t n;
+    if (op.kind == DiskOp::Read) n = ::pread(op.fd, op.buf, op.len, (off_t)op.pos);
+    else if (op.kind == DiskOp::Sync) n = ::fdatasync(op.fd);
+    else if (op.pos == DiskOp::kAppend) n = ::write(op.fd, op.buf, op.len);
+    else n = ::pwrite(op.fd, op.buf, op.len, (off_t)op.pos);
+    if (n >= 0) return n;
+    if (errno != EINTR) return -errno;
+  }
+}
+
+// ops linked to each other from ops[0] on
+size_t chain_length(const DiskOp* ops, size_t n) {
+  size_t k = 1;
+  while (k < n && ops[k - 1].link) k++;
+  return k;
+}
+
+// a failed or short op, which breaks its chain
+bool breaks_chain(const DiskOp& op) {
+  return op.result < 0 || (op.kind != DiskOp::Sync && (size_t)op.result < op.len);
+}
+
+// a chain stops at a failed or short op, as io_uring's links do
+void run_chain(DiskOp* ops, size_t n) {
+  bool broken = false;
+  for (size_t i = 0; i < n; i++) {
+    if (broken) { ops[i].result = -ECANCELED; continue; }
+    ops[i].result = run_one(ops[i]);
+    broken = breaks_chain(ops[i]);
+  }
+}
+
+// An io_uring instance: submission and completion rings shared with the
+// kernel through mmap. Used by one thread only. Once io_uring_enter() has
+// failed the ring is broken and no longer used.
+class Ring {
+public:
+  static constexpr unsigned kEntries = 64;
+
+  Ring() = default;
+  ~Ring();
+
+  Ring(const Ring&) = delete;
+  Ring& operator=(const Ring&) = delete;
+
+  // false if the kernel offers no io_uring, or one without what we use
+  bool open();
+  // At most kEntries ops. Returns how many ran: fewer than n if the ring
+  // broke before the kernel took them all (those taken have completed).
+  size_t run(DiskOp* ops, size_t n);
+  bool broken() const { return broken_; }
+
+private:
+  int fd_ = -1;
+  void* sq_map_ = MAP_FAILED;
+  void* cq_map_ = MAP_FAILED;
+  size_t sq_map_len_ = 0, cq_map_len_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_len_ = 0;
+  bool broken_ = false;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+Ring::~Ring() {
+  if (sqes_) ::munmap(sqes_, sqes_len_);
+  if (cq_map_ != MAP_FAILED && cq_map_ != sq_map_) ::munmap(cq_map_, cq_map_len_);
+  if (sq_map_ != MAP_FAILED) ::munmap(sq_map_, sq_map_len_);
+  if (fd_ >= 0) ::close(fd_);
+}
+
+bool Ring::open() {
+  io_uring_params p{};
+  fd_ = (int)::syscall(__NR_io_uring_setup, kEntries, &p);
+  if (fd_ < 0) return false;
+  // 5.6: IORING_OP_READ / WRITE, and offset -1 for appends
+  if (!(p.features & IORING_FEAT_RW_CUR_POS)) return false;
+
+  sq_map_len_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  cq_map_len_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single) sq_map_len_ = cq_map_len_ = std::max(sq_map_len_, cq_map_len_);
+
+  sq_map_ = ::mmap(nullptr, sq_map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+  if (sq_map_ == MAP_FAILED) return false;
+  if (single) cq_map_ = sq_map_;
+  else {
+    cq_map_ = ::mmap(nullptr, cq_map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    if (cq_map_ == MAP_FAILED) return false;
+  }
+  sqes_len_ = p.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = ::mmap(nullptr, sqes_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return false;
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  char* sq = static_cast<char*>(sq_map_);
+  sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+  sq_mask_ = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+  sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+  char* cq = static_cast<char*>(cq_map_);
+  cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+  cq_mask_ = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+  cqes_ = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+  return true;
+}
+
+size_t Ring::run(DiskOp* ops, size_t n) {
+  unsigned start = *sq_tail_; // the kernel only moves the head
+  unsigned tail = start;
+  for (size_t i = 0; i < n; i++) {
+    const DiskOp& op = ops[i];
+    unsigned idx = tail++ & *sq_mask_;
+    io_uring_sqe& sqe = sqes_[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.fd = op.fd;
+    sqe.user_data = i;
+    if (op.link) sqe.flags = IOSQE_IO_LINK;
+    if (op.kind == DiskOp::Sync) {
+      sqe.opcode = IORING_OP_FSYNC;
+      sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+    } else {
+      sqe.opcode = op.kind == DiskOp::Read ? IORING_OP_READ : IORING_OP_WRITE;
+      sqe.addr = (uint64_t)(uintptr_t)op.buf;
+      sqe.len = (uint32_t)op.len;
+      sqe.off = op.pos == DiskOp::kAppend ? (uint64_t)-1 : op.pos;
+    }
+    sq_array_[idx] = idx;
+  }
+  std::atomic_ref<unsigned>(*sq_tail_).store(tail, std::memory_order_release);
+
+  // submit everything and sleep until it has all completed, in as few
+  // io_uring_enter() calls as the kernel allows
+  unsigned to_submit = (unsigned)n;
+  size_t submitted = n, completed = 0;
+  while (completed < submitted) {
+    int r = (int)::syscall(__NR_io_uring_enter, fd_, to_submit, (unsigned)(submitted - completed),
+                           IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (r >= 0) to_submit -= (unsigned)r;
+    else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      if (!broken_) {
+        // take back the ops the kernel has not picked up; those it has may
+        // still be using their buffers, so they are waited for all the same
+        broken_ = true;
+        unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(std::memory_order_acquire);
+        submitted = head - start;
+        to_submit = 0;
+        std::atomic_ref<unsigned>(*sq_tail_).store(head, std::memory_order_release);
+      } else {
+        ::usleep(1000); // cannot wait in the kernel: poll for the completions
+      }
+    }
+
+    unsigned head = *cq_head_;
+    unsigned ready = std::atomic_ref<unsigned>(*cq_tail_).load(std::memory_order_acquire);
+    for (; head != ready; head++) {
+      const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+      ops[cqe.user_data].result = cqe.res;
+      completed++;
+    }
+    std::atomic_ref<unsigned>(*cq_head_).store(head, std::memory_order_release);
+  }
+  return submitted;
+}
+
+constexpr int kPoolThreads = 4;
+
+std::atomic<int> chosen{-1}; // a Backend once picked
+
+// never destroyed: statics torn down at exit (the store's flusher) may still run batches
+WorkerPool& pool() {
+  static WorkerPool* p = new WorkerPool(kPoolThreads);
+  return *p;
+}
+
+// the calling thread's ring; null if it could not get one
+Ring* thread_ring() {
+  thread_local std::unique_ptr<Ring> ring;
+  thread_local bool tried = false;
+  if (!tried) {
+    tried = true;
+    auto r = std::make_unique<Ring>();
+    if (r->open()) ring = std::move(r);
+  }
+  return ring.get();
+}
+
+bool writes_only(const DiskOp* ops, size_t n) {
+  return std::all_of(ops, ops + n, [](const DiskOp& op) { return op.kind == DiskOp::Write; });
+}
+
+// One chain per pool task; the caller runs the first itself, and chains of
+// writes, which only copy into the page cache.
+void run_threads(DiskOp* ops, size_t n) {
+  size_t first = chain_length(ops, n);
+  if (first == n) return run_chain(ops, n);
+
+  std::mutex mu;
+  std::condition_variable cv;
+  size_t pending = 0;
+  for (size_t i = first; i < n;) {
+    size_t k = chain_length(ops + i, n - i);
+    if (writes_only(ops + i, k)) {
+      run_chain(ops + i, k);
+      i += k;
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      pending++;
+    }
+    pool().submit([&, chain = ops + i, k] {
+      run_chain(chain, k);
+      std::lock_guard<std::mutex> lock(mu);
+      if (--pending == 0) cv.notify_one();
+    });
+    i += k;
+  }
+  run_chain(ops, first);
+  std::unique_lock<std::mutex> lock(mu);
+  cv.wait(lock, [&] { return pending == 0; });
+}
+
+} // namespace
+
+void init(bool allow_uring) {
+  Backend b = Backend::Threads;
+  if (allow_uring) {
+    Ring probe;
+    if (probe.open()) b = Backend::Uring;
+  }
+  chosen.store((int)b, std::memory_order_relaxed);
+}
+
+Backend backend() {
+  if (chosen.load(std::memory_order_relaxed) < 0) init();
+  return (Backend)chosen.load(std::memory_order_relaxed);
+}
+
+const char* backend_name() {
+  return backend() == Backend::Uring ? "io_uring" : "threads";
+}
+
+void run(DiskOp* ops, size_t n) {
+  if (n == 0) return;
+  if (n == 1) { ops[0].result = run_one(ops[0]); return; }
+
+  Ring* ring = backend() == Backend::Uring ? thread_ring() : nullptr;
+  if (!ring || ring->broken()) return run_threads(ops, n);
+
+  // in pieces that fit the ring, never splitting a chain
+  for (size_t i = 0; i < n;) {
+    size_t k = 0;
+    while (i + k < n) {
+      size_t c = chain_length(ops + i + k, n - i - k);
+      if (k + c > Ring::kEntries) break;
+      k += c;
+    }
+    if (k == 0) { // a chain longer than the ring: op by op
+      k = chain_length(ops + i, n - i);
+      run_chain(ops + i, k);
+    } else if (size_t done = ring->run(ops + i, k); done < k) {
+      // the ring broke: the rest go to the threads, less what remains of a
+      // chain already broken by its ops that did run
+      i += done;
+      if (done > 0 && i < n && ops[i - 1].link && breaks_chain(ops[i - 1])) {
+        size_t c = chain_length(ops + i, n - i);
+        for (size_t j = 0; j < c; j++) ops[i + j].result = -ECANCELED;
+        i += c;
+      }
+      if (i < n) run_threads(ops + i, n - i);
+      return;
+    }
+    i += k;
+  }
+}
+
+} // namespace disk_io
@@ -0,0 +1,236 @@
+#include "flat_request.h"
+#include "json_writer.h"
+
+#include <climits>
+#include <cstring>
+
+static void skip_ws(const char*& p, const char* end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool parse_hex4(const char*& p, const char* end, uint32_t& out) {
+  if (end - p < 4) return false;
+  out = 0;
+  for (int i = 0; i < 4; i++) {
+    int v = hex_value(p[i]);
+    if (v < 0) return false;
+    out = (out << 4) | (uint32_t)v;
+  }
+  p += 4;
+  return true;
+}
+
+static char* put_utf8(char* d, uint32_t cp) {
+  if (cp < 0x80) { *d++ = (char)cp; }
+  else if (cp < 0x800) { *d++ = (char)(0xC0 | (cp >> 6)); *d++ = (char)(0x80 | (cp & 0x3F)); }
+  else if (cp < 0x10000) {
+    *d++ = (char)(0xE0 | (cp >> 12));
+    *d++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+    *d++ = (char)(0x80 | (cp & 0x3F));
+  } else {
+    *d++ = (char)(0xF0 | (cp >> 18));
+    *d++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+    *d++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+    *d++ = (char)(0x80 | (cp & 0x3F));
+  }
+  return d;
+}
+
+// Reads a string whose opening quote is behind p. Without escapes the
+// result is a view into the line; with them it is unescaped into the arena
+// (never longer than its escaped form).
+static bool parse_string(const char*& p, const char* end, Arena& arena, std::string_view& out) {
+  const char* start = p;
+  while (p < end) {
+    unsigned char c = (unsigned char)*p;
+    if (c == '"') { out = std::string_view(start, (size_t)(p - start)); p++; return true; }
+    if (c == '\\') break;
+    if (c < 0x20) return false;
+    if (c < 0x80) { p++; continue; }
+    size_t n = utf8_sequence_length((const unsigned char*)p, (size_t)(end - p));
+    if (n == 0) return false;
+    p += n;
+  }
+  if (p >= end) return false;
+
+  const char* close = p;
+  while (close < end && *close != '"') {
+    if (*close == '\\' && ++close == end) return false;
+    close++;
+  }
+  if (close >= end) return false;
+
+  char* buf = arena.allocate_array<char>((size_t)(close - start));
+  size_t prefix = (size_t)(p - start);
+  std::memcpy(buf, start, prefix);
+  char* d = buf + prefix;
+  while (p < close) {
+    unsigned char c = (unsigned char)*p;
+    if (c < 0x20) return false;
+    if (c >= 0x80) {
+      size_t n = utf8_sequence_length((const unsigned char*)p, (size_t)(close - p));
+      if (n == 0) return false;
+      std::memcpy(d, p, n);
+      d += n;
+      p += n;
+      continue;
+    }
+    if (c != '\\') { *d++ = (char)c; p++; continue; }
+
+    p++;
+    switch (*p++) {
+      case '"': *d++ = '"'; break;
+      case '\\': *d++ = '\\'; break;
+      case '/': *d++ = '/'; break;
+      case 'b': *d++ = '\b'; break;
+      case 'f': *d++ = '\f'; break;
+      case 'n': *d++ = '\n'; break;
+      case 'r': *d++ = '\r'; break;
+      case 't': *d++ = '\t'; break;
+      case 'u': {
+        uint32_t cp;
+        if (!parse_hex4(p, close, cp)) return false;
+        if (cp >= 0xDC00 && cp <= 0xDFFF) return false; // low surrogate first
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+          uint32_t lo;
+          if (close - p < 2 || p[0] != '\\' || p[1] != 'u') return false;
+          p += 2;
+          if (!parse_hex4(p, close, lo) || lo < 0xDC00 || lo > 0xDFFF) return false;
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+        }
+        d = put_utf8(d, cp);
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  out = std::string_view(buf, (size_t)(d - buf));
+  p = close + 1;
+  return true;
+}
+
+// Integers only: a fraction or exponent leaves the line to json::parse.
+static bool parse_int(const char*& p, const char* end, int64_t& out) {
+  bool neg = *p == '-';
+  if (neg) p++;
+  const char* digits = p;
+  while (p < end && *p >= '0' && *p <= '9') p++;
+  size_t n = (size_t)(p - digits);
+  if (n == 0 || n > 18 || (n > 1 && *digits == '0')) return false;
+  if (p < end && (*p == '.' || *p == 'e' || *p == 'E')) return false;
+
+  int64_t v = 0;
+  for (const char* d = digits; d < p; d++) v = v * 10 + (*d - '0');
+  out = neg ? -v : v;
+  return true;
+}
+
+static bool parse_literal(const char*& p, const char* end, const char* word) {
+  size_t n = std::strlen(word);
+  if ((size_t)(end - p) < n || std::memcmp(p, word, n) != 0) return false;
+  p += n;
+  return true;
+}
+
+bool FlatRequest::parse(std::string_view line, Arena& arena) {
+  count_ = 0;
+  const char* p = line.data();
+  const char* end = p + line.size();
+
+  skip_ws(p, end);
+  if (p >= end || *p++ != '{') return false;
+  skip_ws(p, end);
+  if (p < end && *p == '}') p++;
+  else {
+    while (true) {
+      if (count_ == kMaxFields || p >= end || *p++ != '"') return false;
+      Field& f = fields_[count_];
+      if (!parse_string(p, end, arena, f.key)) return false;
+      skip_ws(p, end);
+      if (p >= end || *p++ != ':') return false;
+      skip_ws(p, end);
+      if (p >= end) return false;
+
+      if (*p == '"') {
+        p++;
+        f.kind = Field::String;
+        if (!parse_string(p, end, arena, f.str)) return false;
+      } else if (*p == '-' || (*p >= '0' && *p <= '9')) {
+        f.kind = Field::Int;
+        if (!parse_int(p, end, f.num)) return false;
+      } else if (parse_literal(p, end, "true")) {
+        f.kind = Field::Bool;
+        f.num = 1;
+      } else if (parse_literal(p, end, "false")) {
+        f.kind = Field::Bool;
+        f.num = 0;
+      } else {
+        return false; // null, objects, arrays
+      }
+      count_++;
+
+      skip_ws(p, end);
+      if (p >= end) return false;
+      if (*p == '}') { p++; break; }
+      if (*p++ != ',') return false;
+      skip_ws(p, end);
+    }
+  }
+  skip_ws(p, end);
+  return p == end;
+}
+
+const FlatRequest::Field* FlatRequest::find(std::string_view key) const {
+  for (size_t i = count_; i-- > 0;) {
+    if (fields_[i].key == key) return &fields_[i];
+  }
+  return nullptr;
+}
+
+bool FlatRequest::get(std::string_view key, std::string_view& out) const {
+  auto* f = find(key);
+  if (!f) return true;
+  if (f->kind != Field::String) return false;
+  out = f->str;
+  return true;
+}
+
+bool FlatRequest::get(std::string_view key, int& out) const {
+  auto* f = find(key);
+  if (!f) return true;
+  if (f->kind != Field::Int || f->num < INT_MIN || f->num > INT_MAX) return false;
+  out = (int)f->num;
+  return true;
+}
+
+bool FlatRequest::get(std::string_view key, long long& out) const {
+  auto* f = find(key);
+  if (!f) return true;
+  if (f->kind != Field::Int) return false;
+  out = f->num;
+  return true;
+}
+
+bool FlatRequest::get(std::string_view key, uint64_t& out) const {
+  auto* f = find(key);
+  if (!f) return true;
+  if (f->kind != Field::Int || f->num < 0) return false;
+  out = (uint64_t)f->num;
+  return true;
+}
+
+bool FlatRequest::get(std::string_view key, bool& out) const {
+  auto* f = find(key);
+  if (!f) return true;
+  if (f->kind != Field::Bool) return false;
+  out = f->num != 0;
+  return true;
+}
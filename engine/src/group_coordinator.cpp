@@ -0,0 +1,213 @@
+#include "group_coordinator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <numeric>
+#include <random>
+
+using json = nlohmann::json;
+
+static uint64_t steady_ms() {
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+const char* strategy_name(GroupCoordinator::Strategy s) {
+  return s == GroupCoordinator::Strategy::Sticky ? "sticky" : "range";
+}
+
+bool parse_strategy(const std::string& s, GroupCoordinator::Strategy& out) {
+  if (s == "range") { out = GroupCoordinator::Strategy::Range; return true; }
+  if (s == "sticky") { out = GroupCoordinator::Strategy::Sticky; return true; }
+  return false;
+}
+
+GroupCoordinator::GroupCoordinator(std::function<int(const std::string&)> partitions)
+  : partitions_(std::move(partitions)) {
+  // ids from before a restart must not be mistaken for new ones
+  member_seq_ = (uint64_t)std::random_device{}() << 20;
+}
+
+std::string GroupCoordinator::new_member_id(const std::string& group) {
+  char suffix[24];
+  std::snprintf(suffix, sizeof(suffix), "-%llx", (unsigned long long)++member_seq_);
+  std::string id = group;
+  id += suffix;
+  return id;
+}
+
+// Starts a new generation: every member's share of each topic it consumes
+// is computed afresh from the current partition counts.
+void GroupCoordinator::rebalance_locked(Group& g) {
+  g.generation++;
+
+  std::map<std::string, std::vector<Member*>> subscribers; // in member id order
+  std::unordered_map<const Member*, Assignment> previous;
+  for (auto& [id, m] : g.members) {
+    for (auto& t : m.topics) subscribers[t].push_back(&m);
+    previous[&m] = std::move(m.owned);
+    m.owned.clear();
+  }
+
+  g.partition_counts.clear();
+  for (auto& [topic, members] : subscribers) {
+    int n = std::max(partitions_(topic), 0);
+    g.partition_counts[topic] = n;
+    size_t count = members.size();
+    int base = n / (int)count, extra = n % (int)count;
+
+    if (g.strategy == Strategy::Range) {
+      int p = 0;
+      for (size_t i = 0; i < count; i++) {
+        int share = base + ((int)i < extra ? 1 : 0);
+        auto& owned = members[i]->owned[topic];
+        for (int k = 0; k < share; k++) owned.push_back(p++);
+      }
+      continue;
+    }
+
+    // sticky: members keep what they owned, up to their fair share; the
+    // ones keeping the most get the extra partitions, so fewer move
+    std::vector<int> owner(n, -1);
+    std::vector<std::vector<int>> kept(count);
+    for (size_t i = 0; i < count; i++) {
+      auto it = previous[members[i]].find(topic);
+      if (it == previous[members[i]].end()) continue;
+      for (int p : it->second) {
+        if (p < n && owner[p] < 0) { owner[p] = (int)i; kept[i].push_back(p); }
+      }
+    }
+    std::vector<size_t> order(count);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return kept[a].size() > kept[b].size(); });
+    std::vector<size_t> cap(count);
+    for (size_t rank = 0; rank < count; rank++) {
+      size_t i = order[rank];
+      cap[i] = (size_t)base + ((int)rank < extra ? 1 : 0);
+      while (kept[i].size() > cap[i]) { owner[kept[i].back()] = -1; kept[i].pop_back(); }
+    }
+    // the rest go to whoever has room and the fewest
+    for (int p = 0; p < n; p++) {
+      if (owner[p] >= 0) continue;
+      size_t best = count;
+      for (size_t i = 0; i < count; i++) {
+        if (kept[i].size() < cap[i] && (best == count || kept[i].size() < kept[best].size())) best = i;
+      }
+      owner[p] = (int)best;
+      kept[best].push_back(p);
+    }
+    for (size_t i = 0; i < count; i++) {
+      std::sort(kept[i].begin(), kept[i].end());
+      members[i]->owned[topic] = std::move(kept[i]);
+    }
+  }
+}
+
+bool GroupCoordinator::join(const std::string& group, const std::string& member_id, std::vector<std::string> topics,
+                            Strategy strategy, uint32_t session_ms, JoinResult& out, std::string& err) {
+  std::sort(topics.begin(), topics.end());
+  topics.erase(std::unique(topics.begin(), topics.end()), topics.end());
+  session_ms = std::clamp(session_ms, kMinSessionMs, kMaxSessionMs);
+
+  std::lock_guard<std::mutex> lock(mu_);
+  Group* g;
+  Member* m;
+  bool changed = false;
+  if (member_id.empty()) {
+    g = &groups_[group];
+    if (g->members.empty()) g->strategy = strategy;
+    out.member_id = new_member_id(group);
+    m = &g->members[out.member_id];
+    changed = true;
+  } else {
+    auto git = groups_.find(group);
+    if (git == groups_.end() || !git->second.members.count(member_id)) { err = "unknown_member"; return false; }
+    g = &git->second;
+    m = &g->members[member_id];
+    out.member_id = member_id;
+  }
+
+  if (m->topics != topics) { m->topics = std::move(topics); changed = true; }
+  m->session_ms = session_ms;
+  m->last_seen_ms = steady_ms();
+  if (changed) rebalance_locked(*g);
+  m->generation = g->generation;
+
+  out.generation = g->generation;
+  out.assignment = m->owned;
+  out.members = g->members.size();
+  out.strategy = g->strategy;
+  return true;
+}
+
+GroupCoordinator::Status GroupCoordinator::heartbeat(const std::string& group, const std::string& member_id,
+                                                     uint64_t generation) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto git = groups_.find(group);
+  if (git == groups_.end()) return Status::UnknownMember;
+  auto mit = git->second.members.find(member_id);
+  if (mit == git->second.members.end()) return Status::UnknownMember;
+
+  mit->second.last_seen_ms = steady_ms();
+  return generation == git->second.generation ? Status::Ok : Status::RebalanceInProgress;
+}
+
+bool GroupCoordinator::leave(const std::string& group, const std::string& member_id) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto git = groups_.find(group);
+  if (git == groups_.end() || git->second.members.erase(member_id) == 0) return false;
+  if (git->second.members.empty()) groups_.erase(git);
+  else rebalance_locked(git->second);
+  return true;
+}
+
+GroupCoordinator::Status GroupCoordinator::check(std::string_view group, std::string_view member_id,
+                                                 uint64_t generation, std::string_view topic, int partition) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto git = groups_.find(group);
+  if (git == groups_.end()) return Status::UnknownMember;
+  auto mit = git->second.members.find(member_id);
+  if (mit == git->second.members.end()) return Status::UnknownMember;
+  if (generation != git->second.generation) return Status::RebalanceInProgress;
+
+  auto it = mit->second.owned.find(topic);
+  if (it == mit->second.owned.end() || !std::binary_search(it->second.begin(), it->second.end(), partition)) {
+    return Status::NotAssigned;
+  }
+  return Status::Ok;
+}
+
+void GroupCoordinator::expire() {
+  std::lock_guard<std::mutex> lock(mu_);
+  uint64_t now = steady_ms();
+  for (auto git = groups_.begin(); git != groups_.end();) {
+    Group& g = git->second;
+    bool changed = false;
+    for (auto mit = g.members.begin(); mit != g.members.end();) {
+      if (now - mit->second.last_seen_ms > mit->second.session_ms) { mit = g.members.erase(mit); changed = true; }
+      else ++mit;
+    }
+    if (g.members.empty()) { git = groups_.erase(git); continue; }
+
+    for (auto& [topic, n] : g.partition_counts) {
+      if (partitions_(topic) != n) { changed = true; break; }
+    }
+    if (changed) rebalance_locked(g);
+    ++git;
+  }
+}
+
+json GroupCoordinator::describe(const std::string& group) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto git = groups_.find(group);
+  if (git == groups_.end()) return nullptr;
+
+  json members = json::array();
+  for (auto& [id, m] : git->second.members) {
+    members.push_back({{"member_id", id}, {"topics", m.topics}, {"assignment", m.owned}});
+  }
+  return json({{"generation", git->second.generation},
+               {"strategy", strategy_name(git->second.strategy)},
+               {"members", members}});
+}
@@ -0,0 +1,83 @@
+#include "json_writer.h"
+
+#include <charconv>
+
+void json_append_uint(std::string& out, uint64_t v) {
+  char buf[24];
+  auto res = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, res.ptr);
+}
+
+void json_append_int(std::string& out, int64_t v) {
+  char buf[24];
+  auto res = std::to_chars(buf, buf + sizeof(buf), v);
+  out.append(buf, res.ptr);
+}
+
+size_t utf8_sequence_length(const unsigned char* p, size_t left) {
+  unsigned char c = p[0];
+  size_t n;
+  uint32_t cp;
+  if (c < 0x80) return 1;
+  else if ((c & 0xE0) == 0xC0) { n = 2; cp = c & 0x1F; }
+  else if ((c & 0xF0) == 0xE0) { n = 3; cp = c & 0x0F; }
+  else if ((c & 0xF8) == 0xF0) { n = 4; cp = c & 0x07; }
+  else return 0;
+  if (left < n) return 0;
+  for (size_t i = 1; i < n; i++) {
+    if ((p[i] & 0xC0) != 0x80) return 0;
+    cp = (cp << 6) | (p[i] & 0x3F);
+  }
+  // reject overlong forms, surrogates and out of range code points
+  if ((n == 2 && cp < 0x80) || (n == 3 && cp < 0x800) || (n == 4 && cp < 0x10000)) return 0;
+  if ((cp >= 0xD800 && cp <= 0xDFFF) || cp > 0x10FFFF) return 0;
+  return n;
+}
+
+void json_append_string(std::string& out, std::string_view s) {
+  static const char* hex = "0123456789abcdef";
+  out.push_back('"');
+  const unsigned char* p = (const unsigned char*)s.data();
+  size_t n = s.size(), i = 0, run = 0; // run: start of bytes copied verbatim
+  while (i < n) {
+    unsigned char c = p[i];
+    if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80) { i++; continue; }
+
+    size_t len = c < 0x80 ? 1 : utf8_sequence_length(p + i, n - i);
+    if (len > 1) { i += len; continue; }
+
+    out.append(s.data() + run, i - run);
+    switch (c) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      default:
+        if (len == 0) out += "\\ufffd";
+        else { out += "\\u00"; out.push_back(hex[c >> 4]); out.push_back(hex[c & 0xF]); }
+    }
+    i++;
+    run = i;
+  }
+  out.append(s.data() + run, n - run);
+  out.push_back('"');
+}
+
+void json_append_records(std::string& out, const FetchResult& r, int partition) {
+  out.push_back('[');
+  bool first = true;
+  for (auto& rec : r.records) {
+    if (!first) out.push_back(',');
+    first = false;
+    out += "{\"partition\":"; json_append_int(out, partition);
+    out += ",\"offset\":"; json_append_uint(out, rec.offset);
+    out += ",\"ts_ms\":"; json_append_uint(out, rec.ts_ms);
+    if (r.keys) { out += ",\"key\":"; json_append_string(out, r.key(rec)); }
+    if (r.values) { out += ",\"value\":"; json_append_string(out, r.value(rec)); }
+    out.push_back('}');
+  }
+  out.push_back(']');
+}
@@ -0,0 +1,145 @@
+#include "log_file.h"
+#include "disk_io.h"
+#include "metrics.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <stdexcept>
+
+static std::atomic<uint64_t> next_file_id{1};
+
+LogFile::LogFile(const std::string& path)
+    : path_(path), id_(next_file_id.fetch_add(1, std::memory_order_relaxed)) {
+  fd_ = ::open(path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0) throw std::runtime_error("open log failed: " + path + ": " + std::strerror(errno));
+
+  struct stat sb{};
+  if (::fstat(fd_, &sb) < 0) { ::close(fd_); throw std::runtime_error("fstat log failed: " + path); }
+  size_ = (uint64_t)sb.st_size;
+  flushed_ = size_;
+  buf_.reserve(kFlushThreshold);
+}
+
+LogFile::~LogFile() {
+  try { flush(); } catch (...) {}
+  if (fd_ >= 0) ::close(fd_);
+}
+
+uint64_t LogFile::append(const void* data, size_t len) {
+  uint64_t pos = size_;
+  if (buf_.size() + len > kFlushThreshold && !buf_.empty()) flush();
+  buf_.append((const char*)data, len);
+  size_ += len;
+  return pos;
+}
+
+void LogFile::unstage(uint64_t pos) {
+  if (pos >= size_) return;
+  if (pos < flushed_) throw std::logic_error("log unstage below the written end: " + path_);
+  buf_.resize(buf_.size() - (size_t)(size_ - pos));
+  size_ = pos;
+}
+
+void LogFile::flush() {
+  if (buf_.empty()) return;
+  metrics::Timer timer(metrics::kDiskWrite);
+  metrics::add(metrics::kDiskWriteBytes, buf_.size());
+  size_t done = 0;
+  while (done < buf_.size()) {
+    ssize_t n = ::write(fd_, buf_.data() + done, buf_.size() - done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      buf_.erase(0, done);
+      throw std::runtime_error("log write failed: " + path_ + ": " + std::strerror(errno));
+    }
+    done += (size_t)n;
+    flushed_ += (uint64_t)n;
+  }
+  buf_.clear();
+}
+
+void LogFile::flush_all(std::initializer_list<LogFile*> files) {
+  constexpr size_t kMaxBatch = 8;
+  LogFile* staged[kMaxBatch];
+  DiskOp ops[kMaxBatch];
+  size_t n = 0;
+  for (LogFile* f : files) {
+    if (!f || f->buf_.empty()) continue;
+    if (n == kMaxBatch) { f->flush(); continue; }
+    staged[n] = f;
+    ops[n++] = DiskOp::append(f->fd_, f->buf_.data(), f->buf_.size());
+  }
+  if (n <= 1) {
+    if (n) staged[0]->flush();
+    return;
+  }
+
+  {
+    metrics::Timer timer(metrics::kDiskWrite);
+    disk_io::run(ops, n);
+  }
+  // what a short or failed write left goes through flush(), which retries or throws
+  std::exception_ptr error;
+  for (size_t i = 0; i < n; i++) {
+    LogFile& f = *staged[i];
+    size_t done = ops[i].result > 0 ? (size_t)ops[i].result : 0;
+    metrics::add(metrics::kDiskWriteBytes, done);
+    f.flushed_ += done;
+    f.buf_.erase(0, done);
+    if (f.buf_.empty()) continue;
+    try { f.flush(); } catch (...) { if (!error) error = std::current_exception(); }
+  }
+  if (error) std::rethrow_exception(error);
+}
+
+std::vector<bool> LogFile::sync_all(const std::vector<LogFile*>& files) {
+  std::vector<DiskOp> ops;
+  ops.reserve(files.size());
+  for (LogFile* f : files) ops.push_back(DiskOp::sync(f->fd_));
+  {
+    metrics::Timer timer(metrics::kDiskSync);
+    metrics::add(metrics::kDiskSyncs, ops.size());
+    disk_io::run(ops.data(), ops.size());
+  }
+  std::vector<bool> ok(ops.size());
+  for (size_t i = 0; i < ops.size(); i++) ok[i] = ops[i].result >= 0;
+  return ok;
+}
+
+void LogFile::sync() {
+  metrics::Timer timer(metrics::kDiskSync);
+  metrics::add(metrics::kDiskSyncs);
+  if (::fdatasync(fd_) < 0) throw std::runtime_error("log fsync failed: " + path_ + ": " + std::strerror(errno));
+}
+
+void LogFile::truncate(uint64_t size) {
+  buf_.clear();
+  if (::ftruncate(fd_, (off_t)size) < 0) throw std::runtime_error("log truncate failed: " + path_ + ": " + std::strerror(errno));
+  size_ = size;
+  flushed_ = size;
+}
+
+size_t LogFile::read_at(uint64_t pos, void* buf, size_t len) const {
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = ::pread(fd_, (char*)buf + done, len - done, (off_t)(pos + done));
+    if (n == 0) break;
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      throw std::runtime_error("log read failed: " + path_ + ": " + std::strerror(errno));
+    }
+    done += (size_t)n;
+  }
+  return done;
+}
+
+bool all_digits(std::string_view name) {
+  return !name.empty() && std::all_of(name.begin(), name.end(), [](unsigned char c) { return std::isdigit(c); });
+}
@@ -0,0 +1,109 @@
+#include "lz4.h"
+
+#include <cstdint>
+#include <cstring>
+
+static constexpr size_t kMinMatch = 4;
+static constexpr size_t kLastLiterals = 5;  // a block ends with at least this many literals
+static constexpr size_t kMatchFindLimit = 12; // no match starts closer than this to the end
+static constexpr unsigned kHashBits = 12;
+static constexpr size_t kMaxOffset = 65535;
+
+static uint32_t read32(const char* p) {
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return v;
+}
+
+static uint32_t hash4(uint32_t v) {
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+static void put_length(std::string& out, size_t n) {
+  for (; n >= 255; n -= 255) out.push_back((char)255);
+  out.push_back((char)n);
+}
+
+static void put_sequence(std::string& out, const char* lit, size_t lit_len, size_t offset, size_t match_len) {
+  size_t ml = match_len - kMinMatch;
+  out.push_back((char)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15)));
+  if (lit_len >= 15) put_length(out, lit_len - 15);
+  out.append(lit, lit_len);
+  out.push_back((char)(offset & 0xFF));
+  out.push_back((char)(offset >> 8));
+  if (ml >= 15) put_length(out, ml - 15);
+}
+
+void lz4_compress(const char* src, size_t len, std::string& out) {
+  size_t anchor = 0;
+  if (len > kMatchFindLimit) {
+    uint32_t table[1u << kHashBits] = {}; // position + 1; 0 = empty
+    size_t limit = len - kMatchFindLimit, match_end_limit = len - kLastLiterals;
+    size_t ip = 0;
+    unsigned misses = 0;
+    while (ip < limit) {
+      uint32_t h = hash4(read32(src + ip));
+      size_t ref = table[h];
+      table[h] = (uint32_t)(ip + 1);
+      if (!ref || ip - (ref - 1) > kMaxOffset || read32(src + ref - 1) != read32(src + ip)) {
+        ip += 1 + (misses++ >> 6); // incompressible input is skipped over faster
+        continue;
+      }
+      misses = 0;
+      ref--;
+      while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) { ip--; ref--; }
+      size_t ml = kMinMatch;
+      while (ip + ml < match_end_limit && src[ip + ml] == src[ref + ml]) ml++;
+
+      put_sequence(out, src + anchor, ip - anchor, ip - ref, ml);
+      ip += ml;
+      anchor = ip;
+      if (ip - 2 < limit) table[hash4(read32(src + ip - 2))] = (uint32_t)(ip - 1);
+    }
+  }
+
+  size_t lit_len = len - anchor;
+  out.push_back((char)((lit_len < 15 ? lit_len : 15) << 4));
+  if (lit_len >= 15) put_length(out, lit_len - 15);
+  out.append(src + anchor, lit_len);
+}
+
+static bool get_length(const unsigned char*& p, const unsigned char* end, size_t& n) {
+  unsigned char b;
+  do {
+    if (p == end) return false;
+    b = *p++;
+    n += b;
+  } while (b == 255);
+  return true;
+}
+
+bool lz4_decompress(const char* src, size_t len, char* dst, size_t dst_len) {
+  auto p = (const unsigned char*)src, end = p + len;
+  size_t op = 0;
+  while (p < end) {
+    unsigned token = *p++;
+    size_t lit_len = token >> 4;
+    if (lit_len == 15 && !get_length(p, end, lit_len)) return false;
+    if ((size_t)(end - p) < lit_len || dst_len - op < lit_len) return false;
+    std::memcpy(dst + op, p, lit_len);
+    p += lit_len;
+    op += lit_len;
+    if (p == end) break; // the last sequence has literals only
+
+    if (end - p < 2) return false;
+    size_t offset = p[0] | (size_t)p[1] << 8;
+    p += 2;
+    size_t ml = token & 15;
+    if (ml == 15 && !get_length(p, end, ml)) return false;
+    ml += kMinMatch;
+    if (offset == 0 || offset > op || dst_len - op < ml) return false;
+
+    char* d = dst + op;
+    const char* s = d - offset;
+    if (offset >= ml) std::memcpy(d, s, ml);
+    else for (size_t i = 0; i < ml; i++) d[i] = s[i]; // overlapping: repeats the last offset bytes
+    op += ml;
+  }
+  return op == dst_len;
+}
@@ -1,10 +1,56 @@
+#include "disk_io.h"
+#include "record_cache.h"
 #include "server.h"
+#include "store.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
 #include <iostream>
+#include <string>
+
+static void usage() {
+  std::cerr <<
+    "Usage: engine [--port N] [--io-threads N] [--workers N] [--max-connections N]\n"
+    "              [--block-cache-mb N] [--disk-io uring|threads]\n";
+}
+
+int main(int argc, char** argv) {
+  ServerConfig cfg;
+  int block_cache_mb = 64;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") { usage(); return 0; }
+    if (i + 1 >= argc) { usage(); return 1; }
+    if (arg == "--disk-io") {
+      std::string backend = argv[++i];
+      if (backend != "uring" && backend != "threads") { usage(); return 1; }
+      disk_io::init(backend == "uring");
+      continue;
+    }
+    int v = std::atoi(argv[++i]);
+    if (arg == "--port") cfg.port = (uint16_t)v;
+    else if (arg == "--io-threads") cfg.io_threads = v;
+    else if (arg == "--workers") cfg.worker_threads = v;
+    else if (arg == "--max-connections") cfg.max_connections = v;
+    else if (arg == "--block-cache-mb") block_cache_mb = std::max(v, 0);
+    else { usage(); return 1; }
+  }
+
+  BlockCache::instance().set_capacity((uint64_t)block_cache_mb << 20);
 
-int main() {
   try {
-    PulseStreamServer server(9000);
-    std::cout << "PulseStream Engine listening on port 9000 (TCP, NDJSON)\n";
+    // open everything under data/ before accepting connections
+    const auto& rec = GlobalStore::instance().recovery_stats();
+    std::cout << "Recovered " << rec.topics << " topics (" << rec.partitions << " partitions) in "
+              << std::fixed << std::setprecision(1) << rec.total_ms << " ms";
+    if (!rec.slowest.empty()) std::cout << ", slowest " << rec.slowest << " " << rec.slowest_ms << " ms";
+    std::cout << "\n";
+    std::cout << "Disk I/O: " << disk_io::backend_name() << ", block cache " << block_cache_mb << " MiB\n";
+
+    PulseStreamServer server(cfg);
+    std::cout << "PulseStream Engine listening on port " << cfg.port << " (TCP, NDJSON + binary)\n";
     server.run();
   } catch (const std::exception& e) {
     std::cerr << "Fatal: " << e.what() << "\n";
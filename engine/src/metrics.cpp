@@ -0,0 +1,220 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+
+using json = nlohmann::json;
+
+namespace metrics {
+
+const char* counter_name(Counter c) {
+  switch (c) {
+    case kProduceRecords: return "produce_records";
+    case kProduceBytes: return "produce_bytes";
+    case kFetchRecords: return "fetch_records";
+    case kFetchBytes: return "fetch_bytes";
+    case kCommits: return "commits";
+    case kRequests: return "requests";
+    case kDiskWriteBytes: return "disk_write_bytes";
+    case kDiskSyncs: return "disk_syncs";
+    case kTailHits: return "tail_cache_hits";
+    case kTailMisses: return "tail_cache_misses";
+    case kBlockCacheHits: return "block_cache_hits";
+    case kBlockCacheMisses: return "block_cache_misses";
+    default: return "unknown";
+  }
+}
+
+const char* histogram_name(Histogram h) {
+  switch (h) {
+    case kProduce: return "produce";
+    case kFetch: return "fetch";
+    case kCommit: return "commit";
+    case kDiskWrite: return "disk_write";
+    case kDiskSync: return "disk_sync";
+    case kParse: return "parse";
+    case kSerialize: return "serialize";
+    case kRequest: return "request";
+    default: return "unknown";
+  }
+}
+
+static size_t bucket_of(uint64_t v) {
+  if (v < (1u << kSubBits)) return (size_t)v;
+  int msb = 63 - __builtin_clzll(v);
+  return ((size_t)(msb - kSubBits + 1) << kSubBits) + (size_t)((v >> (msb - kSubBits)) & ((1u << kSubBits) - 1));
+}
+
+// middle of the bucket's value range
+static uint64_t bucket_value(size_t b) {
+  if (b < (1u << kSubBits)) return b;
+  int shift = (int)(b >> kSubBits) - 1;
+  uint64_t lower = (uint64_t)((1u << kSubBits) + (b & ((1u << kSubBits) - 1))) << shift;
+  return lower + (((uint64_t)1 << shift) >> 1);
+}
+
+namespace {
+
+// written by its thread only, read by snapshots
+struct Slab {
+  struct Hist {
+    std::atomic<uint64_t> count{0}, sum{0}, max{0};
+    std::atomic<uint64_t> buckets[kBuckets] = {};
+  };
+  std::atomic<uint64_t> counters[kCounterCount] = {};
+  Hist hist[kHistogramCount];
+};
+
+inline void bump(std::atomic<uint64_t>& a, uint64_t n) {
+  a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+struct Registry {
+  std::mutex mu;
+  std::vector<Slab*> live;
+  Snapshot retired; // totals of exited threads
+};
+
+// never destroyed: threads joined by other statics' destructors still
+// retire their slabs into it
+Registry& registry() {
+  static Registry* r = new Registry;
+  return *r;
+}
+
+void fold(const Slab& slab, Snapshot& into) {
+  for (size_t i = 0; i < kCounterCount; i++) into.counters[i] += slab.counters[i].load(std::memory_order_relaxed);
+  for (size_t h = 0; h < kHistogramCount; h++) {
+    auto& src = slab.hist[h];
+    auto& dst = into.histograms[h];
+    dst.count += src.count.load(std::memory_order_relaxed);
+    dst.sum_ns += src.sum.load(std::memory_order_relaxed);
+    dst.max_ns = std::max(dst.max_ns, src.max.load(std::memory_order_relaxed));
+    for (size_t b = 0; b < kBuckets; b++) dst.buckets[b] += src.buckets[b].load(std::memory_order_relaxed);
+  }
+}
+
+struct LocalSlab {
+  Slab* slab = new Slab;
+
+  LocalSlab() {
+    std::lock_guard<std::mutex> lock(registry().mu);
+    registry().live.push_back(slab);
+  }
+  ~LocalSlab() {
+    auto& r = registry();
+    std::lock_guard<std::mutex> lock(r.mu);
+    fold(*slab, r.retired);
+    r.live.erase(std::find(r.live.begin(), r.live.end(), slab));
+    delete slab;
+  }
+};
+
+Slab& local() {
+  thread_local LocalSlab l;
+  return *l.slab;
+}
+
+} // namespace
+
+void add(Counter c, uint64_t n) {
+  bump(local().counters[c], n);
+}
+
+void record(Histogram h, uint64_t ns) {
+  auto& hist = local().hist[h];
+  bump(hist.count, 1);
+  bump(hist.sum, ns);
+  if (ns > hist.max.load(std::memory_order_relaxed)) hist.max.store(ns, std::memory_order_relaxed);
+  bump(hist.buckets[bucket_of(ns)], 1);
+}
+
+uint64_t HistogramSnapshot::quantile_ns(double q) const {
+  if (count == 0) return 0;
+  uint64_t rank = (uint64_t)(std::clamp(q, 0.0, 1.0) * (double)(count - 1));
+  uint64_t seen = 0;
+  for (size_t b = 0; b < kBuckets; b++) {
+    seen += buckets[b];
+    if (seen > rank) return std::min(bucket_value(b), max_ns);
+  }
+  return max_ns;
+}
+
+Snapshot snapshot() {
+  auto& r = registry();
+  std::lock_guard<std::mutex> lock(r.mu);
+  Snapshot s = r.retired;
+  for (auto* slab : r.live) fold(*slab, s);
+  return s;
+}
+
+static const std::pair<const char*, double> kQuantiles[] = {
+  {"p50", 0.5}, {"p90", 0.9}, {"p95", 0.95}, {"p99", 0.99}, {"p999", 0.999}
+};
+
+json to_json(const Snapshot& s, const Gauges& gauges) {
+  json counters = json::object(), g = json::object(), latency = json::object();
+  for (size_t i = 0; i < kCounterCount; i++) counters[counter_name((Counter)i)] = s.counters[i];
+  for (auto& [name, v] : gauges) g[name] = v;
+  for (size_t h = 0; h < kHistogramCount; h++) {
+    auto& hs = s.histograms[h];
+    json j = {{"count", hs.count},
+              {"mean", hs.count ? (double)hs.sum_ns / (double)hs.count / 1000 : 0.0},
+              {"max", (double)hs.max_ns / 1000}};
+    for (auto& [name, q] : kQuantiles) j[name] = (double)hs.quantile_ns(q) / 1000;
+    latency[histogram_name((Histogram)h)] = std::move(j);
+  }
+  return {{"counters", counters}, {"gauges", g}, {"latency_us", latency}};
+}
+
+static void append_type(std::string& out, const std::string& name, const char* type) {
+  out += "# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += '\n';
+}
+
+static void append_sample(std::string& out, const std::string& name, const char* labels, double v) {
+  char buf[64];
+  std::snprintf(buf, sizeof(buf), " %.9g\n", v);
+  out += name;
+  out += labels;
+  out += buf;
+}
+
+std::string to_prometheus(const Snapshot& s, const Gauges& gauges) {
+  std::string out;
+  for (size_t i = 0; i < kCounterCount; i++) {
+    std::string name = "pulsestream_";
+    name += counter_name((Counter)i);
+    name += "_total";
+    append_type(out, name, "counter");
+    append_sample(out, name, "", (double)s.counters[i]);
+  }
+  for (auto& [g, v] : gauges) {
+    std::string name = "pulsestream_";
+    name += g;
+    append_type(out, name, "gauge");
+    append_sample(out, name, "", (double)v);
+  }
+  for (size_t h = 0; h < kHistogramCount; h++) {
+    auto& hs = s.histograms[h];
+    std::string name = "pulsestream_";
+    name += histogram_name((Histogram)h);
+    name += "_latency_seconds";
+    append_type(out, name, "summary");
+    for (auto& [label, q] : kQuantiles) {
+      char labels[32];
+      std::snprintf(labels, sizeof(labels), "{quantile=\"%g\"}", q);
+      append_sample(out, name, labels, (double)hs.quantile_ns(q) / 1e9);
+    }
+    append_sample(out, name + "_sum", "", (double)hs.sum_ns / 1e9);
+    append_sample(out, name + "_count", "", (double)hs.count);
+  }
+  return out;
+}
+
+} // namespace metrics
@@ -0,0 +1,255 @@
+#include "offset_store.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string_view>
+
+#include "crc32c.h"
+#include "json.hpp"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+static constexpr char kFileMagic[4] = {'P', 'O', 'F', 'S'};
+static constexpr uint32_t kVersion = 2;
+static constexpr size_t kFileHeader = 8;
+
+// [u32 crc][u16 glen][u16 tlen][u32 partition][u64 next_offset]
+static constexpr size_t kRecordHeader = 20;
+
+static uint32_t record_crc(const char* h, std::string_view group, std::string_view topic) {
+  uint32_t crc = crc32c(h + 4, kRecordHeader - 4);
+  crc = crc32c(group.data(), group.size(), crc);
+  return crc32c(topic.data(), topic.size(), crc);
+}
+
+static void encode_record_header(char* h, std::string_view group, std::string_view topic,
+                                 uint32_t partition, uint64_t next_offset) {
+  uint16_t glen = (uint16_t)group.size(), tlen = (uint16_t)topic.size();
+  std::memcpy(h + 4, &glen, 2);
+  std::memcpy(h + 6, &tlen, 2);
+  std::memcpy(h + 8, &partition, 4);
+  std::memcpy(h + 12, &next_offset, 8);
+  uint32_t crc = record_crc(h, group, topic);
+  std::memcpy(h, &crc, 4);
+}
+
+static void encode_record(std::string& out, std::string_view group, std::string_view topic,
+                          uint32_t partition, uint64_t next_offset) {
+  char h[kRecordHeader];
+  encode_record_header(h, group, topic, partition, next_offset);
+  out.append(h, sizeof(h));
+  out.append(group);
+  out.append(topic);
+}
+
+static void write_file_header(LogFile& file) {
+  char header[kFileHeader];
+  std::memcpy(header, kFileMagic, 4);
+  std::memcpy(header + 4, &kVersion, 4);
+  file.append(header, sizeof(header));
+}
+
+OffsetStore::OffsetStore(const std::string& dir, const std::string& legacy_json) : dir_(dir) {
+  fs::create_directories(dir_);
+
+  uint64_t snapshot_gen = 0, last_gen = 0;
+  std::vector<uint64_t> logs;
+  for (auto& e : fs::directory_iterator(dir_)) {
+    auto ext = e.path().extension();
+    if (ext == ".tmp") { fs::remove(e.path()); continue; } // unfinished snapshot
+    auto stem = e.path().stem().string();
+    if (!all_digits(stem)) continue;
+    uint64_t gen = std::stoull(stem);
+    if (ext == ".snapshot") snapshot_gen = std::max(snapshot_gen, gen);
+    else if (ext == ".log") logs.push_back(gen);
+    else continue;
+    last_gen = std::max(last_gen, gen);
+  }
+  std::sort(logs.begin(), logs.end());
+
+  if (snapshot_gen) replay(path_for(snapshot_gen, "snapshot"));
+  uint64_t active_bytes = 0;
+  for (uint64_t gen : logs) {
+    if (gen < snapshot_gen) continue;
+    uint64_t bytes = replay(path_for(gen, "log"));
+    if (gen == logs.back()) active_bytes = bytes;
+  }
+
+  gen_ = std::max<uint64_t>(last_gen, 1);
+  log_ = std::make_unique<LogFile>(path_for(gen_, "log"));
+  if (log_->size() > active_bytes) log_->truncate(active_bytes); // torn or corrupt record, or torn header
+  if (log_->size() < kFileHeader) { log_->truncate(0); write_file_header(*log_); log_->flush(); }
+
+  if (last_gen == 0 && fs::exists(legacy_json)) {
+    import_json(legacy_json);
+    write_snapshot(gen_, table_);
+    fs::remove(legacy_json);
+  }
+  remove_before(snapshot_gen);
+}
+
+std::unique_ptr<LogFile> OffsetStore::open_log(uint64_t gen) const {
+  auto log = std::make_unique<LogFile>(path_for(gen, "log"));
+  log->truncate(0);
+  write_file_header(*log);
+  log->flush();
+  return log;
+}
+
+std::string OffsetStore::path_for(uint64_t gen, const char* ext) const {
+  char name[48];
+  std::snprintf(name, sizeof(name), "%020llu.%s", (unsigned long long)gen, ext);
+  return (fs::path(dir_) / name).string();
+}
+
+void OffsetStore::apply(std::string_view group, std::string_view topic, uint32_t partition, uint64_t next_offset) {
+  // looked up by view; keys are only built for a new group or topic
+  auto git = table_.find(group);
+  if (git == table_.end()) git = table_.emplace(std::string(group), GroupOffsets{}).first;
+  auto tit = git->second.find(topic);
+  if (tit == git->second.end()) tit = git->second.emplace(std::string(topic), std::vector<uint64_t>{}).first;
+  auto& vec = tit->second;
+  if (vec.size() <= partition) vec.resize((size_t)partition + 1, 0);
+  vec[partition] = next_offset;
+}
+
+uint64_t OffsetStore::replay(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (data.size() < kFileHeader) return 0; // empty, or its header torn
+
+  uint32_t version;
+  std::memcpy(&version, data.data() + 4, 4);
+  if (std::memcmp(data.data(), kFileMagic, 4) != 0) throw std::runtime_error("not an offsets file: " + path);
+  if (version != kVersion) throw std::runtime_error("unsupported offsets file version in " + path);
+
+  size_t pos = kFileHeader;
+  while (data.size() - pos >= kRecordHeader) {
+    const char* h = data.data() + pos;
+    uint16_t glen, tlen;
+    uint32_t crc, partition;
+    uint64_t next_offset;
+    std::memcpy(&crc, h, 4);
+    std::memcpy(&glen, h + 4, 2);
+    std::memcpy(&tlen, h + 6, 2);
+    std::memcpy(&partition, h + 8, 4);
+    std::memcpy(&next_offset, h + 12, 8);
+    size_t total = kRecordHeader + glen + tlen;
+    if (data.size() - pos < total) break;
+
+    std::string_view group(h + kRecordHeader, glen), topic(h + kRecordHeader + glen, tlen);
+    if (crc != record_crc(h, group, topic)) break;
+    // past the crc, still no partition the table could not hold
+    if (group.empty() || topic.empty() || partition >= kMaxPartitions) break;
+    apply(group, topic, partition, next_offset);
+    pos += total;
+  }
+  return pos;
+}
+
+void OffsetStore::import_json(const std::string& path) {
+  std::ifstream in(path);
+  json j;
+  try { in >> j; } catch (...) { return; }
+  if (!j.is_object()) return;
+
+  for (auto& [group, gv] : j.items()) {
+    if (!gv.is_object()) continue;
+    for (auto& [topic, tv] : gv.items()) {
+      if (!tv.is_array()) continue;
+      for (size_t p = 0; p < tv.size(); p++) {
+        if (tv[p].is_number_unsigned()) apply(group, topic, (uint32_t)p, tv[p].get<uint64_t>());
+      }
+    }
+  }
+}
+
+void OffsetStore::write_snapshot(uint64_t gen, const Table& table) const {
+  std::string path = path_for(gen, "snapshot");
+  std::string tmp = path + ".tmp";
+  {
+    LogFile out(tmp);
+    write_file_header(out);
+    std::string rec;
+    for (auto& [group, topics] : table) {
+      for (auto& [topic, vec] : topics) {
+        for (size_t p = 0; p < vec.size(); p++) {
+          rec.clear();
+          encode_record(rec, group, topic, (uint32_t)p, vec[p]);
+          out.append(rec.data(), rec.size());
+        }
+      }
+    }
+    out.flush();
+    out.sync();
+  }
+  fs::rename(tmp, path);
+}
+
+void OffsetStore::remove_before(uint64_t gen) const {
+  for (auto& e : fs::directory_iterator(dir_)) {
+    auto ext = e.path().extension();
+    if (ext != ".log" && ext != ".snapshot") continue;
+    auto stem = e.path().stem().string();
+    if (!all_digits(stem)) continue;
+    std::error_code ec;
+    if (std::stoull(stem) < gen) fs::remove(e.path(), ec);
+  }
+}
+
+bool OffsetStore::commit(std::string_view group, std::string_view topic, int partition, uint64_t next_offset) {
+  if (group.size() > UINT16_MAX || topic.size() > UINT16_MAX || partition < 0 ||
+      (uint32_t)partition >= kMaxPartitions) return false;
+
+  char h[kRecordHeader];
+  encode_record_header(h, group, topic, (uint32_t)partition, next_offset);
+
+  std::lock_guard<std::mutex> lock(mu_);
+  log_->append(h, sizeof(h));
+  log_->append(group.data(), group.size());
+  log_->append(topic.data(), topic.size());
+  log_->flush();
+  apply(group, topic, (uint32_t)partition, next_offset);
+  return true;
+}
+
+uint64_t OffsetStore::get(std::string_view group, std::string_view topic, int partition) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto itg = table_.find(group);
+  if (itg == table_.end()) return 0;
+  auto itt = itg->second.find(topic);
+  if (itt == itg->second.end()) return 0;
+  auto& vec = itt->second;
+  if (partition < 0 || partition >= (int)vec.size()) return 0;
+  return vec[partition];
+}
+
+OffsetStore::GroupOffsets OffsetStore::group(const std::string& group) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto itg = table_.find(group);
+  return itg == table_.end() ? GroupOffsets{} : itg->second;
+}
+
+void OffsetStore::maybe_snapshot() {
+  std::lock_guard<std::mutex> snapshot_lock(snapshot_mu_);
+
+  // commits keep going to the new log while the snapshot is written
+  Table copy;
+  uint64_t gen;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    if (log_->size() < kSnapshotBytes) return;
+    copy = table_;
+    gen = ++gen_;
+    log_ = open_log(gen);
+  }
+
+  write_snapshot(gen, copy);
+  remove_before(gen);
+}
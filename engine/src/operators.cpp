@@ -0,0 +1,271 @@
+#include "operators.h"
+#include "record_filter.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+bool operator_spec_from_json(const json& j, OperatorSpec& spec, std::string& err) {
+  try {
+    spec.name = j.value("name", spec.name);
+    spec.window_ms = j.value("window_ms", spec.window_ms);
+    spec.slide_ms = j.value("slide_ms", spec.slide_ms);
+    spec.field = j.value("field", spec.field);
+    spec.output_topic = j.value("output_topic", spec.output_topic);
+    if (j.contains("group_by")) {
+      std::string by = j["group_by"].get<std::string>();
+      if (by == "key") spec.by_key = true;
+      else if (by == "none") spec.by_key = false;
+      else { err = "bad_group_by"; return false; }
+    }
+  } catch (const json::exception&) {
+    err = "bad_operator";
+    return false;
+  }
+
+  if (spec.name.empty()) { err = "missing_name"; return false; }
+  if (spec.slide_ms == 0) spec.slide_ms = spec.window_ms;
+  if (spec.window_ms == 0 || spec.window_ms % spec.slide_ms != 0 ||
+      spec.window_ms / spec.slide_ms > StreamOperator::kMaxPanes) {
+    err = "bad_window"; return false;
+  }
+  return true;
+}
+
+json operator_spec_to_json(const OperatorSpec& spec) {
+  return {
+    {"name", spec.name},
+    {"window_ms", spec.window_ms},
+    {"slide_ms", spec.slide_ms},
+    {"field", spec.field},
+    {"group_by", spec.by_key ? "key" : "none"},
+    {"output_topic", spec.output_topic}
+  };
+}
+
+std::vector<OperatorSpec> load_operator_specs(const std::string& topic_dir) {
+  std::vector<OperatorSpec> specs;
+  std::ifstream in(fs::path(topic_dir) / "_operators.json");
+  if (!in) return specs;
+
+  json j;
+  try { in >> j; } catch (...) { return specs; }
+  if (!j.is_array()) return specs;
+  for (auto& e : j) {
+    OperatorSpec spec;
+    std::string err;
+    if (e.is_object() && operator_spec_from_json(e, spec, err)) specs.push_back(std::move(spec));
+  }
+  return specs;
+}
+
+void save_operator_specs(const std::string& topic_dir, const std::vector<OperatorSpec>& specs) {
+  json j = json::array();
+  for (auto& s : specs) j.push_back(operator_spec_to_json(s));
+  std::ofstream out(fs::path(topic_dir) / "_operators.json");
+  out << j.dump(2);
+}
+
+// ---- QuantileSketch ----
+
+static const double kGamma = (1 + QuantileSketch::kRelativeError) / (1 - QuantileSketch::kRelativeError);
+static const double kLogGamma = std::log(kGamma);
+
+int QuantileSketch::bucket(double v) const {
+  return (int)std::ceil(std::log(v) / kLogGamma);
+}
+
+// midpoint (in relative terms) of the bucket's range (gamma^(i-1), gamma^i]
+double QuantileSketch::value_of(int bucket) const {
+  return 2 * std::pow(kGamma, bucket) / (kGamma + 1);
+}
+
+void QuantileSketch::add(double v) {
+  if (!std::isfinite(v)) return;
+  if (v > 0) positive_[bucket(v)]++;
+  else if (v < 0) negative_[bucket(-v)]++;
+  else zero_++;
+  count_++;
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+  for (auto& [b, n] : other.positive_) positive_[b] += n;
+  for (auto& [b, n] : other.negative_) negative_[b] += n;
+  zero_ += other.zero_;
+  count_ += other.count_;
+}
+
+double QuantileSketch::quantile(double q) const {
+  if (count_ == 0) return 0;
+  uint64_t rank = (uint64_t)(std::clamp(q, 0.0, 1.0) * (double)(count_ - 1));
+
+  // ascending: most negative first
+  uint64_t seen = 0;
+  for (auto it = negative_.rbegin(); it != negative_.rend(); ++it) {
+    seen += it->second;
+    if (seen > rank) return -value_of(it->first);
+  }
+  seen += zero_;
+  if (seen > rank) return 0;
+  for (auto& [b, n] : positive_) {
+    seen += n;
+    if (seen > rank) return value_of(b);
+  }
+  return positive_.empty() ? 0 : value_of(positive_.rbegin()->first);
+}
+
+// ---- WindowAggregate ----
+
+void WindowAggregate::add(const double* v) {
+  count++;
+  if (!v) return;
+  if (numeric == 0 || *v < min) min = *v;
+  if (numeric == 0 || *v > max) max = *v;
+  numeric++;
+  sum += *v;
+  sketch.add(*v);
+}
+
+void WindowAggregate::merge(const WindowAggregate& other) {
+  if (other.numeric) {
+    if (numeric == 0 || other.min < min) min = other.min;
+    if (numeric == 0 || other.max > max) max = other.max;
+  }
+  count += other.count;
+  numeric += other.numeric;
+  sum += other.sum;
+  sketch.merge(other.sketch);
+}
+
+json WindowAggregate::to_json() const {
+  json j = {{"count", count}, {"numeric", numeric}};
+  if (numeric == 0) return j;
+  j["sum"] = sum;
+  j["min"] = min;
+  j["max"] = max;
+  j["avg"] = sum / (double)numeric;
+  j["p50"] = sketch.quantile(0.50);
+  j["p95"] = sketch.quantile(0.95);
+  j["p99"] = sketch.quantile(0.99);
+  return j;
+}
+
+static std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '\n' || s.front() == '\r')) s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\n' || s.back() == '\r')) s.remove_suffix(1);
+  return s;
+}
+
+// No JSON parse: reads the token after the first `"field":`, which is the
+// top-level member for the flat event objects producers send.
+bool extract_number(std::string_view value, std::string_view field, double& out) {
+  std::string_view v = field.empty() ? trim(value) : json_field_token(value, field);
+  if (v.empty()) return false;
+  auto [p, ec] = std::from_chars(v.data(), v.data() + v.size(), out);
+  return ec == std::errc() && p == v.data() + v.size();
+}
+
+// ---- StreamOperator ----
+
+StreamOperator::StreamOperator(OperatorSpec spec)
+  : spec_(std::move(spec)), slide_ms_(spec_.slide_ms ? spec_.slide_ms : spec_.window_ms) {}
+
+void StreamOperator::add(const KeyValue* recs, size_t n, uint64_t now, std::vector<Output>& out) {
+  std::lock_guard<std::mutex> lock(mu_);
+  advance_locked(now, out);
+
+  for (size_t i = 0; i < n; i++) {
+    std::string_view key = spec_.by_key ? recs[i].key : std::string_view();
+    auto it = keys_.find(key);
+    if (it == keys_.end()) {
+      if (keys_.size() >= kMaxKeys) key = kOverflowKey;
+      it = keys_.try_emplace(std::string(key)).first;
+    }
+    auto& panes = it->second;
+    if (panes.empty() || panes.back().start != current_pane_) panes.push_back(Pane{current_pane_, {}});
+
+    double v;
+    bool numeric = extract_number(recs[i].value, spec_.field, v);
+    panes.back().agg.add(numeric ? &v : nullptr);
+  }
+}
+
+void StreamOperator::tick(uint64_t now, std::vector<Output>& out) {
+  std::lock_guard<std::mutex> lock(mu_);
+  advance_locked(now, out);
+}
+
+// Moves to the pane holding now. A window ends at every boundary passed;
+// with an output topic each is emitted, as far as it still holds records.
+void StreamOperator::advance_locked(uint64_t now, std::vector<Output>& out) {
+  uint64_t pane = now - now % slide_ms_;
+  if (current_pane_ == 0) { current_pane_ = pane; return; }
+  if (pane <= current_pane_) return; // clock stepped back: keep filling the current pane
+
+  if (!spec_.output_topic.empty()) {
+    uint64_t last = current_pane_ + spec_.window_ms; // later windows are empty
+    for (uint64_t end = current_pane_ + slide_ms_; end <= pane && end <= last; end += slide_ms_) emit_locked(end, out);
+  }
+  current_pane_ = pane;
+
+  // keep the panes the windows ending from the next boundary on still need
+  uint64_t next_end = current_pane_ + slide_ms_;
+  uint64_t keep_from = next_end > spec_.window_ms ? next_end - spec_.window_ms : 0;
+  for (auto it = keys_.begin(); it != keys_.end();) {
+    auto& panes = it->second;
+    while (!panes.empty() && panes.front().start < keep_from) panes.pop_front();
+    if (panes.empty()) it = keys_.erase(it);
+    else ++it;
+  }
+}
+
+WindowAggregate StreamOperator::window_locked(const std::deque<Pane>& panes, uint64_t window_end) const {
+  WindowAggregate agg;
+  uint64_t start = window_end > spec_.window_ms ? window_end - spec_.window_ms : 0;
+  for (auto& p : panes) {
+    if (p.start >= start && p.start < window_end) agg.merge(p.agg);
+  }
+  return agg;
+}
+
+void StreamOperator::emit_locked(uint64_t window_end, std::vector<Output>& out) const {
+  for (auto& [key, panes] : keys_) {
+    WindowAggregate agg = window_locked(panes, window_end);
+    if (agg.count == 0) continue;
+    json j = agg.to_json();
+    j["operator"] = spec_.name;
+    j["window_start"] = window_end - std::min(window_end, spec_.window_ms);
+    j["window_end"] = window_end;
+    if (spec_.by_key) j["key"] = key;
+    out.push_back({key, j.dump()});
+  }
+}
+
+json StreamOperator::window_json(uint64_t window_end) const {
+  json j = {{"operator", spec_.name},
+            {"window_start", window_end - std::min(window_end, spec_.window_ms)},
+            {"window_end", window_end}};
+  if (!spec_.by_key) {
+    auto it = keys_.find(std::string_view());
+    j.update(it == keys_.end() ? WindowAggregate{}.to_json() : window_locked(it->second, window_end).to_json());
+    return j;
+  }
+  json groups = json::object();
+  for (auto& [key, panes] : keys_) {
+    WindowAggregate agg = window_locked(panes, window_end);
+    if (agg.count) groups[key] = agg.to_json();
+  }
+  j["groups"] = std::move(groups);
+  return j;
+}
+
+json StreamOperator::query(uint64_t now) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  uint64_t pane = now - now % slide_ms_;
+  return window_json(std::max(pane, current_pane_) + slide_ms_);
+}
@@ -0,0 +1,1114 @@
+#include "partition_log.h"
+#include "metrics.h"
+#include "record_batch.h"
+
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+using namespace record_format;
+
+static uint64_t now_ms() {
+  using namespace std::chrono;
+  return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+struct Frame {
+  uint64_t pos = 0;
+  uint64_t offset = 0;       // of the first record
+  uint64_t last_offset = 0;
+  uint64_t ts = 0;
+  uint64_t size = 0;
+  uint32_t count = 1;        // records in the frame
+  Codec codec = Codec::None; // set for batch frames, whose value is the batch payload
+  std::string_view key, value;
+  std::string_view raw; // the whole frame as stored (empty for header-only reads)
+
+  bool batch() const { return codec != Codec::None; }
+};
+
+// Frame layouts a FrameReader understands: the original segment-less log
+// [u64 ts][u32 klen][u32 vlen][k][v] whose frames carry no offset, version 1
+// segments (no crc), and the current format (see record.h).
+enum class FrameFormat { Legacy, V1, Current };
+
+// Sequential frame reader over a LogFile, up to file position end. Reads the
+// log in large windows with pread() instead of one seek+read per field. Also
+// reads frames held in memory (a tail buffer chunk); positions are then
+// relative to its start.
+class FrameReader {
+public:
+  FrameReader(const LogFile& log, uint64_t pos, uint64_t end = UINT64_MAX, FrameFormat format = FrameFormat::Current)
+      : log_(&log), pos_(pos), end_(end), format_(format) {}
+  explicit FrameReader(std::string_view frames)
+      : pos_(0), end_(frames.size()), format_(FrameFormat::Current), data_(frames.data()), len_(frames.size()) {}
+
+  // Checks the crc of every frame read with its body.
+  void verify(bool on) { verify_ = on; }
+  // Reads the file through the block cache.
+  void cached(bool on) { cached_ = on; }
+  // true once next() stopped at a frame whose crc did not match
+  bool corrupt() const { return corrupt_; }
+
+  // Returns false at end of data, on a corrupt header or (when verifying) a
+  // crc mismatch. The views in f stay valid until the next call. With body =
+  // false only the header is read and the key/value bytes are skipped.
+  bool next(Frame& f, bool body = true) {
+    size_t header = format_ == FrameFormat::Legacy ? 16 : format_ == FrameFormat::V1 ? 24 : kHeaderSize;
+    if (!ensure(header)) return false;
+    const char* p = data_ + off_;
+    uint32_t klen, vlen;
+    if (format_ == FrameFormat::Legacy) {
+      f.offset = 0;
+      std::memcpy(&f.ts, p, 8);
+      std::memcpy(&klen, p + 8, 4);
+      std::memcpy(&vlen, p + 12, 4);
+    } else {
+      std::memcpy(&f.offset, p, 8);
+      std::memcpy(&f.ts, p + 8, 8);
+      std::memcpy(&klen, p + 16, 4);
+      std::memcpy(&vlen, p + 20, 4);
+    }
+    f.codec = Codec::None;
+    f.count = 1;
+    f.last_offset = f.offset;
+    bool batch = format_ == FrameFormat::Current && (klen & kBatchFlag);
+    if (batch) {
+      f.codec = (Codec)(klen & 0xFF);
+      if (f.codec != Codec::Lz4 || vlen < kBatchPrefix) return false;
+      klen = 0;
+    }
+    if (klen > kMaxKey || vlen > kMaxValue) return false;
+
+    size_t total = header + klen + vlen;
+    if (end_ - pos_ < total) return false;
+    f.pos = pos_;
+    f.size = total;
+    if (batch) { // count and last offset lead the payload
+      if (!ensure(header + kBatchPrefix)) return false;
+      uint32_t last_delta;
+      std::memcpy(&f.count, data_ + off_ + header, 4);
+      std::memcpy(&last_delta, data_ + off_ + header + 4, 4);
+      f.last_offset = f.offset + last_delta;
+    }
+
+    if (!body) {
+      f.key = f.value = f.raw = {};
+      if (len_ - off_ >= total) off_ += total;
+      else off_ = len_ = 0;
+      pos_ += total;
+      return true;
+    }
+
+    if (!ensure(total)) return false;
+    p = data_ + off_;
+    f.key = std::string_view(p + header, klen);
+    f.value = std::string_view(p + header + klen, vlen);
+    f.raw = std::string_view(p, total);
+    if (verify_ && format_ == FrameFormat::Current && !frame_intact(f.raw)) { corrupt_ = true; return false; }
+    off_ += total; pos_ += total;
+    return true;
+  }
+
+private:
+  static constexpr size_t kWindow = 64 * 1024;
+
+  bool ensure(size_t n) {
+    if (len_ - off_ >= n) return true;
+    if (!log_ || end_ - pos_ < n) return false;
+    std::memmove(buf_.data(), buf_.data() + off_, len_ - off_);
+    len_ -= off_; off_ = 0;
+    if (buf_.size() < std::max(n, kWindow)) buf_.resize(std::max(n, kWindow));
+    data_ = buf_.data();
+    size_t want = (size_t)std::min<uint64_t>(buf_.size() - len_, end_ - pos_ - len_);
+    len_ += cached_ ? BlockCache::instance().read(*log_, pos_ + len_, buf_.data() + len_, want)
+                    : log_->read_at(pos_ + len_, buf_.data() + len_, want);
+    return len_ >= n;
+  }
+
+  const LogFile* log_ = nullptr; // null when reading from memory
+  uint64_t pos_;   // file position of data_[off_]
+  uint64_t end_;
+  FrameFormat format_;
+  bool verify_ = false, corrupt_ = false, cached_ = false;
+  std::string buf_;
+  const char* data_ = nullptr; // buf_, or the frames in memory
+  size_t off_ = 0, len_ = 0;
+};
+
+// The records of a frame: the frame itself, or a batch's records
+// decompressed into scratch. False if a batch does not decode.
+static bool frame_records(const Frame& f, std::string& scratch, std::vector<BatchRecord>& out) {
+  if (!f.batch()) { out.assign(1, BatchRecord{f.offset, f.key, f.value}); return true; }
+  return decode_batch_payload(f.offset, f.codec, f.value, scratch, out);
+}
+
+static std::string index_path(const std::string& log_path) {
+  std::string path = log_path;
+  path.replace(path.size() - 4, 4, ".index");
+  return path;
+}
+
+static std::string time_index_path(const std::string& log_path) {
+  std::string path = log_path;
+  path.replace(path.size() - 4, 4, ".timeindex");
+  return path;
+}
+
+static void write_segment_header(LogFile& file) {
+  char header[kSegmentHeaderSize];
+  std::memcpy(header, kSegmentMagic, 4);
+  std::memcpy(header + 4, &kVersion, 4);
+  file.append(header, sizeof(header));
+}
+
+template <typename Entry>
+SparseIndex<Entry>::SparseIndex() : chunks_(std::make_shared<const Chunks>()) {}
+
+template <typename Entry>
+SparseIndex<Entry>::~SparseIndex() {
+  if (mapped_) ::munmap((void*)mapped_, mapped_count_ * sizeof(Entry));
+}
+
+template <typename Entry>
+void SparseIndex<Entry>::map(int fd, uint64_t count) {
+  void* p = ::mmap(nullptr, count * sizeof(Entry), PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) throw std::runtime_error("mmap index failed");
+  mapped_ = (const Entry*)p;
+  mapped_count_ = count;
+}
+
+template <typename Entry>
+typename SparseIndex<Entry>::Snapshot SparseIndex<Entry>::snapshot() const {
+  Snapshot snap;
+  snap.mapped = mapped_;
+  snap.mapped_count = mapped_count_;
+  snap.size = mapped_count_ + appended_.load(std::memory_order_acquire);
+  snap.chunks = chunks_.load(std::memory_order_acquire);
+  return snap;
+}
+
+template <typename Entry>
+void SparseIndex<Entry>::push_back(const Entry& e) {
+  uint64_t n = appended_.load(std::memory_order_relaxed);
+  auto chunks = chunks_.load(std::memory_order_relaxed);
+  if ((n >> kChunkBits) >= chunks->size()) {
+    auto grown = std::make_shared<Chunks>(*chunks);
+    grown->push_back(std::shared_ptr<Entry[]>(new Entry[kChunkSize]));
+    chunks = grown;
+    chunks_.store(chunks, std::memory_order_release);
+  }
+  (*chunks)[n >> kChunkBits][n & (kChunkSize - 1)] = e;
+  appended_.store(n + 1, std::memory_order_release);
+}
+
+template class SparseIndex<IndexEntry>;
+template class SparseIndex<TimeIndexEntry>;
+
+uint64_t Segment::seek(uint64_t offset) const {
+  auto snap = index.snapshot();
+  uint64_t n = snap.count_below([&](const IndexEntry& e) { return e.offset <= offset; });
+  return n ? snap.at(n - 1).pos : kSegmentHeaderSize;
+}
+
+// the last entry still older than ts: every record before it is, too
+uint64_t Segment::seek_time(uint64_t ts) const {
+  auto snap = time_index.snapshot();
+  uint64_t n = snap.count_below([&](const TimeIndexEntry& e) { return e.ts < ts; });
+  return n ? snap.at(n - 1).offset : base_offset;
+}
+
+PartitionLog::PartitionLog(const std::string& dir, const std::string& legacy_path, const TopicConfig& cfg)
+    : dir_(dir), cfg_(cfg), tail_(cfg.tail_cache_bytes) {
+  fs::create_directories(dir_);
+
+  // leftovers of an interrupted compaction
+  for (auto& e : fs::directory_iterator(dir_)) {
+    if (e.path().extension() == ".compacting") fs::remove(e.path());
+  }
+
+  if (!legacy_path.empty() && fs::exists(legacy_path)) convert_legacy(legacy_path);
+
+  std::vector<std::pair<uint64_t, std::string>> files;
+  for (auto& e : fs::directory_iterator(dir_)) {
+    auto name = e.path().filename().string();
+    if (e.path().extension() != ".log" || name.size() != 24) continue;
+    auto stem = e.path().stem().string();
+    if (!all_digits(stem)) continue;
+    files.emplace_back(std::stoull(stem), e.path().string());
+  }
+  std::sort(files.begin(), files.end());
+
+  SegmentList list;
+  for (auto& [base, path] : files) {
+    upgrade_segment(path);
+    list.push_back(open_segment(path, base));
+    if (list.size() > 1) { // only the active segment grows
+      list[list.size() - 2]->index_file.reset();
+      list[list.size() - 2]->time_index_file.reset();
+    }
+  }
+  if (list.empty()) list.push_back(create_segment(0));
+
+  active_ = list.back();
+  next_offset_ = active_->end_offset.load(std::memory_order_relaxed);
+  last_sync_ms_ = now_ms();
+  publish(std::move(list));
+}
+
+std::string PartitionLog::segment_path(uint64_t base_offset) const {
+  char name[32];
+  std::snprintf(name, sizeof(name), "%020llu.log", (unsigned long long)base_offset);
+  return (fs::path(dir_) / name).string();
+}
+
+void PartitionLog::publish(SegmentList list) {
+  segments_.store(std::make_shared<const SegmentList>(std::move(list)), std::memory_order_release);
+}
+
+// Opens a segment and its sparse indexes. The offset index is trusted up to
+// its last entry once that entry's frame is checked against the log and its
+// crc; only frames from there on are scanned (all of them if the index is
+// missing or stale), checked and indexed, and the log is cut at the first
+// torn or corrupt frame. The time index must then match
+// it entry for entry, or it is rebuilt from the frames before that point.
+std::shared_ptr<Segment> PartitionLog::open_segment(const std::string& path, uint64_t base_offset) {
+  auto seg = std::make_shared<Segment>();
+  seg->base_offset = base_offset;
+  seg->file = std::make_shared<LogFile>(path);
+  seg->index_file = std::make_unique<LogFile>(index_path(path));
+  seg->time_index_file = std::make_unique<LogFile>(time_index_path(path));
+  LogFile& log = *seg->file;
+  LogFile& idx = *seg->index_file;
+  LogFile& tidx = *seg->time_index_file;
+
+  if (log.size() == 0) {
+    write_segment_header(log);
+    log.flush();
+    idx.truncate(0);
+    tidx.truncate(0);
+    seg->end_offset = base_offset;
+    seg->end_pos = kSegmentHeaderSize;
+    return seg;
+  }
+
+  char header[kSegmentHeaderSize];
+  uint32_t version = 0;
+  if (log.read_at(0, header, sizeof(header)) != sizeof(header) || std::memcmp(header, kSegmentMagic, 4) != 0)
+    throw std::runtime_error("not a segment file: " + path);
+  std::memcpy(&version, header + 4, 4);
+  if (version < 2 || version > kVersion) throw std::runtime_error("unsupported segment version in " + path);
+
+  uint64_t count = idx.size() / sizeof(IndexEntry);
+  IndexEntry last;
+  bool valid = idx.size() % sizeof(IndexEntry) == 0;
+  if (valid && count) {
+    char fh[kHeaderSize];
+    uint64_t at_offset = 0;
+    valid = idx.read_at((count - 1) * sizeof(IndexEntry), &last, sizeof(last)) == sizeof(last) &&
+            last.pos >= kSegmentHeaderSize &&
+            log.read_at(last.pos, fh, sizeof(fh)) == sizeof(fh) &&
+            frame_size(fh) && last.pos + frame_size(fh) <= log.size();
+    if (valid) { std::memcpy(&at_offset, fh, 8); valid = at_offset == last.offset; }
+    if (valid) {
+      std::string frame(frame_size(fh), '\0');
+      valid = log.read_at(last.pos, frame.data(), frame.size()) == frame.size() && frame_intact(frame);
+    }
+  }
+  if (!valid || !count) { idx.truncate(0); count = 0; }
+  if (count) {
+    seg->index.map(idx.fd(), count);
+    seg->last_indexed_pos = last.pos;
+  }
+
+  uint64_t max_ts = 0; // of the records before the scan position
+  TimeIndexEntry tlast;
+  bool time_valid = tidx.size() == count * sizeof(TimeIndexEntry) &&
+                    (!count || (tidx.read_at((count - 1) * sizeof(tlast), &tlast, sizeof(tlast)) == sizeof(tlast) &&
+                                tlast.offset == last.offset));
+  if (time_valid && count) {
+    seg->time_index.map(tidx.fd(), count);
+    max_ts = tlast.ts;
+  } else if (!time_valid) {
+    tidx.truncate(0);
+    if (count) {
+      auto snap = seg->index.snapshot();
+      uint64_t i = 0;
+      FrameReader reader(log, kSegmentHeaderSize, last.pos);
+      Frame f;
+      while (reader.next(f, /*body=*/false)) {
+        if (i < count && snap.at(i).pos == f.pos) {
+          TimeIndexEntry t{max_ts, f.offset};
+          seg->time_index.push_back(t);
+          tidx.append(&t, sizeof(t));
+          i++;
+        }
+        max_ts = std::max(max_ts, f.ts);
+      }
+      TimeIndexEntry t{max_ts, last.offset};
+      seg->time_index.push_back(t);
+      tidx.append(&t, sizeof(t));
+    }
+  }
+
+  uint64_t end_offset = base_offset, end_pos = kSegmentHeaderSize;
+  bool any = false;
+  FrameReader reader(log, count ? last.pos : kSegmentHeaderSize);
+  reader.verify(true);
+  Frame f;
+  while (reader.next(f)) {
+    if (any && f.offset < end_offset) break; // offsets only go up; garbage
+    any = true;
+    if (!seg->last_indexed_pos || f.pos - seg->last_indexed_pos >= Segment::kIndexIntervalBytes) {
+      IndexEntry e{f.offset, f.pos};
+      TimeIndexEntry t{max_ts, f.offset};
+      seg->index.push_back(e);
+      seg->time_index.push_back(t);
+      idx.append(&e, sizeof(e));
+      tidx.append(&t, sizeof(t));
+      seg->last_indexed_pos = f.pos;
+    }
+    end_offset = f.last_offset + 1;
+    end_pos = f.pos + f.size;
+    max_ts = std::max(max_ts, f.ts);
+  }
+  if (end_pos < log.size()) log.truncate(end_pos); // torn write at the tail
+  idx.flush();
+  tidx.flush();
+
+  seg->end_offset = end_offset;
+  seg->end_pos = end_pos;
+  seg->max_ts = max_ts;
+  return seg;
+}
+
+std::shared_ptr<Segment> PartitionLog::create_segment(uint64_t base_offset) {
+  return open_segment(segment_path(base_offset), base_offset);
+}
+
+// Rewrites a pre-segment pN.log into this partition's first segment.
+void PartitionLog::convert_legacy(const std::string& legacy_path) {
+  // output of an earlier, interrupted conversion
+  for (auto& e : fs::directory_iterator(dir_)) {
+    auto ext = e.path().extension();
+    if (ext == ".log" || ext == ".index" || ext == ".timeindex") fs::remove(e.path());
+  }
+
+  {
+    LogFile in(legacy_path);
+    auto seg = create_segment(0);
+    FrameReader reader(in, 0, UINT64_MAX, FrameFormat::Legacy);
+    Frame f;
+    uint64_t offset = 0;
+    while (reader.next(f)) {
+      char header[kHeaderSize];
+      encode_header(header, offset++, f.ts, f.key, f.value);
+      seg->file->append(header, sizeof(header));
+      seg->file->append(f.key.data(), f.key.size());
+      seg->file->append(f.value.data(), f.value.size());
+    }
+    seg->file->flush();
+    seg->file->sync();
+  }
+  fs::remove(legacy_path); // the index is rebuilt when the segment is opened
+}
+
+// Rewrites a version 1 segment (frames without a crc) in the current
+// format. The indexes go first: should we stop before the rename, the old
+// segment is still there to convert again, without them.
+void PartitionLog::upgrade_segment(const std::string& path) {
+  uint32_t version = kVersion;
+  {
+    LogFile in(path);
+    char header[kSegmentHeaderSize];
+    if (in.read_at(0, header, sizeof(header)) != sizeof(header) || std::memcmp(header, kSegmentMagic, 4) != 0) return;
+    std::memcpy(&version, header + 4, 4);
+    if (version != 1) return;
+
+    std::string tmp = path + ".compacting";
+    LogFile out(tmp);
+    out.truncate(0);
+    write_segment_header(out);
+    FrameReader reader(in, kSegmentHeaderSize, in.size(), FrameFormat::V1);
+    Frame f;
+    uint64_t last = 0;
+    bool any = false;
+    while (reader.next(f)) {
+      if (any && f.offset < last) break;
+      any = true;
+      last = f.offset;
+      char fh[kHeaderSize];
+      encode_header(fh, f.offset, f.ts, f.key, f.value);
+      out.append(fh, sizeof(fh));
+      out.append(f.key.data(), f.key.size());
+      out.append(f.value.data(), f.value.size());
+    }
+    out.flush();
+    out.sync();
+  }
+  std::error_code ec;
+  fs::remove(index_path(path), ec);
+  fs::remove(time_index_path(path), ec);
+  fs::rename(path + ".compacting", path);
+}
+
+void PartitionLog::roll_locked() {
+  LogFile::flush_all({active_->file.get(), active_->index_file.get(), active_->time_index_file.get()});
+  if (cfg_.durability != Durability::None) active_->file->sync();
+  active_->index_file.reset();
+  active_->time_index_file.reset();
+  dirty_ = false;
+
+  auto seg = create_segment(next_offset_);
+  SegmentList list = *segments_.load(std::memory_order_acquire);
+  list.push_back(seg);
+  publish(std::move(list));
+  active_ = seg;
+}
+
+// Group commit round: writes everything staged so far and fsyncs it once
+// while other producers keep staging behind us, then publishes it.
+void PartitionLog::sync_pending_locked(std::unique_lock<std::mutex>& lock) {
+  syncing_ = true;
+  std::vector<PendingIndex> batch;
+  batch.swap(pending_index_);
+  uint64_t target = appended_seq_;
+  uint64_t end_offset = next_offset_;
+  auto seg = active_;
+  uint64_t end_pos = seg->file->size();
+  try {
+    LogFile::flush_all({seg->file.get(), seg->index_file.get(), seg->time_index_file.get()});
+    lock.unlock();
+    seg->file->sync();
+    lock.lock();
+  } catch (...) {
+    if (!lock.owns_lock()) lock.lock();
+    fail_sync_locked(*seg);
+    throw;
+  }
+
+  for (auto& e : batch) { seg->index.push_back(e.index); seg->time_index.push_back(e.time); }
+  seg->end_pos.store(end_pos, std::memory_order_release);
+  seg->end_offset.store(end_offset, std::memory_order_release);
+  durable_seq_ = target;
+  syncing_ = false;
+  synced_cv_.notify_all();
+  notify_watchers(end_offset);
+}
+
+// A Batch round failed. Its records, and any staged behind it, are never
+// published: a later fsync may succeed with the pages of the failed write
+// dropped. The files are cut back to the published end (best effort, so a
+// reopen does not recover the records either) and the partition takes no
+// more appends; every producer waiting on a round fails.
+void PartitionLog::fail_sync_locked(Segment& seg) {
+  failed_ = true;
+  pending_index_.clear();
+  try {
+    seg.file->truncate(seg.end_pos.load(std::memory_order_relaxed));
+    seg.index_file->truncate(seg.index.size() * sizeof(IndexEntry));
+    seg.time_index_file->truncate(seg.time_index.size() * sizeof(TimeIndexEntry));
+  } catch (...) {}
+  syncing_ = false;
+  synced_cv_.notify_all();
+}
+
+// A None / Interval write failed: what is staged past the published end,
+// and whatever part of it reached the file, is dropped and its offsets are
+// handed out again. If the files cannot be cut back the partition fails as
+// after a failed Batch round.
+void PartitionLog::unstage_locked(Segment& seg) {
+  pending_index_.clear();
+  next_offset_ = seg.end_offset.load(std::memory_order_relaxed);
+  auto snap = seg.index.snapshot();
+  seg.last_indexed_pos = snap.size ? snap.at(snap.size - 1).pos : 0;
+  tail_.clear(); // holds the dropped frames
+  try {
+    seg.file->truncate(seg.end_pos.load(std::memory_order_relaxed));
+    seg.index_file->truncate(seg.index.size() * sizeof(IndexEntry));
+    seg.time_index_file->truncate(seg.time_index.size() * sizeof(TimeIndexEntry));
+  } catch (...) {
+    failed_ = true;
+  }
+}
+
+void PartitionLog::check_failed_locked() const {
+  if (failed_) throw std::runtime_error("partition " + dir_ + " lost records to a failed write or fsync; reopen it to append");
+}
+
+// Writes staged records to the kernel and publishes them (None / Interval).
+// On failure they are dropped (see unstage_locked()), so the producer that
+// gets the error knows none of them was written.
+void PartitionLog::flush_pending_locked() {
+  Segment& seg = *active_;
+  try {
+    LogFile::flush_all({seg.file.get(), seg.index_file.get(), seg.time_index_file.get()});
+  } catch (...) {
+    unstage_locked(seg);
+    throw;
+  }
+  // publish only after the bytes are in the file so readers never see a partial record
+  for (auto& e : pending_index_) { seg.index.push_back(e.index); seg.time_index.push_back(e.time); }
+  pending_index_.clear();
+  seg.end_pos.store(seg.file->size(), std::memory_order_release);
+  seg.end_offset.store(next_offset_, std::memory_order_release);
+  if (cfg_.durability == Durability::Interval) dirty_ = true;
+  notify_watchers(next_offset_);
+}
+
+void PartitionLog::notify_watchers(uint64_t end_offset) {
+  // pairs with the fence in watch(): either we see its watcher or it sees our end offset
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (watcher_count_.load(std::memory_order_relaxed) == 0) return;
+
+  std::vector<std::function<void()>> due;
+  {
+    std::lock_guard<std::mutex> lock(watch_mu_);
+    for (auto it = watchers_.begin(); it != watchers_.end();) {
+      if (it->second.after_offset < end_offset) { due.push_back(std::move(it->second.fn)); it = watchers_.erase(it); }
+      else ++it;
+    }
+    watcher_count_.store(watchers_.size(), std::memory_order_relaxed);
+  }
+  for (auto& fn : due) fn();
+}
+
+uint64_t PartitionLog::watch(uint64_t after_offset, std::function<void()> fn) {
+  std::unique_lock<std::mutex> lock(watch_mu_);
+  uint64_t token = next_watch_++;
+  auto it = watchers_.emplace(token, Watcher{after_offset, std::move(fn)}).first;
+  watcher_count_.store(watchers_.size(), std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (end_offset() <= after_offset) return token;
+
+  fn = std::move(it->second.fn);
+  watchers_.erase(it);
+  watcher_count_.store(watchers_.size(), std::memory_order_relaxed);
+  lock.unlock();
+  fn();
+  return 0;
+}
+
+void PartitionLog::unwatch(uint64_t token) {
+  std::lock_guard<std::mutex> lock(watch_mu_);
+  watchers_.erase(token);
+  watcher_count_.store(watchers_.size(), std::memory_order_relaxed);
+}
+
+uint64_t PartitionLog::append(const KeyValue* recs, size_t n) {
+  queued_.fetch_add(1, std::memory_order_relaxed);
+  struct Dequeue {
+    std::atomic<uint32_t>& n;
+    ~Dequeue() { n.fetch_sub(1, std::memory_order_relaxed); }
+  } dequeue{queued_};
+
+  // compressed outside the lock; offsets are relative until the base is known
+  std::string payload;
+  bool compressed = false;
+  if (cfg_.compression != Codec::None && n > 1) {
+    std::vector<BatchRecord> batch(n);
+    for (size_t i = 0; i < n; i++) batch[i] = {i, recs[i].key, recs[i].value};
+    payload.assign(kHeaderSize, '\0'); // the header is filled in once the base offset is known
+    compressed = encode_batch_payload(cfg_.compression, batch.data(), n, payload);
+  }
+
+  std::unique_lock<std::mutex> lock(append_mu_);
+  bool batch = cfg_.durability == Durability::Batch;
+  check_failed_locked();
+
+  // roll once the active segment is full; records still staged in it land first
+  while (active_->end_pos.load(std::memory_order_relaxed) > kSegmentHeaderSize &&
+         active_->file->size() >= cfg_.segment_bytes) {
+    if (syncing_) { synced_cv_.wait(lock); check_failed_locked(); continue; }
+    if (active_->end_offset.load(std::memory_order_relaxed) != next_offset_) {
+      if (batch) sync_pending_locked(lock);
+      else flush_pending_locked();
+      continue;
+    }
+    roll_locked();
+  }
+
+  Segment& seg = *active_;
+  uint64_t base = next_offset_;
+  uint64_t ts = now_ms();
+  uint64_t max_ts = seg.max_ts.load(std::memory_order_relaxed); // of the records before this one
+
+  // the frames and their index entries are built first and staged with one
+  // append per file: an append may write out what was staged before it and
+  // fail, and must not leave part of the batch behind when it does
+  uint64_t start = seg.file->size(), pos = start, last_indexed = seg.last_indexed_pos;
+  std::string frames;
+  std::vector<PendingIndex> entries;
+  auto index_at = [&](uint64_t offset) {
+    if (last_indexed && pos - last_indexed < Segment::kIndexIntervalBytes) return;
+    entries.push_back({{offset, pos}, {max_ts, offset}});
+    last_indexed = pos;
+  };
+  if (compressed) {
+    index_at(base);
+    encode_batch_header(payload.data(), base, ts, cfg_.compression, std::string_view(payload).substr(kHeaderSize));
+    frames = std::move(payload);
+  }
+  for (size_t i = 0; !compressed && i < n; i++) {
+    pos = start + frames.size();
+    index_at(base + i);
+    char header[kHeaderSize];
+    encode_header(header, base + i, ts, recs[i].key, recs[i].value);
+    frames.append(header, sizeof(header));
+    frames.append(recs[i].key);
+    frames.append(recs[i].value);
+    max_ts = std::max(max_ts, ts);
+  }
+
+  uint64_t index_start = seg.index_file->size(), time_start = seg.time_index_file->size();
+  try {
+    seg.file->append(frames.data(), frames.size());
+    if (!entries.empty()) {
+      std::vector<IndexEntry> index;
+      std::vector<TimeIndexEntry> time_index;
+      for (auto& e : entries) { index.push_back(e.index); time_index.push_back(e.time); }
+      seg.index_file->append(index.data(), index.size() * sizeof(IndexEntry));
+      seg.time_index_file->append(time_index.data(), time_index.size() * sizeof(TimeIndexEntry));
+    }
+  } catch (...) {
+    seg.file->unstage(start);
+    seg.index_file->unstage(index_start);
+    seg.time_index_file->unstage(time_start);
+    throw;
+  }
+
+  std::string_view staged = frames;
+  if (compressed) tail_.append(base, staged, {});
+  for (size_t i = 0, at = 0; !compressed && i < n; i++) {
+    size_t len = kHeaderSize + recs[i].key.size() + recs[i].value.size();
+    tail_.append(base + i, staged.substr(at, len), {});
+    at += len;
+  }
+  pending_index_.insert(pending_index_.end(), entries.begin(), entries.end());
+  seg.last_indexed_pos = last_indexed;
+  next_offset_ += n;
+  if (ts > seg.max_ts.load(std::memory_order_relaxed)) seg.max_ts.store(ts, std::memory_order_relaxed);
+
+  if (!batch) {
+    flush_pending_locked();
+    return base;
+  }
+
+  uint64_t my_seq = ++appended_seq_;
+  while (durable_seq_ < my_seq) {
+    check_failed_locked();
+    if (syncing_) { synced_cv_.wait(lock); continue; }
+    sync_pending_locked(lock);
+  }
+  return base;
+}
+
+// index of the segment that holds offset (or the first one after a gap)
+static size_t segment_for(const std::vector<std::shared_ptr<Segment>>& segs, uint64_t offset) {
+  size_t k = (size_t)(std::upper_bound(segs.begin(), segs.end(), offset,
+                                       [](uint64_t o, const std::shared_ptr<Segment>& s) { return o < s->base_offset; })
+                      - segs.begin());
+  return k ? k - 1 : 0;
+}
+
+void PartitionLog::read(uint64_t offset, int limit, FetchResult& out, const RecordFilter* filter, bool verify) const {
+  auto segs = segments_.load(std::memory_order_acquire);
+  uint64_t end = segs->back()->end_offset.load(std::memory_order_acquire);
+  uint64_t next = std::min(std::max(offset, segs->front()->base_offset), end);
+  int count = 0;
+
+  bool match_all = !filter || filter->match_all();
+  if (filter) {
+    out.keys = filter->projection != RecordFilter::Projection::Meta;
+    out.values = filter->projection == RecordFilter::Projection::All;
+  }
+  uint64_t scanned = 0; // a selective filter must not walk the whole log in one call
+  // a time range starts at its first record, found through the time index
+  if (!match_all && filter->ts_from && next < end) next = std::min(std::max(next, offset_for_time(filter->ts_from)), end);
+
+  std::string scratch;
+  std::vector<BatchRecord> batch;
+  auto take = [&](uint64_t rec_offset, uint64_t ts, std::string_view key, std::string_view value) {
+    next = rec_offset + 1;
+    if (!match_all && !filter->matches(ts, key, value)) return;
+    FetchedRecord r;
+    r.offset = rec_offset;
+    r.ts_ms = ts;
+    r.key_pos = out.data.size();
+    if (out.keys) { r.key_len = key.size(); out.data.append(key); }
+    r.value_pos = out.data.size();
+    if (out.values) { r.value_len = value.size(); out.data.append(value); }
+    out.records.push_back(r);
+    count++;
+  };
+  // takes the records of reader's frames below stop; false once the read is
+  // over: limit or scan budget reached, or an unreadable frame (out.corrupt
+  // if it failed its crc)
+  auto scan = [&](FrameReader& reader, uint64_t stop) {
+    reader.verify(verify);
+    Frame f;
+    while (count < limit && scanned < kMaxFilterScan && reader.next(f)) {
+      if (f.last_offset < next) continue;
+      if (f.offset >= stop) break;
+      if (!match_all) scanned += f.size;
+      if (!f.batch()) { take(f.offset, f.ts, f.key, f.value); continue; }
+
+      // a batch may start before next, and the limit may end it early
+      if (!frame_records(f, scratch, batch)) { out.corrupt = true; return false; }
+      for (auto& rec : batch) {
+        if (count == limit) break;
+        if (rec.offset >= next) take(rec.offset, f.ts, rec.key, rec.value);
+      }
+    }
+    if (reader.corrupt()) { out.corrupt = true; return false; }
+    return next >= stop;
+  };
+
+  // the end offset was read first, so every frame below it is in the tail
+  auto tail = tail_.snapshot();
+  size_t chunk = next < end ? TailBuffer::find(*tail, next) : tail->size();
+  if (chunk < tail->size()) {
+    metrics::add(metrics::kTailHits);
+    for (; chunk < tail->size(); chunk++) {
+      FrameReader reader((*tail)[chunk]->frames());
+      // a chunk ends before the end offset, unless it is the last
+      if (scan(reader, end) || out.corrupt || count == limit || scanned >= kMaxFilterScan) break;
+    }
+    out.next_offset = next;
+    return;
+  }
+  if (next < end) metrics::add(metrics::kTailMisses);
+
+  for (size_t k = segment_for(*segs, next); k < segs->size() && count < limit; k++) {
+    const Segment& seg = *(*segs)[k];
+    uint64_t seg_end = seg.end_offset.load(std::memory_order_acquire);
+    uint64_t end_pos = seg.end_pos.load(std::memory_order_acquire);
+    uint64_t next_base = k + 1 < segs->size() ? (*segs)[k + 1]->base_offset : seg_end;
+
+    if (next < seg_end) {
+      // the sparse index gets us close; scan forward from there
+      FrameReader reader(*seg.file, seg.seek(next), end_pos);
+      reader.cached(true);
+      if (!scan(reader, seg_end)) break;
+    }
+    next = std::max(next, next_base);
+  }
+
+  out.next_offset = next;
+}
+
+FrameRange PartitionLog::locate(uint64_t offset, int limit, uint64_t max_bytes) const {
+  auto segs = segments_.load(std::memory_order_acquire);
+  uint64_t end = segs->back()->end_offset.load(std::memory_order_acquire);
+
+  FrameRange res;
+  uint64_t next = std::min(std::max(offset, segs->front()->base_offset), end);
+  res.first_offset = res.next_offset = next;
+  if (limit <= 0) return res;
+
+  // walk headers only; the bytes themselves go out with sendfile() (or are
+  // copied from the tail buffer)
+  uint64_t last = 0;
+  auto walk = [&](FrameReader& reader, uint64_t stop) {
+    Frame f;
+    while (res.count < (uint64_t)limit && reader.next(f, /*body=*/false)) {
+      if (f.last_offset < next) continue;
+      if (f.offset >= stop) break;
+      if (res.frames == 0) { res.pos = f.pos; res.first_offset = std::max(f.offset, next); }
+      else if (f.pos + f.size - res.pos > max_bytes) break;
+      res.len = f.pos + f.size - res.pos;
+      res.count += f.count;
+      res.frames++;
+      res.batches |= f.batch();
+      last = f.last_offset;
+    }
+    return res.frames != 0;
+  };
+
+  auto tail = tail_.snapshot();
+  size_t chunk = next < end ? TailBuffer::find(*tail, next) : tail->size();
+  if (chunk < tail->size()) {
+    metrics::add(metrics::kTailHits);
+    const auto& c = *(*tail)[chunk];
+    FrameReader reader(c.frames());
+    if (walk(reader, end)) {
+      res.mem = c.data;
+      res.next_offset = last + 1;
+      return res;
+    }
+  } else if (next < end) {
+    metrics::add(metrics::kTailMisses);
+  }
+
+  for (size_t k = segment_for(*segs, next); k < segs->size(); k++) {
+    const Segment& seg = *(*segs)[k];
+    uint64_t seg_end = seg.end_offset.load(std::memory_order_acquire);
+    uint64_t end_pos = seg.end_pos.load(std::memory_order_acquire);
+    uint64_t next_base = k + 1 < segs->size() ? (*segs)[k + 1]->base_offset : seg_end;
+    if (next >= seg_end) { next = std::max(next, next_base); continue; }
+
+    FrameReader reader(*seg.file, seg.seek(next), end_pos);
+    reader.cached(true);
+    if (!walk(reader, seg_end)) break;
+
+    res.file = seg.file;
+    res.next_offset = last + 1 < seg_end ? last + 1 : next_base;
+    return res;
+  }
+
+  res.first_offset = res.next_offset = next;
+  return res;
+}
+
+uint64_t PartitionLog::start_offset() const {
+  return segments_.load(std::memory_order_acquire)->front()->base_offset;
+}
+
+uint64_t PartitionLog::end_offset() const {
+  return segments_.load(std::memory_order_acquire)->back()->end_offset.load(std::memory_order_acquire);
+}
+
+uint64_t PartitionLog::offset_for_time(uint64_t ts_ms) const {
+  auto segs = segments_.load(std::memory_order_acquire);
+  uint64_t end = 0;
+  for (size_t k = 0; k < segs->size(); k++) {
+    const Segment& seg = *(*segs)[k];
+    // closed segments older than ts_ms are skipped whole; the active one's
+    // max_ts may lag records already published, so it is always scanned
+    if (k + 1 < segs->size() && seg.max_ts.load(std::memory_order_relaxed) < ts_ms) continue;
+    end = seg.end_offset.load(std::memory_order_acquire);
+    uint64_t end_pos = seg.end_pos.load(std::memory_order_acquire);
+
+    uint64_t from = seg.seek_time(ts_ms);
+    FrameReader reader(*seg.file, seg.seek(from), end_pos);
+    reader.cached(true);
+    Frame f;
+    while (reader.next(f, /*body=*/false) && f.offset < end) {
+      if (f.offset >= from && f.ts >= ts_ms) return f.offset; // a batch's records share its ts
+    }
+  }
+  return end;
+}
+
+uint64_t PartitionLog::size_bytes() const {
+  uint64_t total = 0;
+  for (auto& seg : *segments_.load(std::memory_order_acquire)) total += seg->end_pos.load(std::memory_order_acquire);
+  return total;
+}
+
+size_t PartitionLog::segment_count() const {
+  return segments_.load(std::memory_order_acquire)->size();
+}
+
+std::shared_ptr<LogFile> PartitionLog::sync_due(uint64_t now, uint64_t& next_due) {
+  std::lock_guard<std::mutex> lock(append_mu_);
+  uint64_t due_at = last_sync_ms_ + cfg_.fsync_interval_ms;
+  if (!dirty_ || now < due_at) {
+    next_due = std::min(next_due, dirty_ ? due_at : now + cfg_.fsync_interval_ms);
+    return nullptr;
+  }
+  dirty_ = false;
+  last_sync_ms_ = now;
+  next_due = std::min(next_due, now + cfg_.fsync_interval_ms);
+  return active_->file;
+}
+
+void PartitionLog::sync_done(bool ok) {
+  if (ok) return;
+  std::lock_guard<std::mutex> lock(append_mu_);
+  dirty_ = true;
+}
+
+void PartitionLog::enforce_retention(uint64_t now) {
+  if (!cfg_.retention_ms && !cfg_.retention_bytes) return;
+
+  SegmentList doomed;
+  {
+    std::lock_guard<std::mutex> lock(append_mu_);
+    SegmentList list = *segments_.load(std::memory_order_acquire);
+    uint64_t total = 0;
+    for (auto& seg : list) total += seg->file->size();
+
+    // oldest first, never the active segment
+    size_t drop = 0;
+    while (drop + 1 < list.size()) {
+      auto& seg = list[drop];
+      bool expired = cfg_.retention_ms && seg->max_ts.load(std::memory_order_relaxed) + cfg_.retention_ms <= now;
+      bool oversize = cfg_.retention_bytes && total > cfg_.retention_bytes;
+      if (!expired && !oversize) break;
+      total -= seg->file->size();
+      drop++;
+    }
+    if (drop == 0) return;
+
+    doomed.assign(list.begin(), list.begin() + (ptrdiff_t)drop);
+    list.erase(list.begin(), list.begin() + (ptrdiff_t)drop);
+    publish(std::move(list));
+  }
+
+  // readers still holding a segment keep its (unlinked) file open
+  for (auto& seg : doomed) {
+    std::error_code ec;
+    fs::remove(seg->file->path(), ec);
+    fs::remove(index_path(seg->file->path()), ec);
+    fs::remove(time_index_path(seg->file->path()), ec);
+  }
+}
+
+void PartitionLog::compact() {
+  if (!cfg_.compact) return;
+  auto segs = segments_.load(std::memory_order_acquire);
+  if (segs->size() < 2) return;
+  uint64_t closed_end = segs->back()->base_offset;
+  if (closed_end == compacted_end_) return; // nothing closed since the last pass
+
+  // latest offset of every key across the whole log, active segment included
+  std::unordered_map<std::string, uint64_t> latest;
+  std::string scratch;
+  std::vector<BatchRecord> recs, keep;
+  for (auto& seg : *segs) {
+    uint64_t seg_end = seg->end_offset.load(std::memory_order_acquire);
+    FrameReader reader(*seg->file, kSegmentHeaderSize, seg->end_pos.load(std::memory_order_acquire));
+    Frame f;
+    while (reader.next(f) && f.offset < seg_end) {
+      if (!frame_records(f, scratch, recs)) return; // undecodable batch: leave the log alone
+      for (auto& r : recs) {
+        if (!r.key.empty() && r.offset < seg_end) latest[std::string(r.key)] = r.offset;
+      }
+    }
+  }
+  auto superseded = [&](const BatchRecord& r) {
+    if (r.key.empty()) return false;
+    auto it = latest.find(std::string(r.key));
+    return it != latest.end() && it->second != r.offset;
+  };
+
+  // rewrite closed segments that hold superseded records; null = now empty
+  std::vector<std::pair<std::shared_ptr<Segment>, std::shared_ptr<Segment>>> replaced;
+  for (size_t k = 0; k + 1 < segs->size(); k++) {
+    auto& seg = (*segs)[k];
+    uint64_t end_pos = seg->end_pos.load(std::memory_order_acquire);
+
+    bool dirty = false;
+    {
+      FrameReader reader(*seg->file, kSegmentHeaderSize, end_pos);
+      Frame f;
+      while (!dirty && reader.next(f) && frame_records(f, scratch, recs)) {
+        dirty = std::any_of(recs.begin(), recs.end(), superseded);
+      }
+    }
+    if (!dirty) continue;
+
+    std::string path = seg->file->path();
+    std::string tmp = path + ".compacting";
+    std::string tmp_index = index_path(path) + ".compacting";
+    std::string tmp_time_index = time_index_path(path) + ".compacting";
+    uint64_t kept = 0;
+    bool broken = false;
+    {
+      LogFile out(tmp), out_index(tmp_index), out_time_index(tmp_time_index);
+      write_segment_header(out);
+      uint64_t last_indexed = 0, max_ts = 0;
+
+      FrameReader reader(*seg->file, kSegmentHeaderSize, end_pos);
+      Frame f;
+      std::string rebuilt;
+      while (reader.next(f)) {
+        if (!frame_records(f, scratch, recs)) { broken = true; break; }
+        keep.clear();
+        for (auto& r : recs) {
+          if (!superseded(r)) keep.push_back(r);
+        }
+        if (keep.empty()) continue;
+
+        // a batch that lost records is compressed anew (or split up if that no longer pays)
+        std::string_view frame = f.raw;
+        if (keep.size() < recs.size()) {
+          rebuilt.assign(kHeaderSize, '\0');
+          if (encode_batch_payload(f.codec, keep.data(), keep.size(), rebuilt)) {
+            encode_batch_header(rebuilt.data(), keep[0].offset, f.ts, f.codec, std::string_view(rebuilt).substr(kHeaderSize));
+          } else {
+            rebuilt.clear();
+            for (auto& r : keep) {
+              char header[kHeaderSize];
+              encode_header(header, r.offset, f.ts, r.key, r.value);
+              rebuilt.append(header, sizeof(header));
+              rebuilt.append(r.key);
+              rebuilt.append(r.value);
+            }
+          }
+          frame = rebuilt;
+        }
+
+        uint64_t pos = out.append(frame.data(), frame.size());
+        if (!last_indexed || pos - last_indexed >= Segment::kIndexIntervalBytes) {
+          IndexEntry e{keep[0].offset, pos};
+          TimeIndexEntry t{max_ts, keep[0].offset};
+          out_index.append(&e, sizeof(e));
+          out_time_index.append(&t, sizeof(t));
+          last_indexed = pos;
+        }
+        max_ts = std::max(max_ts, f.ts);
+        kept += keep.size();
+      }
+      out.flush();
+      out.sync();
+      out_index.flush();
+      out_time_index.flush();
+    }
+
+    if (broken) {
+      fs::remove(tmp);
+      fs::remove(tmp_index);
+      fs::remove(tmp_time_index);
+      continue;
+    }
+    if (!kept) {
+      fs::remove(tmp);
+      fs::remove(tmp_index);
+      fs::remove(tmp_time_index);
+      replaced.emplace_back(seg, nullptr);
+      continue;
+    }
+
+    // a crash between the renames leaves a stale index, which open_segment
+    // rebuilds (a stale time index is only less precise: dropping records
+    // cannot make an entry's bound wrong)
+    fs::rename(tmp, path);
+    fs::rename(tmp_index, index_path(path));
+    fs::rename(tmp_time_index, time_index_path(path));
+    auto fresh = open_segment(path, seg->base_offset);
+    fresh->index_file.reset();
+    fresh->time_index_file.reset();
+    replaced.emplace_back(seg, fresh);
+  }
+
+  if (!replaced.empty()) {
+    std::lock_guard<std::mutex> lock(append_mu_);
+    SegmentList list;
+    for (auto& seg : *segments_.load(std::memory_order_acquire)) {
+      auto it = std::find_if(replaced.begin(), replaced.end(), [&](auto& r) { return r.first == seg; });
+      if (it == replaced.end()) list.push_back(seg);
+      else if (it->second) list.push_back(it->second);
+    }
+    publish(std::move(list));
+    // the tail still holds the records dropped from the closed segments
+    tail_.drop_before(closed_end);
+  }
+  for (auto& [old, fresh] : replaced) {
+    if (fresh) continue;
+    std::error_code ec;
+    fs::remove(old->file->path(), ec);
+    fs::remove(index_path(old->file->path()), ec);
+    fs::remove(time_index_path(old->file->path()), ec);
+  }
+
+  compacted_end_ = closed_end;
+}
@@ -0,0 +1,121 @@
+#include "partitioner.h"
+
+#include <cstring>
+#include <random>
+
+bool parse_partitioning(const std::string& s, Partitioning& out) {
+  if (s == "hash") { out = Partitioning::Hash; return true; }
+  if (s == "sticky") { out = Partitioning::Sticky; return true; }
+  if (s == "load_aware") { out = Partitioning::LoadAware; return true; }
+  if (s == "explicit") { out = Partitioning::Explicit; return true; }
+  return false;
+}
+
+const char* partitioning_name(Partitioning p) {
+  switch (p) {
+    case Partitioning::Sticky: return "sticky";
+    case Partitioning::LoadAware: return "load_aware";
+    case Partitioning::Explicit: return "explicit";
+    default: return "hash";
+  }
+}
+
+bool parse_key_hash(const std::string& s, KeyHash& out) {
+  if (s == "fnv1a") { out = KeyHash::Fnv1a; return true; }
+  if (s == "murmur2") { out = KeyHash::Murmur2; return true; }
+  return false;
+}
+
+const char* key_hash_name(KeyHash h) {
+  return h == KeyHash::Murmur2 ? "murmur2" : "fnv1a";
+}
+
+uint64_t fnv1a_64(std::string_view s) {
+  const uint64_t FNV_OFFSET = 1469598103934665603ULL;
+  const uint64_t FNV_PRIME  = 1099511628211ULL;
+  uint64_t h = FNV_OFFSET;
+  for (unsigned char c : s) { h ^= (uint64_t)c; h *= FNV_PRIME; }
+  return h;
+}
+
+// 8 bytes per step instead of fnv1a's one
+uint64_t murmur2_64(std::string_view s) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = s.size() * m;
+
+  const char* p = s.data();
+  size_t blocks = s.size() / 8;
+  for (size_t i = 0; i < blocks; i++, p += 8) {
+    uint64_t k;
+    std::memcpy(&k, p, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  size_t tail = s.size() & 7;
+  if (tail) {
+    uint64_t k = 0;
+    for (size_t i = tail; i-- > 0;) k = (k << 8) | (unsigned char)p[i];
+    h ^= k;
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+Partitioner::Partitioner(Partitioning kind, KeyHash hash, uint64_t sticky_bytes, int partitions,
+                         std::function<uint32_t(int)> depth)
+  : kind_(kind), hash_(hash), sticky_bytes_(sticky_bytes), partitions_(partitions), depth_(std::move(depth)) {
+  // topics created together should not all pile onto partition 0
+  uint32_t seed = std::random_device{}();
+  rr_.store(seed);
+  sticky_.store((int)(seed % (uint32_t)partitions_));
+}
+
+int Partitioner::for_key(std::string_view key) const {
+  uint64_t h = hash_ == KeyHash::Murmur2 ? murmur2_64(key) : fnv1a_64(key);
+  return (int)(h % (uint64_t)partitions_);
+}
+
+int Partitioner::for_keyless(uint64_t bytes) {
+  switch (kind_) {
+    case Partitioning::Explicit:
+      return -1;
+
+    case Partitioning::Sticky: {
+      // the produce that fills the current partition's batch is its last;
+      // only that one moves the topic on, so concurrent producers agree
+      int p = sticky_.load(std::memory_order_relaxed);
+      uint64_t before = sticky_used_.fetch_add(bytes, std::memory_order_relaxed);
+      if (before < sticky_bytes_ && before + bytes >= sticky_bytes_) {
+        sticky_used_.store(0, std::memory_order_relaxed);
+        sticky_.store((p + 1) % partitions_, std::memory_order_relaxed);
+      }
+      return p;
+    }
+
+    case Partitioning::LoadAware: {
+      // fewest appends in flight; ties go round robin, so an idle topic
+      // spreads like Hash
+      int start = (int)(rr_.fetch_add(1, std::memory_order_relaxed) % (uint64_t)partitions_);
+      int best = start;
+      uint32_t best_depth = depth_(start);
+      for (int i = 1; i < partitions_ && best_depth > 0; i++) {
+        int p = (start + i) % partitions_;
+        uint32_t d = depth_(p);
+        if (d < best_depth) { best = p; best_depth = d; }
+      }
+      return best;
+    }
+
+    default:
+      return (int)(rr_.fetch_add(1, std::memory_order_relaxed) % (uint64_t)partitions_);
+  }
+}
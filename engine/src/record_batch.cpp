@@ -0,0 +1,84 @@
+#include "record_batch.h"
+#include "lz4.h"
+
+using namespace record_format;
+
+bool parse_codec(const std::string& s, Codec& out) {
+  if (s == "none") { out = Codec::None; return true; }
+  if (s == "lz4") { out = Codec::Lz4; return true; }
+  return false;
+}
+
+const char* codec_name(Codec c) {
+  return c == Codec::Lz4 ? "lz4" : "none";
+}
+
+static void put_u32(std::string& out, uint32_t v) { out.append((const char*)&v, 4); }
+
+bool encode_batch_payload(Codec codec, const BatchRecord* recs, size_t n, std::string& out) {
+  if (codec != Codec::Lz4 || n == 0) return false;
+
+  std::string raw;
+  uint64_t plain = 0; // the same records as separate frames
+  size_t bytes = 0;
+  for (size_t i = 0; i < n; i++) bytes += 12 + recs[i].key.size() + recs[i].value.size();
+  if (bytes > kMaxValue) return false;
+  raw.reserve(bytes);
+  for (size_t i = 0; i < n; i++) {
+    put_u32(raw, (uint32_t)(recs[i].offset - recs[0].offset));
+    put_u32(raw, (uint32_t)recs[i].key.size());
+    put_u32(raw, (uint32_t)recs[i].value.size());
+    raw.append(recs[i].key);
+    raw.append(recs[i].value);
+    plain += kHeaderSize + recs[i].key.size() + recs[i].value.size();
+  }
+
+  size_t at = out.size();
+  put_u32(out, (uint32_t)n);
+  put_u32(out, (uint32_t)(recs[n - 1].offset - recs[0].offset));
+  put_u32(out, (uint32_t)raw.size());
+  lz4_compress(raw.data(), raw.size(), out);
+  uint64_t len = out.size() - at;
+  if (len > kMaxValue || kHeaderSize + len >= plain) { out.resize(at); return false; }
+  return true;
+}
+
+void encode_batch_header(char* header, uint64_t base_offset, uint64_t ts, Codec codec, std::string_view payload) {
+  uint32_t flags = kBatchFlag | (uint32_t)codec, len = (uint32_t)payload.size();
+  std::memcpy(header, &base_offset, 8);
+  std::memcpy(header + 8, &ts, 8);
+  std::memcpy(header + 16, &flags, 4);
+  std::memcpy(header + 20, &len, 4);
+  uint32_t crc = frame_crc(header, {}, payload);
+  std::memcpy(header + kCrcPos, &crc, 4);
+}
+
+bool decode_batch_payload(uint64_t base_offset, Codec codec, std::string_view payload,
+                          std::string& scratch, std::vector<BatchRecord>& out) {
+  if (codec != Codec::Lz4 || payload.size() < kBatchPrefix) return false;
+  uint32_t count, last_delta, raw_len;
+  std::memcpy(&count, payload.data(), 4);
+  std::memcpy(&last_delta, payload.data() + 4, 4);
+  std::memcpy(&raw_len, payload.data() + 8, 4);
+  if (raw_len > kMaxValue || (uint64_t)count * 12 > raw_len) return false;
+
+  scratch.resize(raw_len);
+  if (!lz4_decompress(payload.data() + kBatchPrefix, payload.size() - kBatchPrefix, scratch.data(), raw_len)) return false;
+
+  out.clear();
+  out.reserve(count);
+  size_t pos = 0;
+  for (uint32_t i = 0; i < count; i++) {
+    if (raw_len - pos < 12) return false;
+    uint32_t delta, klen, vlen;
+    std::memcpy(&delta, scratch.data() + pos, 4);
+    std::memcpy(&klen, scratch.data() + pos + 4, 4);
+    std::memcpy(&vlen, scratch.data() + pos + 8, 4);
+    pos += 12;
+    if (raw_len - pos < (uint64_t)klen + vlen || delta > last_delta) return false;
+    out.push_back({base_offset + delta, std::string_view(scratch).substr(pos, klen),
+                   std::string_view(scratch).substr(pos + klen, vlen)});
+    pos += klen + vlen;
+  }
+  return pos == raw_len;
+}
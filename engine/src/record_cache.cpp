@@ -0,0 +1,196 @@
+#include "record_cache.h"
+#include "disk_io.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+TailBuffer::TailBuffer(uint64_t capacity)
+    : capacity_(capacity),
+      chunk_size_((size_t)std::min<uint64_t>(capacity, std::clamp<uint64_t>(capacity / 8, 16 << 10, 1 << 20))) {
+  chunks_.store(std::make_shared<const Chunks>(), std::memory_order_relaxed);
+}
+
+void TailBuffer::append(uint64_t offset, std::string_view a, std::string_view b, std::string_view c) {
+  if (!capacity_) return;
+  size_t n = a.size() + b.size() + c.size();
+  if (n > capacity_) {
+    // the frames after it would no longer join up with those held
+    clear();
+    return;
+  }
+
+  size_t used = current_ ? current_->used.load(std::memory_order_relaxed) : 0;
+  if (!current_ || current_->capacity - used < n) {
+    auto chunk = std::make_shared<Chunk>();
+    chunk->capacity = std::max(chunk_size_, n);
+    chunk->data.reset(new char[chunk->capacity]);
+    chunk->first_offset = offset;
+
+    // keep the newest chunks that fit in the capacity alongside it
+    auto old = chunks_.load(std::memory_order_relaxed);
+    uint64_t held = chunk->capacity;
+    size_t first = old->size();
+    while (first > 0 && held + (*old)[first - 1]->capacity <= capacity_) held += (*old)[--first]->capacity;
+    auto list = std::make_shared<Chunks>(old->begin() + (ptrdiff_t)first, old->end());
+    list->push_back(chunk);
+    // readers see it before it holds anything, but nothing in it is below
+    // the published end offset yet
+    chunks_.store(std::move(list), std::memory_order_release);
+    held_.store(held, std::memory_order_relaxed);
+    current_ = std::move(chunk);
+    used = 0;
+  }
+
+  char* d = current_->data.get() + used;
+  std::memcpy(d, a.data(), a.size());
+  if (!b.empty()) std::memcpy(d + a.size(), b.data(), b.size());
+  if (!c.empty()) std::memcpy(d + a.size() + b.size(), c.data(), c.size());
+  current_->used.store(used + n, std::memory_order_release);
+}
+
+void TailBuffer::drop_before(uint64_t offset) {
+  auto old = chunks_.load(std::memory_order_relaxed);
+  // a chunk starting below offset may still run past it, but is dropped whole
+  auto first = std::find_if(old->begin(), old->end(), [&](auto& c) { return c->first_offset >= offset; });
+  if (first == old->begin()) return;
+  auto list = std::make_shared<const Chunks>(first, old->end());
+  uint64_t held = 0;
+  for (auto& c : *list) held += c->capacity;
+  if (list->empty()) current_.reset(); // the next frame starts a chunk of its own
+  chunks_.store(std::move(list), std::memory_order_release);
+  held_.store(held, std::memory_order_relaxed);
+}
+
+void TailBuffer::clear() {
+  current_.reset();
+  chunks_.store(std::make_shared<const Chunks>(), std::memory_order_release);
+  held_.store(0, std::memory_order_relaxed);
+}
+
+size_t TailBuffer::find(const Chunks& chunks, uint64_t offset) {
+  auto it = std::upper_bound(chunks.begin(), chunks.end(), offset,
+                             [](uint64_t o, const std::shared_ptr<const Chunk>& c) { return o < c->first_offset; });
+  return it == chunks.begin() ? chunks.size() : (size_t)(it - chunks.begin()) - 1;
+}
+
+BlockCache& BlockCache::instance() {
+  static BlockCache cache;
+  return cache;
+}
+
+void BlockCache::set_capacity(uint64_t bytes) {
+  capacity_.store(bytes, std::memory_order_relaxed);
+}
+
+uint64_t BlockCache::bytes() const {
+  uint64_t total = 0;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mu);
+    total += shard.bytes;
+  }
+  return total;
+}
+
+// bytes of a block in the flushed part of its file
+static size_t block_bytes(uint64_t index, uint64_t flushed) {
+  uint64_t start = index * BlockCache::kBlockSize;
+  return (size_t)std::min<uint64_t>(BlockCache::kBlockSize, flushed - std::min(flushed, start));
+}
+
+size_t BlockCache::read(const LogFile& file, uint64_t pos, void* buf, size_t len) {
+  if (!capacity()) return file.read_at(pos, buf, len);
+  uint64_t flushed = file.flushed_size();
+  uint64_t end = std::min(pos + len, flushed); // the part that can be cached
+
+  // the blocks missing, and a few after them for a reader working through
+  // older data, are read in one batch
+  uint64_t first = pos / kBlockSize;
+  std::vector<std::shared_ptr<const char[]>> blocks;
+  std::vector<Load> loads;
+  for (uint64_t index = first; index * kBlockSize < end; index++) {
+    size_t need = (size_t)(std::min(end, (index + 1) * kBlockSize) - index * kBlockSize);
+    blocks.push_back(find(file, index, need));
+    if (!blocks.back()) loads.push_back({index, blocks.size() - 1});
+  }
+  if (!loads.empty()) {
+    uint64_t next = first + blocks.size();
+    for (uint64_t index = next; index < next + kReadahead && block_bytes(index, flushed) > 0; index++) {
+      if (!contains(file, index)) loads.push_back({index, SIZE_MAX});
+    }
+    load(file, flushed, loads, blocks);
+  }
+
+  char* out = static_cast<char*>(buf);
+  size_t done = 0;
+  for (size_t i = 0; i < blocks.size() && blocks[i]; i++) {
+    uint64_t at = pos + done;
+    uint64_t index = first + i;
+    size_t n = (size_t)(std::min(end, (index + 1) * kBlockSize) - at);
+    std::memcpy(out + done, blocks[i].get() + (at - index * kBlockSize), n);
+    done += n;
+  }
+  // past the flushed bytes (or a failed block read): straight from the file
+  if (done < len) done += file.read_at(pos + done, out + done, len - done);
+  return done;
+}
+
+std::shared_ptr<const char[]> BlockCache::find(const LogFile& file, uint64_t index, size_t need) {
+  Key key{file.id(), index};
+  Shard& shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mu);
+  auto it = shard.map.find(key);
+  if (it == shard.map.end() || it->second->size < need) {
+    metrics::add(metrics::kBlockCacheMisses);
+    return nullptr;
+  }
+  shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+  metrics::add(metrics::kBlockCacheHits);
+  return it->second->data;
+}
+
+bool BlockCache::contains(const LogFile& file, uint64_t index) const {
+  Key key{file.id(), index};
+  const Shard& shard = shards_[KeyHash{}(key) % kShards];
+  std::lock_guard<std::mutex> lock(shard.mu);
+  return shard.map.count(key) != 0;
+}
+
+void BlockCache::load(const LogFile& file, uint64_t flushed, const std::vector<Load>& loads,
+                      std::vector<std::shared_ptr<const char[]>>& blocks) {
+  std::vector<std::shared_ptr<char[]>> data(loads.size());
+  std::vector<DiskOp> ops(loads.size());
+  for (size_t i = 0; i < loads.size(); i++) {
+    data[i].reset(new char[kBlockSize]);
+    ops[i] = DiskOp::read(file.fd(), data[i].get(), block_bytes(loads[i].index, flushed),
+                          loads[i].index * kBlockSize);
+  }
+  disk_io::run(ops.data(), ops.size());
+
+  for (size_t i = 0; i < loads.size(); i++) {
+    if (ops[i].result != (int64_t)ops[i].len) continue; // left to a plain read
+    if (loads[i].slot != SIZE_MAX) blocks[loads[i].slot] = data[i];
+    insert(Key{file.id(), loads[i].index}, data[i], ops[i].len);
+  }
+}
+
+void BlockCache::insert(const Key& key, std::shared_ptr<const char[]> data, size_t size) {
+  Shard& shard = shard_of(key);
+  std::lock_guard<std::mutex> lock(shard.mu);
+  auto it = shard.map.find(key);
+  if (it != shard.map.end()) { // a racing reader loaded it too
+    if (it->second->size < size) { it->second->data = std::move(data); it->second->size = size; }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    return;
+  }
+  shard.lru.push_front({key, std::move(data), size});
+  shard.map.emplace(key, shard.lru.begin());
+  shard.bytes += kBlockSize;
+  uint64_t limit = capacity() / kShards;
+  while (shard.bytes > limit && !shard.lru.empty()) {
+    shard.map.erase(shard.lru.back().key);
+    shard.lru.pop_back();
+    shard.bytes -= kBlockSize;
+  }
+}
@@ -0,0 +1,128 @@
+#include "record_filter.h"
+
+#include <charconv>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using json = nlohmann::json;
+
+size_t find_bytes(std::string_view hay, std::string_view needle) {
+  size_t n = needle.size(), h = hay.size();
+  if (n == 0) return 0;
+  if (n > h) return std::string_view::npos;
+  if (n == 1) {
+    auto p = (const char*)std::memchr(hay.data(), needle[0], h);
+    return p ? (size_t)(p - hay.data()) : std::string_view::npos;
+  }
+
+  size_t i = 0;
+#if defined(__SSE2__)
+  // compare the needle's first and last byte at 16 candidate positions at
+  // once; only positions where both match are checked in full
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[n - 1]);
+  for (; i + n - 1 + 16 <= h; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(hay.data() + i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(hay.data() + i + n - 1));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (std::memcmp(hay.data() + i + bit + 1, needle.data() + 1, n - 2) == 0) return i + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+  size_t r = hay.substr(i).find(needle);
+  return r == std::string_view::npos ? r : i + r;
+}
+
+static size_t skip_ws(std::string_view s, size_t i) {
+  while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) i++;
+  return i;
+}
+
+std::string_view json_field_token(std::string_view value, std::string_view field) {
+  for (size_t pos = find_bytes(value, field); pos != std::string_view::npos;) {
+    size_t end = pos + field.size();
+    if (pos > 0 && value[pos - 1] == '"' && end < value.size() && value[end] == '"') {
+      size_t i = skip_ws(value, end + 1);
+      if (i < value.size() && value[i] == ':') {
+        i = skip_ws(value, i + 1);
+        size_t start = i;
+        if (i < value.size() && value[i] == '"') {
+          for (i++; i < value.size() && value[i] != '"'; i++) {
+            if (value[i] == '\\') i++;
+          }
+          return i < value.size() ? value.substr(start, i + 1 - start) : std::string_view();
+        }
+        while (i < value.size() && value[i] != ',' && value[i] != '}' && value[i] != ']' &&
+               value[i] != ' ' && value[i] != '\t' && value[i] != '\n' && value[i] != '\r') i++;
+        return value.substr(start, i - start);
+      }
+    }
+    size_t next = find_bytes(value.substr(pos + 1), field);
+    pos = next == std::string_view::npos ? next : pos + 1 + next;
+  }
+  return {};
+}
+
+bool RecordFilter::match_all() const {
+  return !has_key && key_prefix.empty() && keys.empty() && ts_from == 0 && ts_to == UINT64_MAX &&
+         contains.empty() && field.empty();
+}
+
+bool RecordFilter::matches(uint64_t ts, std::string_view k, std::string_view value) const {
+  if (ts < ts_from || ts >= ts_to) return false;
+  if (has_key && k != key) return false;
+  if (!key_prefix.empty() && k.substr(0, key_prefix.size()) != key_prefix) return false;
+  if (!keys.empty() && keys.find(k) == keys.end()) return false;
+  if (!contains.empty() && find_bytes(value, contains) == std::string_view::npos) return false;
+  if (!field.empty()) {
+    std::string_view tok = json_field_token(value, field);
+    if (tok.empty()) return false;
+    if (!field_is_number) return tok == field_token;
+    double v;
+    auto [p, ec] = std::from_chars(tok.data(), tok.data() + tok.size(), v);
+    return ec == std::errc() && p == tok.data() + tok.size() && v == field_number;
+  }
+  return true;
+}
+
+bool record_filter_from_json(const json& req, RecordFilter& filter, std::string& err) {
+  try {
+    std::string project = req.value("project", "all");
+    if (project == "all") filter.projection = RecordFilter::Projection::All;
+    else if (project == "keys") filter.projection = RecordFilter::Projection::Keys;
+    else if (project == "meta") filter.projection = RecordFilter::Projection::Meta;
+    else { err = "bad_project"; return false; }
+
+    auto it = req.find("filter");
+    if (it == req.end() || it->is_null()) return true;
+    const json& f = *it;
+    if (!f.is_object()) { err = "bad_filter"; return false; }
+
+    if (f.contains("key")) { filter.has_key = true; filter.key = f["key"].get<std::string>(); }
+    filter.key_prefix = f.value("key_prefix", "");
+    if (f.contains("keys")) {
+      for (auto& k : f["keys"]) filter.keys.insert(k.get<std::string>());
+      if (filter.keys.empty()) { err = "bad_filter"; return false; } // would match nothing
+    }
+    filter.ts_from = f.value("ts_from", (uint64_t)0);
+    filter.ts_to = f.value("ts_to", UINT64_MAX);
+    filter.contains = f.value("contains", "");
+    if (f.contains("field")) {
+      filter.field = f["field"].get<std::string>();
+      auto eq = f.find("equals");
+      if (filter.field.empty() || eq == f.end() || eq->is_structured()) { err = "bad_filter"; return false; }
+      if (eq->is_number()) { filter.field_is_number = true; filter.field_number = eq->get<double>(); }
+      else filter.field_token = eq->dump();
+    }
+  } catch (const json::exception&) {
+    err = "bad_filter";
+    return false;
+  }
+  return true;
+}
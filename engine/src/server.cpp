@@ -1,44 +1,1008 @@
 #include "server.h"
+#include "arena.h"
+#include "binary_protocol.h"
+#include "flat_request.h"
 #include "store.h"
 #include "json.hpp"
+#include "json_writer.h"
+#include "log_file.h"
+#include "metrics.h"
+#include "record_cache.h"
+#include "worker_pool.h"
 
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <set>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <utility>
 
 using json = nlohmann::json;
 
-static std::string read_line(int fd) {
-  std::string line;
-  char ch;
-  while (true) {
-    ssize_t n = ::recv(fd, &ch, 1, 0);
-    if (n == 0) return "";
-    if (n < 0) { if (errno == EINTR) continue; throw std::runtime_error("recv failed"); }
-    if (ch == '\n') break;
-    line.push_back(ch);
-    if (line.size() > 2 * 1024 * 1024) throw std::runtime_error("request too large");
+static void reply(std::string& out, const json& j) {
+  metrics::Timer timer(metrics::kSerialize);
+  out += j.dump();
+  out.push_back('\n');
+}
+
+// {"error":"<error>","ok":false}, as reply() would write it
+static void reply_error(std::string& out, std::string_view error) {
+  out += "{\"error\":";
+  json_append_string(out, error);
+  out += ",\"ok\":false}\n";
+}
+
+static uint64_t steady_ms() {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static constexpr uint64_t kMaxWaitMs = 60000;
+
+// Decides whether a fetch that came up short parks rather than answers:
+// only with a wait to park in, a max_wait_ms, and its deadline not yet
+// reached. The deadline is fixed the first time the request runs.
+static bool should_park(FetchWait* wait, uint64_t max_wait_ms, std::string_view topic, int partition, uint64_t after_offset) {
+  if (!wait || max_wait_ms == 0) return false;
+  uint64_t now = steady_ms();
+  if (wait->deadline_ms == 0) wait->deadline_ms = now + std::min(max_wait_ms, kMaxWaitMs);
+  if (now >= wait->deadline_ms) return false;
+  wait->parked = true;
+  wait->topic = topic;
+  wait->partition = partition;
+  wait->after_offset = after_offset;
+  return true;
+}
+
+std::string& ResponseBuffer::text() {
+  if (chunks_.empty() || chunks_.back().file) chunks_.emplace_back();
+  return chunks_.back().data;
+}
+
+void ResponseBuffer::append_file(std::shared_ptr<const LogFile> file, uint64_t pos, uint64_t len) {
+  if (len == 0) return;
+  Chunk c;
+  c.file = std::move(file);
+  c.file_pos = pos;
+  c.file_len = len;
+  chunks_.push_back(std::move(c));
+}
+
+// One epoll event loop thread. All state of the connections it owns is
+// touched only on this thread; requests run on the worker pool and their
+// responses come back through post().
+//
+// Requests of one connection execute in arrival order, one batch at a time,
+// so pipelined clients get responses in order and see their own writes.
+// Parallelism comes from running many connections at once.
+//
+// A long-poll fetch that finds too little data parks its connection: the
+// request goes back to the front of the queue and runs again when its
+// partition grows (the partition's watch callback posts a wakeup) or its
+// deadline passes (timers_ bound the epoll_wait timeout).
+//
+// Subscriptions push records without a request per batch: while the
+// connection has credit and its output buffer is below kMaxPendingOut, a
+// worker reads from each subscribed partition that may have data; caught
+// up partitions are watched for the next append. A slow subscriber thus
+// costs at most its credit and output buffer, never producer progress.
+class IoLoop {
+public:
+  explicit IoLoop(PulseStreamServer& server);
+  ~IoLoop();
+
+  void add_connection(int fd);          // any thread
+  void post(std::function<void()> fn);  // any thread
+
+private:
+  enum class Protocol { Unknown, Ndjson, Binary, Http };
+
+  struct Subscription {
+    struct Part {
+      int partition = 0;
+      uint64_t next = 0;      // next offset to push
+      uint64_t token = 0;     // watch for records at next; 0 = none
+      bool ready = true;      // may have records at next
+    };
+    uint64_t gen = 0;         // tells this subscription from an earlier one to the topic
+    std::vector<Part> parts;
+  };
+
+  // one subscribed partition read by a pump round
+  struct PumpItem {
+    std::string topic;
+    uint64_t gen = 0;
+    size_t part = 0;
+    int partition = 0;
+    uint64_t next = 0;
+    uint64_t sent = 0;
+    bool caught_up = false;
+    std::string line;         // RECORDS line to push, if any
+  };
+
+  struct Connection {
+    uint64_t id = 0;
+    int fd = -1;
+    Protocol proto = Protocol::Unknown;   // decided by the first bytes received
+    std::string in;  size_t in_off = 0;   // received, not yet framed
+    ResponseBuffer out;                   // responses not yet sent
+    size_t out_off = 0;                   // bytes of out's front chunk already sent
+    uint64_t out_bytes = 0;
+    std::deque<std::string> queued;       // framed requests (lines or binary frames) not yet executed
+    std::vector<std::string> spare;       // buffers of executed requests, to frame new ones into
+    std::vector<std::string> batch;       // kept for its capacity between batches
+    bool executing = false;
+    bool read_closed = false;
+    uint32_t events = 0;                  // current epoll interest
+
+    bool parked = false;                  // front of queued waits for data
+    FetchWait wait;                       // what it waits for; its deadline carries over on resume
+    uint64_t wait_token = 0;              // partition watch to cancel
+    uint64_t wait_seq = 0;                // tells a stale wakeup from the current one
+
+    std::unordered_map<std::string, Subscription> subs; // by topic
+    uint64_t credit = 0;                  // records that may still be pushed
+    uint64_t sub_seq = 0;
+    bool pumping = false;                 // a worker is reading records to push
+    size_t pump_rr = 0;                   // rotates which partition a round starts at
+  };
+
+  static constexpr size_t kReadChunk = 64 * 1024;
+  static constexpr size_t kMaxHttpRequest = 8 * 1024;
+  static constexpr size_t kMaxBatch = 64;             // requests per worker task
+  static constexpr size_t kMaxSpareRequest = 64 * 1024; // larger request buffers are not kept
+  static constexpr size_t kMaxPendingOut = 4 << 20;   // pause reading (and pushing) beyond this
+  static constexpr int kPushRecords = 1000;           // per partition per pump round
+  static constexpr size_t kPushBytes = 1 << 20;       // per pump round
+
+  void loop();
+  void drain_inbox();
+  void on_readable(Connection& c);
+  void frame_requests(Connection& c);
+  void frame_lines(Connection& c);
+  void frame_binary(Connection& c);
+  void frame_http(Connection& c);
+  void queue_request(Connection& c, size_t pos, size_t len);
+  void dispatch(Connection& c);
+  void finish(uint64_t id, ResponseBuffer responses, std::vector<std::string> batch, size_t done, FetchWait wait,
+              std::vector<StreamOp> ops);
+  void park(Connection& c, FetchWait wait);
+  void unpark(Connection& c);
+  void wake(uint64_t id, uint64_t seq);
+  void expire_timers();
+  void apply_stream(Connection& c, StreamOp op);
+  void drop_subscription(const std::string& topic, Subscription& sub);
+  void pump(Connection& c);
+  void pumped(uint64_t id, std::vector<PumpItem> items, uint64_t used);
+  void watch_part(Connection& c, const std::string& topic, Subscription& sub, size_t i);
+  void part_ready(uint64_t id, const std::string& topic, uint64_t gen, size_t i);
+  void drop_output(Connection& c);
+  void flush_out(Connection& c);
+  void update_interest(Connection& c);
+  bool settle(Connection& c); // returns false if the connection was closed
+  void close_connection(Connection& c);
+
+  PulseStreamServer& server_;
+  int epfd_ = -1;
+  int wakefd_ = -1;
+  std::atomic<bool> stopping_{false};
+
+  std::mutex inbox_mu_;
+  std::vector<std::function<void()>> inbox_;
+
+  std::unordered_map<uint64_t, std::unique_ptr<Connection>> conns_;
+  uint64_t next_id_ = 1; // 0 tags the wakeup eventfd
+  std::set<std::pair<uint64_t, uint64_t>> timers_; // (deadline_ms, id) of parked connections
+  std::vector<char> rbuf_;
+  std::thread thread_;
+};
+
+IoLoop::IoLoop(PulseStreamServer& server) : server_(server), rbuf_(kReadChunk) {
+  epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ < 0) throw std::runtime_error("epoll_create1 failed");
+  wakefd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wakefd_ < 0) throw std::runtime_error("eventfd failed");
+
+  epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.u64 = 0;
+  if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev) < 0) throw std::runtime_error("epoll_ctl failed");
+
+  thread_ = std::thread(&IoLoop::loop, this);
+}
+
+IoLoop::~IoLoop() {
+  stopping_ = true;
+  post([] {});
+  if (thread_.joinable()) thread_.join();
+  for (auto& [id, c] : conns_) {
+    // watch callbacks point at this loop
+    if (c->parked) unpark(*c);
+    for (auto& [topic, sub] : c->subs) drop_subscription(topic, sub);
+    ::close(c->fd);
+    server_.connections_--;
+  }
+  ::close(wakefd_);
+  ::close(epfd_);
+}
+
+void IoLoop::post(std::function<void()> fn) {
+  {
+    std::lock_guard<std::mutex> lock(inbox_mu_);
+    inbox_.push_back(std::move(fn));
+  }
+  uint64_t one = 1;
+  ssize_t n = ::write(wakefd_, &one, sizeof(one));
+  (void)n;
+}
+
+void IoLoop::add_connection(int fd) {
+  post([this, fd] {
+    auto c = std::make_unique<Connection>();
+    c->id = next_id_++;
+    c->fd = fd;
+    c->events = EPOLLIN;
+
+    epoll_event ev{};
+    ev.events = c->events;
+    ev.data.u64 = c->id;
+    if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0) { ::close(fd); server_.connections_--; return; }
+    conns_[c->id] = std::move(c);
+  });
+}
+
+void IoLoop::loop() {
+  epoll_event events[128];
+  while (!stopping_) {
+    int timeout = -1;
+    if (!timers_.empty()) {
+      uint64_t first = timers_.begin()->first, now = steady_ms();
+      timeout = first <= now ? 0 : (int)std::min<uint64_t>(first - now, INT_MAX);
+    }
+    int n = ::epoll_wait(epfd_, events, 128, timeout);
+    if (n < 0) { if (errno == EINTR) continue; std::cerr << "epoll_wait failed\n"; return; }
+
+    for (int i = 0; i < n; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == 0) { drain_inbox(); continue; }
+
+      auto it = conns_.find(id);
+      if (it == conns_.end()) continue;
+      Connection& c = *it->second;
+
+      if (events[i].events & (EPOLLERR | EPOLLHUP) && !(events[i].events & EPOLLIN)) { close_connection(c); continue; }
+      if (events[i].events & EPOLLOUT) flush_out(c);
+      if (events[i].events & EPOLLIN) on_readable(c);
+      settle(c);
+    }
+    if (!timers_.empty()) expire_timers();
+  }
+}
+
+void IoLoop::drain_inbox() {
+  uint64_t cnt;
+  while (::read(wakefd_, &cnt, sizeof(cnt)) > 0) {}
+
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(inbox_mu_);
+    tasks.swap(inbox_);
+  }
+  for (auto& t : tasks) t();
+}
+
+void IoLoop::on_readable(Connection& c) {
+  ssize_t n = ::recv(c.fd, rbuf_.data(), rbuf_.size(), 0);
+  if (n == 0) { c.read_closed = true; return; }
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return;
+    c.read_closed = true;
+    c.queued.clear();
+    drop_output(c);
+    return;
+  }
+
+  if (c.in_off > 0 && c.in_off * 2 >= c.in.size()) { c.in.erase(0, c.in_off); c.in_off = 0; }
+  c.in.append(rbuf_.data(), (size_t)n);
+  frame_requests(c);
+  dispatch(c);
+}
+
+void IoLoop::frame_requests(Connection& c) {
+  if (c.proto == Protocol::Unknown) {
+    // binary clients open with the magic, metrics scrapers with an HTTP
+    // GET; anything else is NDJSON
+    static constexpr char kGet[4] = {'G', 'E', 'T', ' '};
+    size_t have = c.in.size() - c.in_off;
+    size_t n = std::min(have, sizeof(binproto::kMagic));
+    if (std::memcmp(c.in.data() + c.in_off, binproto::kMagic, n) == 0) {
+      if (n < sizeof(binproto::kMagic)) return;
+      c.proto = Protocol::Binary;
+      c.in_off += sizeof(binproto::kMagic);
+      c.out.text().append(binproto::kMagic, sizeof(binproto::kMagic));
+      c.out_bytes += sizeof(binproto::kMagic);
+    } else if (std::memcmp(c.in.data() + c.in_off, kGet, std::min(have, sizeof(kGet))) == 0) {
+      if (have < sizeof(kGet)) return;
+      c.proto = Protocol::Http;
+    } else {
+      c.proto = Protocol::Ndjson;
+    }
+  }
+  if (c.proto == Protocol::Binary) frame_binary(c);
+  else if (c.proto == Protocol::Http) frame_http(c);
+  else frame_lines(c);
+}
+
+// splits complete NDJSON lines off the input buffer
+void IoLoop::frame_lines(Connection& c) {
+  while (c.in_off < c.in.size()) {
+    size_t nl = c.in.find('\n', c.in_off);
+    if (nl == std::string::npos) {
+      if (c.in.size() - c.in_off > server_.cfg_.max_request_bytes) {
+        std::string& t = c.out.text();
+        size_t before = t.size();
+        reply(t, json({{"ok",false},{"error","request_too_large"}}));
+        c.out_bytes += t.size() - before;
+        c.in.clear(); c.in_off = 0;
+        c.read_closed = true;
+      }
+      return;
+    }
+    size_t end = nl;
+    if (end > c.in_off && c.in[end - 1] == '\r') end--;
+    if (end > c.in_off) queue_request(c, c.in_off, end - c.in_off);
+    c.in_off = nl + 1;
+  }
+  c.in.clear(); c.in_off = 0;
+}
+
+// splits complete [u32 len][body] frames off the input buffer
+void IoLoop::frame_binary(Connection& c) {
+  while (c.in.size() - c.in_off >= 4) {
+    uint32_t len;
+    std::memcpy(&len, c.in.data() + c.in_off, 4);
+    if (len == 0 || len > binproto::kMaxFrame || len > server_.cfg_.max_request_bytes) {
+      c.in.clear(); c.in_off = 0;
+      c.read_closed = true;
+      return;
+    }
+    if (c.in.size() - c.in_off - 4 < len) return;
+    queue_request(c, c.in_off + 4, len);
+    c.in_off += 4 + len;
+  }
+}
+
+// takes the request head; one request per connection, answered and closed
+void IoLoop::frame_http(Connection& c) {
+  size_t end = c.in.find("\r\n\r\n", c.in_off);
+  if (end == std::string::npos) {
+    if (c.in.size() - c.in_off > kMaxHttpRequest) { c.in.clear(); c.in_off = 0; c.read_closed = true; }
+    return;
+  }
+  queue_request(c, c.in_off, end - c.in_off);
+  c.in.clear(); c.in_off = 0;
+  c.read_closed = true;
+}
+
+// copies bytes [pos, pos + len) of the input into a spare buffer, so a
+// connection in steady state frames requests without allocating
+void IoLoop::queue_request(Connection& c, size_t pos, size_t len) {
+  if (c.spare.empty()) { c.queued.emplace_back(c.in, pos, len); return; }
+  c.queued.push_back(std::move(c.spare.back()));
+  c.spare.pop_back();
+  c.queued.back().assign(c.in, pos, len);
+}
+
+void IoLoop::dispatch(Connection& c) {
+  if (c.executing || c.parked || c.queued.empty()) return;
+
+  std::vector<std::string> batch = std::move(c.batch);
+  batch.clear();
+  while (!c.queued.empty() && batch.size() < kMaxBatch) {
+    batch.push_back(std::move(c.queued.front()));
+    c.queued.pop_front();
+  }
+  c.executing = true;
+
+  uint64_t id = c.id;
+  Protocol proto = c.proto;
+  FetchWait resume = std::exchange(c.wait, FetchWait{}); // set if the first request parked before
+  server_.workers_->submit([this, id, proto, batch = std::move(batch), resume = std::move(resume)]() mutable {
+    ResponseBuffer out;
+    FetchWait wait;
+    std::vector<StreamOp> ops;
+    size_t i = 0;
+    for (; i < batch.size(); i++) {
+      metrics::Timer timer(metrics::kRequest);
+      metrics::add(metrics::kRequests);
+      wait = i == 0 ? std::move(resume) : FetchWait{};
+      if (proto == Protocol::Binary) server_.handle_binary(batch[i], out, &wait);
+      else if (proto == Protocol::Http) server_.handle_http(batch[i], out.text());
+      else {
+        try { server_.handle_request(batch[i], out.text(), &wait, &ops); }
+        catch (const std::exception& e) { reply(out.text(), json({{"ok",false},{"error","internal"},{"message",e.what()}})); }
+      }
+      if (wait.parked) break;
+    }
+    // a parked request and everything behind it go back to the connection
+    post([this, id, out = std::move(out), batch = std::move(batch), done = i, wait = std::move(wait),
+          ops = std::move(ops)]() mutable {
+      finish(id, std::move(out), std::move(batch), done, std::move(wait), std::move(ops));
+    });
+  });
+}
+
+void IoLoop::finish(uint64_t id, ResponseBuffer responses, std::vector<std::string> batch, size_t done,
+                    FetchWait wait, std::vector<StreamOp> ops) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return; // closed while the batch ran
+  Connection& c = *it->second;
+
+  c.executing = false;
+  for (auto& ch : responses.chunks()) {
+    if (ch.size() == 0) continue;
+    c.out_bytes += ch.size();
+    c.out.chunks().push_back(std::move(ch));
+  }
+  for (size_t i = 0; i < done; i++) {
+    if (c.spare.size() >= kMaxBatch || batch[i].capacity() > kMaxSpareRequest) continue;
+    batch[i].clear();
+    c.spare.push_back(std::move(batch[i]));
+  }
+  if (done < batch.size()) {
+    c.queued.insert(c.queued.begin(), std::make_move_iterator(batch.begin() + done), std::make_move_iterator(batch.end()));
+    park(c, std::move(wait));
+  }
+  batch.clear();
+  c.batch = std::move(batch);
+  for (auto& op : ops) apply_stream(c, std::move(op));
+
+  flush_out(c);
+  dispatch(c);
+  settle(c);
+}
+
+void IoLoop::park(Connection& c, FetchWait wait) {
+  c.parked = true;
+  c.wait = std::move(wait);
+  c.wait.parked = false;
+  uint64_t id = c.id, seq = ++c.wait_seq;
+  timers_.emplace(c.wait.deadline_ms, id);
+  // may call back right away if data arrived while the request ran
+  c.wait_token = GlobalStore::instance().watch(c.wait.topic, c.wait.partition, c.wait.after_offset,
+                                               [this, id, seq] { post([this, id, seq] { wake(id, seq); }); });
+}
+
+void IoLoop::unpark(Connection& c) {
+  GlobalStore::instance().unwatch(c.wait.topic, c.wait.partition, c.wait_token);
+  timers_.erase({c.wait.deadline_ms, c.id});
+  c.wait_token = 0;
+  c.parked = false;
+}
+
+void IoLoop::wake(uint64_t id, uint64_t seq) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return;
+  Connection& c = *it->second;
+  if (!c.parked || c.wait_seq != seq) return;
+
+  unpark(c);
+  dispatch(c);
+  settle(c);
+}
+
+void IoLoop::expire_timers() {
+  uint64_t now = steady_ms();
+  while (!timers_.empty() && timers_.begin()->first <= now) {
+    uint64_t id = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+    auto it = conns_.find(id);
+    if (it != conns_.end()) wake(id, it->second->wait_seq);
+  }
+}
+
+void IoLoop::apply_stream(Connection& c, StreamOp op) {
+  if (op.kind == StreamOp::Credit || op.kind == StreamOp::Subscribe) {
+    c.credit = op.credit > UINT64_MAX - c.credit ? UINT64_MAX : c.credit + op.credit;
+  }
+  if (op.kind == StreamOp::Credit) return;
+
+  auto it = c.subs.find(op.topic);
+  if (it != c.subs.end()) { drop_subscription(op.topic, it->second); c.subs.erase(it); }
+  if (op.kind == StreamOp::Unsubscribe) return;
+
+  Subscription& sub = c.subs[op.topic];
+  sub.gen = ++c.sub_seq;
+  for (size_t i = 0; i < op.partitions.size(); i++) {
+    Subscription::Part part;
+    part.partition = op.partitions[i];
+    part.next = op.offsets[i];
+    sub.parts.push_back(part);
+  }
+}
+
+void IoLoop::drop_subscription(const std::string& topic, Subscription& sub) {
+  for (auto& part : sub.parts) {
+    GlobalStore::instance().unwatch(topic, part.partition, part.token);
+    part.token = 0;
+  }
+}
+
+// Starts a pump round if the connection has credit, room in its output
+// buffer, a partition that may have records, and no round in flight.
+void IoLoop::pump(Connection& c) {
+  if (c.pumping || c.credit == 0 || c.subs.empty() || c.out_bytes >= kMaxPendingOut) return;
+
+  std::vector<PumpItem> items;
+  for (auto& [topic, sub] : c.subs) {
+    for (size_t i = 0; i < sub.parts.size(); i++) {
+      if (!sub.parts[i].ready) continue;
+      PumpItem item;
+      item.topic = topic;
+      item.gen = sub.gen;
+      item.part = i;
+      item.partition = sub.parts[i].partition;
+      item.next = sub.parts[i].next;
+      items.push_back(std::move(item));
+    }
+  }
+  if (items.empty()) return;
+  std::rotate(items.begin(), items.begin() + (long)(c.pump_rr++ % items.size()), items.end());
+
+  c.pumping = true;
+  uint64_t id = c.id, credit = c.credit;
+  server_.workers_->submit([this, id, credit, items = std::move(items)]() mutable {
+    uint64_t left = credit;
+    size_t bytes = 0;
+    try {
+      for (auto& it : items) {
+        if (left == 0 || bytes >= kPushBytes) break;
+        int limit = (int)std::min<uint64_t>(left, kPushRecords);
+        auto batch = GlobalStore::instance().fetch(it.topic, it.partition, it.next, limit);
+        it.sent = batch.records.size();
+        it.caught_up = batch.records.size() < (size_t)limit;
+        it.next = batch.next_offset;
+        left -= it.sent;
+        if (batch.records.empty()) continue;
+
+        std::string& out = it.line;
+        out.reserve(batch.data.size() + batch.records.size() * 96 + 128);
+        out += "{\"type\":\"RECORDS\",\"topic\":"; json_append_string(out, it.topic);
+        out += ",\"partition\":"; json_append_int(out, it.partition);
+        out += ",\"next_offset\":"; json_append_uint(out, batch.next_offset);
+        out += ",\"records\":"; json_append_records(out, batch, it.partition);
+        out += "}\n";
+        bytes += out.size();
+      }
+    } catch (const std::exception& e) {
+      std::cerr << "subscription read failed: " << e.what() << "\n";
+    }
+    post([this, id, items = std::move(items), used = credit - left]() mutable { pumped(id, std::move(items), used); });
+  });
+}
+
+void IoLoop::pumped(uint64_t id, std::vector<PumpItem> items, uint64_t used) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return;
+  Connection& c = *it->second;
+
+  c.pumping = false;
+  c.credit -= std::min(used, c.credit);
+  for (auto& item : items) {
+    // dropped if the topic was unsubscribed (or subscribed anew) meanwhile
+    auto sit = c.subs.find(item.topic);
+    if (sit == c.subs.end() || sit->second.gen != item.gen) continue;
+
+    auto& part = sit->second.parts[item.part];
+    part.next = item.next;
+    if (!item.line.empty()) {
+      c.out.text() += item.line;
+      c.out_bytes += item.line.size();
+    }
+    if (item.caught_up) {
+      part.ready = false;
+      watch_part(c, item.topic, sit->second, item.part);
+    }
+  }
+
+  flush_out(c);
+  settle(c);
+}
+
+void IoLoop::watch_part(Connection& c, const std::string& topic, Subscription& sub, size_t i) {
+  auto& part = sub.parts[i];
+  uint64_t id = c.id, gen = sub.gen;
+  part.token = GlobalStore::instance().watch(topic, part.partition, part.next, [this, id, topic, gen, i] {
+    post([this, id, topic, gen, i] { part_ready(id, topic, gen, i); });
+  });
+}
+
+void IoLoop::part_ready(uint64_t id, const std::string& topic, uint64_t gen, size_t i) {
+  auto it = conns_.find(id);
+  if (it == conns_.end()) return;
+  Connection& c = *it->second;
+  auto sit = c.subs.find(topic);
+  if (sit == c.subs.end() || sit->second.gen != gen) return;
+
+  auto& part = sit->second.parts[i];
+  part.token = 0;
+  part.ready = true;
+  settle(c);
+}
+
+void IoLoop::drop_output(Connection& c) {
+  c.out.chunks().clear();
+  c.out_off = 0;
+  c.out_bytes = 0;
+}
+
+void IoLoop::flush_out(Connection& c) {
+  auto& chunks = c.out.chunks();
+  while (!chunks.empty()) {
+    auto& ch = chunks.front();
+    size_t left = ch.size() - c.out_off;
+    ssize_t n;
+    if (ch.file) {
+      // zero-copy: log bytes go from the page cache straight to the socket
+      off_t off = (off_t)(ch.file_pos + c.out_off);
+      n = ::sendfile(c.fd, ch.file->fd(), &off, left);
+      if (n == 0) { errno = EIO; n = -1; } // log shorter than the located range
+    } else {
+      int flags = MSG_NOSIGNAL | (chunks.size() > 1 ? MSG_MORE : 0);
+      n = ::send(c.fd, ch.data.data() + c.out_off, left, flags);
+    }
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+      // peer is gone: drop everything and close once idle
+      c.read_closed = true;
+      c.queued.clear();
+      drop_output(c);
+      return;
+    }
+    c.out_off += (size_t)n;
+    c.out_bytes -= (uint64_t)n;
+    if (c.out_off == ch.size()) { chunks.pop_front(); c.out_off = 0; }
+  }
+}
+
+// closes finished connections and keeps epoll interest in line with state
+bool IoLoop::settle(Connection& c) {
+  bool out_pending = c.out_bytes > 0;
+  if (c.read_closed && !c.executing && c.queued.empty() && !out_pending) { close_connection(c); return false; }
+  pump(c);
+  update_interest(c);
+  return true;
+}
+
+void IoLoop::update_interest(Connection& c) {
+  bool out_pending = c.out_bytes > 0;
+  bool want_read = !c.read_closed
+                && c.queued.size() < server_.cfg_.max_queued_requests
+                && c.out_bytes < kMaxPendingOut;
+
+  uint32_t events = (want_read ? (uint32_t)EPOLLIN : 0u) | (out_pending ? (uint32_t)EPOLLOUT : 0u);
+  if (events == c.events) return;
+
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.u64 = c.id;
+  ::epoll_ctl(epfd_, EPOLL_CTL_MOD, c.fd, &ev);
+  c.events = events;
+}
+
+void IoLoop::close_connection(Connection& c) {
+  if (c.parked) unpark(c);
+  for (auto& [topic, sub] : c.subs) drop_subscription(topic, sub);
+  ::epoll_ctl(epfd_, EPOLL_CTL_DEL, c.fd, nullptr);
+  ::close(c.fd);
+  server_.connections_--;
+  conns_.erase(c.id);
+}
+
+static const char* group_error(GroupCoordinator::Status st) {
+  switch (st) {
+    case GroupCoordinator::Status::UnknownMember: return "unknown_member";
+    case GroupCoordinator::Status::RebalanceInProgress: return "rebalance_in_progress";
+    case GroupCoordinator::Status::NotAssigned: return "not_assigned";
+    default: return "ok";
+  }
+}
+
+// The consumer group member a COMMIT or FETCH_GROUP is made for, if it
+// names one.
+struct GroupMember {
+  bool given = false;
+  bool malformed = false;   // member_id is not a string
+  std::string_view id;
+  uint64_t generation = 0;
+};
+
+// Group requests that name a member_id are fenced: they must carry the
+// current generation and target a partition the member owns. Replies with
+// the error and returns true if the request is rejected.
+static const char* fence_error(const GroupMember& member, std::string_view group, std::string_view topic,
+                               int partition) {
+  if (!member.given) return nullptr;
+  if (member.malformed) return "bad_request";
+
+  auto st = GlobalStore::instance().groups().check(group, member.id, member.generation, topic, partition);
+  return st == GroupCoordinator::Status::Ok ? nullptr : group_error(st);
+}
+
+static bool fenced(const GroupMember& member, std::string_view group, std::string_view topic, int partition,
+                   std::string& out) {
+  const char* err = fence_error(member, group, topic, partition);
+  if (err) reply_error(out, err);
+  return err != nullptr;
+}
+
+// true if a fetch came back with fewer records or bytes than the client
+// waits for. A filtered scan that stopped short of the partition end is
+// answered as is: waiting would only scan the same records again.
+static bool fetch_short(const FetchResult& batch, int limit, int min_records, long long min_bytes,
+                        std::string_view topic, int partition) {
+  if (batch.records.size() >= (size_t)min_records &&
+      (batch.records.size() >= (size_t)limit || (long long)batch.data.size() >= min_bytes)) return false;
+  return batch.next_offset >= GlobalStore::instance().end_offset(topic, partition);
+}
+
+// after the fetch that auto-created the topic, if it had to
+static bool has_partition(std::string_view topic, int partition) {
+  return partition >= 0 && partition < GlobalStore::instance().partition_count(topic);
+}
+
+static void reply_corrupt(std::string& out, uint64_t offset) {
+  out += "{\"error\":\"corrupt_record\",\"offset\":";
+  json_append_uint(out, offset);
+  out += ",\"ok\":false}\n";
+}
+
+// json::value() behind the getters of FlatRequest, so the handlers below
+// read either kind of request. Never returns false: throws where value()
+// throws.
+class JsonFields {
+public:
+  explicit JsonFields(const json& j) : j_(j) {}
+
+  const json& doc() const { return j_; }
+
+  bool get(std::string_view key, std::string_view& out) const {
+    auto it = j_.find(key);
+    if (it == j_.end()) return true;
+    if (!it->is_string()) (void)it->get<std::string>(); // the type_error value() throws
+    out = it->get_ref<const std::string&>();
+    return true;
   }
-  return line;
+
+  template <typename T>
+  bool get(std::string_view key, T& out) const {
+    out = j_.value(key, out);
+    return true;
+  }
+
+private:
+  const json& j_;
+};
+
+static bool read_member(const JsonFields& req, GroupMember& m) {
+  auto it = req.doc().find("member_id");
+  if (it == req.doc().end()) return true;
+  m.given = true;
+  if (!it->is_string()) { m.malformed = true; return true; }
+  m.id = it->get_ref<const std::string&>();
+  return req.get("generation", m.generation);
 }
 
-static void write_line(int fd, const std::string& s) {
-  std::string out = s + "\n";
-  const char* p = out.c_str();
-  size_t left = out.size();
-  while (left > 0) {
-    ssize_t n = ::send(fd, p, left, 0);
-    if (n < 0) { if (errno == EINTR) continue; throw std::runtime_error("send failed"); }
-    p += n; left -= (size_t)n;
+static bool read_member(const FlatRequest& req, GroupMember& m) {
+  auto* f = req.find("member_id");
+  if (!f) return true;
+  m.given = true;
+  if (f->kind != FlatRequest::Field::String) { m.malformed = true; return true; }
+  m.id = f->str;
+  return req.get("generation", m.generation);
+}
+
+static bool read_filter(const JsonFields& req, RecordFilter& filter, std::string& err) {
+  return record_filter_from_json(req.doc(), filter, err);
+}
+
+// handle_flat() leaves filtered fetches to the json path
+static bool read_filter(const FlatRequest&, RecordFilter&, std::string&) { return true; }
+
+// The hot requests, written once for both readers. Every member is read
+// before anything is written, so with a FlatRequest they can return false
+// (a member of the wrong type) and leave the request to the json path;
+// with JsonFields they always answer. Replies are serialized by hand, the
+// same bytes whichever reader parsed the request: PRODUCE and COMMIT with
+// their keys sorted, as json::dump() would, FETCH and FETCH_GROUP in the
+// order the fetch replies have always had (ok, topic, partition, ...,
+// records last).
+
+template <typename Req>
+static bool handle_produce(const Req& req, std::string& out) {
+  std::string_view topic, key, value;
+  int partition = -1;
+  if (!req.get("topic", topic) || !req.get("key", key) || !req.get("value", value) ||
+      !req.get("partition", partition)) return false;
+  if (topic.empty()) { reply_error(out, "missing_topic"); return true; }
+
+  // returns once the topic's durability level is reached, so the ack below implies it
+  auto [part, offset] = GlobalStore::instance().produce(topic, key, value, partition);
+  if (part < 0) { reply_error(out, partition == -1 ? "partition_required" : "bad_partition"); return true; }
+
+  metrics::Timer timer(metrics::kSerialize);
+  out += "{\"offset\":"; json_append_uint(out, offset);
+  out += ",\"ok\":true,\"partition\":"; json_append_int(out, part);
+  out += ",\"topic\":"; json_append_string(out, topic);
+  out += "}\n";
+  return true;
+}
+
+template <typename Req>
+static bool handle_fetch(const Req& req, std::string& out, FetchWait* wait, FetchResult& batch) {
+  std::string_view topic;
+  int partition = 0, limit = 10, min_records = 1;
+  long long offset = 0, max_wait_ms = 0, min_bytes = 0;
+  bool verify = false;
+  if (!req.get("topic", topic) || !req.get("partition", partition) || !req.get("offset", offset) ||
+      !req.get("limit", limit) || !req.get("max_wait_ms", max_wait_ms) || !req.get("min_records", min_records) ||
+      !req.get("min_bytes", min_bytes) || !req.get("verify", verify)) return false;
+
+  if (topic.empty() || offset < 0) { reply_error(out, "bad_request"); return true; }
+  limit = limit <= 0 ? 10 : std::min(limit, 1000);
+  min_records = std::clamp(min_records, 1, limit);
+  RecordFilter filter;
+  std::string err;
+  if (!read_filter(req, filter, err)) { reply_error(out, err); return true; }
+
+  GlobalStore::instance().fetch(topic, partition, (uint64_t)offset, limit, batch, &filter, verify);
+  // nothing could ever be appended to wake a long-poll on it
+  if (!has_partition(topic, partition)) { reply_error(out, "bad_partition"); return true; }
+  if (batch.corrupt && batch.records.empty()) { reply_corrupt(out, batch.next_offset); return true; }
+  if (fetch_short(batch, limit, min_records, min_bytes, topic, partition) &&
+      should_park(wait, (uint64_t)std::max(max_wait_ms, 0LL), topic, partition, batch.next_offset)) return true;
+
+  // records go straight from the fetch buffer to the output
+  metrics::Timer timer(metrics::kSerialize);
+  out.reserve(out.size() + batch.data.size() + batch.records.size() * 96 + 128);
+  out += "{\"ok\":true,\"topic\":"; json_append_string(out, topic);
+  out += ",\"partition\":"; json_append_int(out, partition);
+  out += ",\"next_offset\":"; json_append_uint(out, batch.next_offset);
+  out += ",\"records\":"; json_append_records(out, batch, partition);
+  out += "}\n";
+  return true;
+}
+
+template <typename Req>
+static bool handle_commit(const Req& req, std::string& out) {
+  std::string_view group, topic;
+  int partition = 0;
+  long long next_offset = 0;
+  GroupMember member;
+  if (!req.get("group", group) || !req.get("topic", topic) || !req.get("partition", partition) ||
+      !req.get("next_offset", next_offset) || !read_member(req, member)) return false;
+
+  if (group.empty() || topic.empty() || next_offset < 0) { reply_error(out, "bad_request"); return true; }
+  if (fenced(member, group, topic, partition, out)) return true;
+
+  bool ok = GlobalStore::instance().commit_offset(group, topic, partition, (uint64_t)next_offset);
+
+  metrics::Timer timer(metrics::kSerialize);
+  out += "{\"committed_next_offset\":"; json_append_uint(out, (uint64_t)next_offset);
+  out += ",\"group\":"; json_append_string(out, group);
+  out += ",\"ok\":"; out += ok ? "true" : "false";
+  out += ",\"partition\":"; json_append_int(out, partition);
+  out += ",\"topic\":"; json_append_string(out, topic);
+  out += "}\n";
+  return true;
+}
+
+template <typename Req>
+static bool handle_fetch_group(const Req& req, std::string& out, FetchWait* wait, FetchResult& batch) {
+  std::string_view group, topic;
+  int partition = 0, limit = 10, min_records = 1;
+  long long max_wait_ms = 0, min_bytes = 0;
+  bool auto_commit = true, verify = false;
+  GroupMember member;
+  if (!req.get("group", group) || !req.get("topic", topic) || !req.get("partition", partition) ||
+      !req.get("limit", limit) || !req.get("auto_commit", auto_commit) || !req.get("max_wait_ms", max_wait_ms) ||
+      !req.get("min_records", min_records) || !req.get("min_bytes", min_bytes) || !req.get("verify", verify) ||
+      !read_member(req, member)) return false;
+
+  if (group.empty() || topic.empty()) { reply_error(out, "bad_request"); return true; }
+  limit = limit <= 0 ? 10 : std::min(limit, 1000);
+  min_records = std::clamp(min_records, 1, limit);
+  RecordFilter filter;
+  std::string err;
+  if (!read_filter(req, filter, err)) { reply_error(out, err); return true; }
+  if (fenced(member, group, topic, partition, out)) return true;
+
+  auto& store = GlobalStore::instance();
+  uint64_t start = store.get_committed_offset(group, topic, partition);
+  store.fetch(topic, partition, start, limit, batch, &filter, verify);
+  if (!has_partition(topic, partition)) { reply_error(out, "bad_partition"); return true; }
+  if (batch.corrupt && batch.records.empty()) { reply_corrupt(out, batch.next_offset); return true; }
+  // parks before committing; the committed offset is read again on resume
+  if (fetch_short(batch, limit, min_records, min_bytes, topic, partition) &&
+      should_park(wait, (uint64_t)std::max(max_wait_ms, 0LL), topic, partition, batch.next_offset)) return true;
+
+  bool commit_ok = true;
+  uint64_t committed_after = start;
+  if (auto_commit) {
+    commit_ok = store.commit_offset(group, topic, partition, batch.next_offset);
+    committed_after = batch.next_offset;
   }
+
+  metrics::Timer timer(metrics::kSerialize);
+  out.reserve(out.size() + batch.data.size() + batch.records.size() * 96 + 256);
+  out += "{\"ok\":true,\"group\":"; json_append_string(out, group);
+  out += ",\"topic\":"; json_append_string(out, topic);
+  out += ",\"partition\":"; json_append_int(out, partition);
+  out += ",\"start_offset\":"; json_append_uint(out, start);
+  out += ",\"next_offset\":"; json_append_uint(out, batch.next_offset);
+  out += ",\"auto_commit\":"; out += auto_commit ? "true" : "false";
+  out += ",\"commit_ok\":"; out += commit_ok ? "true" : "false";
+  out += ",\"committed_offset_after\":"; json_append_uint(out, committed_after);
+  out += ",\"records\":"; json_append_records(out, batch, partition);
+  out += "}\n";
+  return true;
+}
+
+// Answers the hot requests from a FlatRequest. False, with nothing written,
+// if the request needs the json path.
+static bool handle_flat(const FlatRequest& req, std::string& out, FetchWait* wait, FetchResult& batch) {
+  std::string_view type;
+  if (!req.get("type", type)) return false;
+  if (type == "PRODUCE") return handle_produce(req, out);
+  if (type == "COMMIT") return handle_commit(req, out);
+  if (type != "FETCH" && type != "FETCH_GROUP") return false;
+  if (req.find("filter") || req.find("project")) return false;
+  return type == "FETCH" ? handle_fetch(req, out, wait, batch) : handle_fetch_group(req, out, wait, batch);
+}
+
+// Memory every request on a worker thread reuses. A connection's requests
+// run one batch at a time on whichever worker is free, so per-thread
+// buffers give each request warm memory, bounded by the pool size rather
+// than the number of connections.
+struct RequestScratch {
+  static constexpr size_t kMaxFetchKeep = 4 << 20;
+
+  Arena arena;
+  FlatRequest req;
+  FetchResult fetch;
+};
+
+static RequestScratch& request_scratch() {
+  thread_local RequestScratch s;
+  return s;
+}
+
+static int default_threads(int configured, int divisor, int min) {
+  if (configured > 0) return configured;
+  int hc = (int)std::thread::hardware_concurrency();
+  return std::max(min, hc / divisor);
 }
 
-PulseStreamServer::PulseStreamServer(uint16_t port) : listen_fd_(-1), port_(port) {
-  listen_fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+PulseStreamServer::PulseStreamServer(const ServerConfig& cfg) : cfg_(cfg), listen_fd_(-1) {
+  listen_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
   if (listen_fd_ < 0) throw std::runtime_error("socket failed");
 
   int yes = 1;
@@ -47,133 +1011,548 @@ PulseStreamServer::PulseStreamServer(uint16_t port) : listen_fd_(-1), port_(port
   sockaddr_in addr{};
   addr.sin_family = AF_INET;
   addr.sin_addr.s_addr = htonl(INADDR_ANY);
-  addr.sin_port = htons(port_);
+  addr.sin_port = htons(cfg_.port);
 
   if (::bind(listen_fd_, (sockaddr*)&addr, sizeof(addr)) < 0) throw std::runtime_error("bind failed");
-  if (::listen(listen_fd_, 128) < 0) throw std::runtime_error("listen failed");
+  if (::listen(listen_fd_, 1024) < 0) throw std::runtime_error("listen failed");
+
+  workers_ = std::make_unique<WorkerPool>(default_threads(cfg_.worker_threads, 1, 4));
+  int io = default_threads(cfg_.io_threads, 4, 1);
+  for (int i = 0; i < io; i++) loops_.push_back(std::make_unique<IoLoop>(*this));
 }
 
 PulseStreamServer::~PulseStreamServer() {
+  stop();
+  // workers first: in-flight tasks still post their results to the loops
+  workers_.reset();
+  loops_.clear();
   if (listen_fd_ >= 0) ::close(listen_fd_);
 }
 
+void PulseStreamServer::stop() {
+  if (stopping_.exchange(true)) return;
+  ::shutdown(listen_fd_, SHUT_RDWR);
+}
+
 void PulseStreamServer::run() {
-  while (true) {
-    sockaddr_in client_addr{};
-    socklen_t len = sizeof(client_addr);
-    int client_fd = ::accept(listen_fd_, (sockaddr*)&client_addr, &len);
-    if (client_fd < 0) { if (errno == EINTR) continue; throw std::runtime_error("accept failed"); }
-    std::thread(&PulseStreamServer::handle_client, this, client_fd).detach();
+  size_t next_loop = 0;
+  while (!stopping_) {
+    int client_fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd < 0) {
+      if (stopping_) break;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno == EMFILE || errno == ENFILE) { std::this_thread::sleep_for(std::chrono::milliseconds(10)); continue; }
+      throw std::runtime_error("accept failed");
+    }
+
+    if (connections_.fetch_add(1) >= cfg_.max_connections) {
+      connections_--;
+      static const char busy[] = "{\"error\":\"too_many_connections\",\"ok\":false}\n";
+      ssize_t n = ::send(client_fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+      (void)n;
+      ::close(client_fd);
+      continue;
+    }
+
+    int yes = 1;
+    ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    loops_[next_loop++ % loops_.size()]->add_connection(client_fd);
   }
 }
 
-void PulseStreamServer::handle_client(int client_fd) {
+void PulseStreamServer::handle_request(const std::string& line, std::string& out, FetchWait* wait,
+                                       std::vector<StreamOp>* stream) {
+  auto& scratch = request_scratch();
+  scratch.arena.reset();
+  if (scratch.fetch.data.capacity() > RequestScratch::kMaxFetchKeep) scratch.fetch = FetchResult{};
+
+  // the hot requests are flat objects: read in place, no json tree
+  uint64_t parse_start = metrics::now_ns();
+  bool flat = scratch.req.parse(line, scratch.arena);
+  uint64_t parse_ns = metrics::now_ns() - parse_start;
+  if (flat && handle_flat(scratch.req, out, wait, scratch.fetch)) {
+    metrics::record(metrics::kParse, parse_ns);
+    return;
+  }
+
+  json req;
   try {
-    while (true) {
-      std::string line = read_line(client_fd);
-      if (line.empty()) break;
+    parse_start = metrics::now_ns();
+    req = json::parse(line);
+    metrics::record(metrics::kParse, parse_ns + metrics::now_ns() - parse_start);
+  } catch (...) { reply(out, json({{"ok", false},{"error","invalid_json"}})); return; }
 
-      json req;
-      try { req = json::parse(line); }
-      catch (...) { write_line(client_fd, json({{"ok", false},{"error","invalid_json"}}).dump()); continue; }
+  const std::string type = req.value("type", "");
 
-      const std::string type = req.value("type", "");
+  if (type == "PING") {
+    reply(out, json({{"ok", true},{"type","PONG"}}));
+    return;
+  }
 
-      if (type == "PING") {
-        write_line(client_fd, json({{"ok", true},{"type","PONG"}}).dump());
-        continue;
-      }
+  if (type == "CREATE_TOPIC") {
+    std::string topic = req.value("topic","");
+    int parts = req.value("partitions", 3);
+    if (topic.empty()) { reply(out, json({{"ok",false},{"error","missing_topic"}})); return; }
 
-      if (type == "CREATE_TOPIC") {
-        std::string topic = req.value("topic","");
-        int parts = req.value("partitions", 3);
-        if (topic.empty()) { write_line(client_fd, json({{"ok",false},{"error","missing_topic"}}).dump()); continue; }
-        bool ok = GlobalStore::instance().create_topic(topic, parts);
-        write_line(client_fd, json({{"ok",ok},{"topic",topic},{"partitions",parts}}).dump());
-        continue;
-      }
+    TopicConfig cfg;
+    std::string err;
+    if (!topic_config_from_json(req, cfg, err)) { reply(out, json({{"ok",false},{"error",err}})); return; }
 
-      if (type == "TOPICS") {
-        write_line(client_fd, json({{"ok",true},{"topics",GlobalStore::instance().list_topics()}}).dump());
-        continue;
-      }
+    bool ok = GlobalStore::instance().create_topic(topic, parts, cfg);
+    json res = {{"ok",ok},{"topic",topic},{"partitions",parts}};
+    res.update(topic_config_to_json(cfg));
+    reply(out, res);
+    return;
+  }
 
-      if (type == "PRODUCE") {
-        std::string topic = req.value("topic","");
-        std::string key = req.value("key","");
-        std::string value = req.value("value","");
-        if (topic.empty()) { write_line(client_fd, json({{"ok",false},{"error","missing_topic"}}).dump()); continue; }
+  if (type == "TOPICS") {
+    reply(out, json({{"ok",true},{"topics",GlobalStore::instance().list_topics()}}));
+    return;
+  }
 
-        auto [partition, offset] = GlobalStore::instance().produce(topic, key, value);
-        write_line(client_fd, json({{"ok",true},{"topic",topic},{"partition",partition},{"offset",offset}}).dump());
-        continue;
-      }
+  if (type == "PRODUCE") {
+    handle_produce(JsonFields(req), out);
+    return;
+  }
 
-      if (type == "FETCH") {
-        std::string topic = req.value("topic","");
-        int partition = req.value("partition",0);
-        long long offset_ll = req.value("offset",0LL);
-        int limit = req.value("limit",10);
+  if (type == "PRODUCE_BATCH") {
+    std::string topic = req.value("topic","");
+    int partition = req.value("partition",-1);
+    auto it = req.find("records");
+    if (topic.empty() || it == req.end() || !it->is_array()) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
 
-        if (topic.empty() || offset_ll < 0) { write_line(client_fd, json({{"ok",false},{"error","bad_request"}}).dump()); continue; }
-        if (limit <= 0) limit = 10; if (limit > 1000) limit = 1000;
+    // views into the parsed request; no per-record copies
+    static const std::string empty;
+    std::vector<KeyValue> records;
+    records.reserve(it->size());
+    bool bad = false;
+    for (auto& r : *it) {
+      if (!r.is_object()) { bad = true; break; }
+      auto k = r.find("key"), v = r.find("value");
+      if ((k != r.end() && !k->is_string()) || (v != r.end() && !v->is_string())) { bad = true; break; }
+      records.push_back({k != r.end() ? k->get_ref<const std::string&>() : empty,
+                         v != r.end() ? v->get_ref<const std::string&>() : empty});
+    }
+    if (bad) { reply(out, json({{"ok",false},{"error","bad_record"}})); return; }
 
-        auto batch = GlobalStore::instance().fetch(topic, partition, (uint64_t)offset_ll, limit);
-        write_line(client_fd, json({{"ok",true},{"topic",topic},{"partition",partition},{"next_offset",batch.next_offset},{"records",batch.records}}).dump());
-        continue;
+    auto ranges = GlobalStore::instance().produce_batch(topic, records, partition);
+    if (ranges.empty() && !records.empty()) {
+      reply(out, json({{"ok",false},{"error",partition == -1 ? "partition_required" : "bad_partition"}}));
+      return;
+    }
+    json arr = json::array();
+    for (auto& r : ranges) {
+      arr.push_back({{"partition",r.partition},{"base_offset",r.base_offset},
+                     {"last_offset",r.base_offset + r.count - 1},{"count",r.count}});
+    }
+    reply(out, json({{"ok",true},{"topic",topic},{"count",records.size()},{"ranges",arr}}));
+    return;
+  }
+
+  if (type == "FETCH") {
+    handle_fetch(JsonFields(req), out, wait, scratch.fetch);
+    return;
+  }
+
+  if (type == "COMMIT") {
+    handle_commit(JsonFields(req), out);
+    return;
+  }
+
+  if (type == "FETCH_GROUP") {
+    handle_fetch_group(JsonFields(req), out, wait, scratch.fetch);
+    return;
+  }
+
+  if (type == "OFFSETS_FOR_TIME" || type == "RESET_GROUP_TO_TIME") {
+    bool reset = type == "RESET_GROUP_TO_TIME";
+    std::string group = req.value("group","");
+    std::string topic = req.value("topic","");
+    long long ts_ms = req.value("ts_ms",-1LL);
+    int partition = req.value("partition",-1);
+
+    if (topic.empty() || ts_ms < 0 || (reset && group.empty())) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+    auto& store = GlobalStore::instance();
+    int n = store.partition_count(topic);
+    if (n == 0) { reply(out, json({{"ok",false},{"error","unknown_topic"}})); return; }
+    if (partition >= n) { reply(out, json({{"ok",false},{"error","bad_partition"}})); return; }
+
+    // a reset moves the group's committed offsets to the first record at or after ts_ms
+    json offsets = json::array();
+    for (int p = partition < 0 ? 0 : partition; p < (partition < 0 ? n : partition + 1); p++) {
+      uint64_t off = store.offset_for_time(topic, p, (uint64_t)ts_ms);
+      if (reset && !store.commit_offset(group, topic, p, off)) { reply(out, json({{"ok",false},{"error","commit_failed"}})); return; }
+      offsets.push_back({{"partition",p},{"offset",off}});
+    }
+    json res = {{"ok",true},{"topic",topic},{"ts_ms",ts_ms},{"offsets",offsets}};
+    if (reset) res["group"] = group;
+    reply(out, res);
+    return;
+  }
+
+  if (type == "METRICS") {
+    json res = {{"ok",true}};
+    res.update(metrics::to_json(metrics::snapshot(), metrics_gauges()));
+    reply(out, res);
+    return;
+  }
+
+  if (type == "GROUP_STATS") {
+    std::string group = req.value("group","");
+    if (group.empty()) { reply(out, json({{"ok",false},{"error","missing_group"}})); return; }
+    reply(out, json({{"ok",true},{"stats",GlobalStore::instance().group_stats(group)}}));
+    return;
+  }
+
+  if (type == "CREATE_OPERATOR") {
+    std::string topic = req.value("topic","");
+    if (topic.empty()) { reply(out, json({{"ok",false},{"error","missing_topic"}})); return; }
+
+    OperatorSpec spec;
+    std::string err;
+    if (!operator_spec_from_json(req, spec, err) || !GlobalStore::instance().create_operator(topic, spec, err)) {
+      reply(out, json({{"ok",false},{"error",err}}));
+      return;
+    }
+    json res = {{"ok",true},{"topic",topic}};
+    res.update(operator_spec_to_json(spec));
+    reply(out, res);
+    return;
+  }
+
+  if (type == "DROP_OPERATOR") {
+    std::string topic = req.value("topic","");
+    std::string name = req.value("name","");
+    bool ok = GlobalStore::instance().drop_operator(topic, name);
+    reply(out, ok ? json({{"ok",true}}) : json({{"ok",false},{"error","unknown_operator"}}));
+    return;
+  }
+
+  if (type == "QUERY_OPERATOR") {
+    std::string topic = req.value("topic","");
+    std::string name = req.value("name","");
+    json window = GlobalStore::instance().query_operator(topic, name);
+    if (window.is_null()) { reply(out, json({{"ok",false},{"error","unknown_operator"}})); return; }
+    reply(out, json({{"ok",true},{"topic",topic},{"window",window}}));
+    return;
+  }
+
+  if (type == "LIST_OPERATORS") {
+    std::string topic = req.value("topic","");
+    reply(out, json({{"ok",true},{"topic",topic},{"operators",GlobalStore::instance().list_operators(topic)}}));
+    return;
+  }
+
+  if (type == "JOIN_GROUP") {
+    std::string group = req.value("group","");
+    std::string member_id = req.value("member_id","");
+    uint32_t session_ms = req.value("session_timeout_ms", GroupCoordinator::kDefaultSessionMs);
+    auto it = req.find("topics");
+
+    GroupCoordinator::Strategy strategy = GroupCoordinator::Strategy::Range;
+    if (group.empty() || it == req.end() || !it->is_array() || it->empty() ||
+        !parse_strategy(req.value("strategy","range"), strategy)) {
+      reply(out, json({{"ok",false},{"error","bad_request"}}));
+      return;
+    }
+    std::vector<std::string> topics;
+    for (auto& t : *it) {
+      if (!t.is_string() || t.get_ref<const std::string&>().empty()) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+      topics.push_back(t.get<std::string>());
+    }
+
+    GroupCoordinator::JoinResult res;
+    std::string err;
+    if (!GlobalStore::instance().groups().join(group, member_id, std::move(topics), strategy, session_ms, res, err)) {
+      reply(out, json({{"ok",false},{"error",err}}));
+      return;
+    }
+    json assignment = json::array();
+    for (auto& [topic, parts] : res.assignment) assignment.push_back({{"topic",topic},{"partitions",parts}});
+    reply(out, json({{"ok",true},{"group",group},{"member_id",res.member_id},{"generation",res.generation},
+                     {"strategy",strategy_name(res.strategy)},{"members",res.members},{"assignment",assignment}}));
+    return;
+  }
+
+  if (type == "HEARTBEAT") {
+    std::string group = req.value("group","");
+    std::string member_id = req.value("member_id","");
+    if (group.empty() || member_id.empty()) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+
+    auto st = GlobalStore::instance().groups().heartbeat(group, member_id, req.value("generation", 0ULL));
+    if (st == GroupCoordinator::Status::UnknownMember) { reply(out, json({{"ok",false},{"error",group_error(st)}})); return; }
+    // a new generation means a new assignment: the member joins again to get it
+    reply(out, json({{"ok",true},{"rebalance",st == GroupCoordinator::Status::RebalanceInProgress}}));
+    return;
+  }
+
+  if (type == "LEAVE_GROUP") {
+    std::string group = req.value("group","");
+    std::string member_id = req.value("member_id","");
+    if (group.empty() || member_id.empty()) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+
+    bool ok = GlobalStore::instance().groups().leave(group, member_id);
+    reply(out, ok ? json({{"ok",true}}) : json({{"ok",false},{"error","unknown_member"}}));
+    return;
+  }
+
+  if (type == "SUBSCRIBE") {
+    std::string topic = req.value("topic","");
+    std::string group = req.value("group","");
+    std::string from = req.value("from","end");
+    long long credit = req.value("credit",1000LL);
+
+    if (!stream) { reply(out, json({{"ok",false},{"error","subscribe_not_supported"}})); return; }
+    if (topic.empty() || credit < 0 || (from != "end" && from != "start")) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+
+    auto& store = GlobalStore::instance();
+    int n = store.partition_count(topic);
+    if (n == 0) { reply(out, json({{"ok",false},{"error","unknown_topic"}})); return; }
+
+    StreamOp op;
+    op.kind = StreamOp::Subscribe;
+    op.topic = topic;
+    op.credit = (uint64_t)credit;
+    auto it = req.find("partitions");
+    if (it == req.end()) {
+      for (int p = 0; p < n; p++) op.partitions.push_back(p);
+    } else {
+      if (!it->is_array()) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+      for (auto& p : *it) {
+        if (!p.is_number_integer() || p.get<int>() < 0 || p.get<int>() >= n) { reply(out, json({{"ok",false},{"error","bad_partition"}})); return; }
+        op.partitions.push_back(p.get<int>());
       }
+      std::sort(op.partitions.begin(), op.partitions.end());
+      op.partitions.erase(std::unique(op.partitions.begin(), op.partitions.end()), op.partitions.end());
+    }
+
+    // a group resumes from its committed offsets; otherwise from either end of the log
+    json parts = json::array();
+    for (int p : op.partitions) {
+      uint64_t off = !group.empty() ? store.get_committed_offset(group, topic, p)
+                   : from == "start" ? store.start_offset(topic, p)
+                   : store.end_offset(topic, p);
+      op.offsets.push_back(off);
+      parts.push_back({{"partition",p},{"offset",off}});
+    }
+    reply(out, json({{"ok",true},{"type","SUBSCRIBED"},{"topic",topic},{"partitions",parts},{"credit",credit}}));
+    stream->push_back(std::move(op));
+    return;
+  }
+
+  if (type == "UNSUBSCRIBE") {
+    std::string topic = req.value("topic","");
+    if (!stream) { reply(out, json({{"ok",false},{"error","subscribe_not_supported"}})); return; }
+    if (topic.empty()) { reply(out, json({{"ok",false},{"error","missing_topic"}})); return; }
+
+    StreamOp op;
+    op.kind = StreamOp::Unsubscribe;
+    op.topic = topic;
+    stream->push_back(std::move(op));
+    reply(out, json({{"ok",true},{"type","UNSUBSCRIBED"},{"topic",topic}}));
+    return;
+  }
+
+  // flow control for subscriptions; not answered unless malformed
+  if (type == "CREDIT") {
+    long long records = req.value("records",0LL);
+    if (!stream) { reply(out, json({{"ok",false},{"error","subscribe_not_supported"}})); return; }
+    if (records <= 0) { reply(out, json({{"ok",false},{"error","bad_request"}})); return; }
+
+    StreamOp op;
+    op.kind = StreamOp::Credit;
+    op.credit = (uint64_t)records;
+    stream->push_back(std::move(op));
+    return;
+  }
+
+  reply(out, json({{"ok",false},{"error","unknown_type"},{"got",type}}));
+}
 
-      if (type == "COMMIT") {
-        std::string group = req.value("group","");
-        std::string topic = req.value("topic","");
-        int partition = req.value("partition",0);
-        long long next_offset_ll = req.value("next_offset",0LL);
+metrics::Gauges PulseStreamServer::metrics_gauges() const {
+  return {{"connections", (uint64_t)std::max(connections_.load(), 0)},
+          {"worker_queue_depth", workers_->queue_depth()},
+          {"append_queue_depth", GlobalStore::instance().append_queue_depth()},
+          {"tail_cache_bytes", GlobalStore::instance().tail_cache_bytes()},
+          {"block_cache_bytes", BlockCache::instance().bytes()}};
+}
+
+void PulseStreamServer::handle_http(std::string_view request, std::string& out) {
+  // "GET <path> HTTP/1.x"
+  std::string_view path = request.substr(0, request.find('\r'));
+  path.remove_prefix(std::min(path.size(), (size_t)4));
+  path = path.substr(0, path.find(' '));
+
+  std::string body;
+  const char* status = "200 OK";
+  if (path == "/metrics" || path == "/") body = metrics::to_prometheus(metrics::snapshot(), metrics_gauges());
+  else { status = "404 Not Found"; body = "not found\n"; }
+
+  out += "HTTP/1.1 ";
+  out += status;
+  out += "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+  out += std::to_string(body.size());
+  out += "\r\nConnection: close\r\n\r\n";
+  out += body;
+}
+
+void PulseStreamServer::handle_binary(std::string_view frame, ResponseBuffer& resp, FetchWait* wait) {
+  using namespace binproto;
+  Reader r(frame);
+  uint8_t op = r.u8();
+
+  std::string& out = resp.text();
+  size_t at = begin_frame(out);
+  put_u8(out, op | kResponseBit);
+  size_t status_at = out.size();
+  put_u8(out, kOk);
+
+  auto fail = [&](Status st, std::string_view msg) {
+    out.resize(status_at);
+    put_u8(out, st);
+    out.append(msg);
+    finish_frame(out, at);
+  };
+
+  try {
+    auto& store = GlobalStore::instance();
+    switch (op) {
+      case kPing:
+        break;
+
+      case kProduce: {
+        std::string topic(r.str16());
+        int partition = r.i32();
+        uint32_t n = r.u32();
+        if (r.failed() || topic.empty()) return fail(kBadRequest, "bad_request");
 
-        if (group.empty() || topic.empty() || next_offset_ll < 0) { write_line(client_fd, json({{"ok",false},{"error","bad_request"}}).dump()); continue; }
+        // record views point into the request frame; no copies before the append
+        std::vector<KeyValue> records;
+        records.reserve(std::min<uint32_t>(n, 1u << 16));
+        for (uint32_t i = 0; i < n && !r.failed(); i++) {
+          uint32_t klen = r.u32(), vlen = r.u32();
+          auto k = r.bytes(klen);
+          records.push_back({k, r.bytes(vlen)});
+        }
+        if (r.failed() || !r.done()) return fail(kBadRequest, "bad_record");
 
-        bool ok = GlobalStore::instance().commit_offset(group, topic, partition, (uint64_t)next_offset_ll);
-        write_line(client_fd, json({{"ok",ok},{"group",group},{"topic",topic},{"partition",partition},{"committed_next_offset",(uint64_t)next_offset_ll}}).dump());
-        continue;
+        auto ranges = store.produce_batch(topic, records, partition);
+        if (ranges.empty() && !records.empty()) return fail(kBadRequest, partition == -1 ? "partition_required" : "bad_partition");
+        put_u32(out, (uint32_t)ranges.size());
+        for (auto& rg : ranges) { put_i32(out, rg.partition); put_u64(out, rg.base_offset); put_u64(out, rg.count); }
+        break;
       }
 
-      if (type == "FETCH_GROUP") {
-        std::string group = req.value("group","");
-        std::string topic = req.value("topic","");
-        int partition = req.value("partition",0);
-        int limit = req.value("limit",10);
-        bool auto_commit = req.value("auto_commit", true);
+      case kFetch:
+      case kFetchGroup: {
+        std::string group;
+        if (op == kFetchGroup) group = std::string(r.str16());
+        std::string topic(r.str16());
+        int partition = r.i32();
+        uint64_t offset = op == kFetch ? r.u64() : 0;
+        uint32_t limit = r.u32();
+        uint32_t max_bytes = r.u32();
+        bool auto_commit = op == kFetchGroup ? r.u8() != 0 : false;
+        uint32_t max_wait_ms = 0, min_bytes = 0;
+        uint8_t flags = 0;
+        GroupMember member;
+        if (!r.done()) { max_wait_ms = r.u32(); min_bytes = r.u32(); }
+        if (!r.done()) flags = r.u8();
+        if (op == kFetchGroup && !r.done()) { member.given = true; member.id = r.str16(); member.generation = r.u64(); }
+        if (r.failed() || topic.empty() || (op == kFetchGroup && group.empty())) return fail(kBadRequest, "bad_request");
+        if (const char* err = fence_error(member, group, topic, partition)) return fail(kBadRequest, err);
 
-        if (group.empty() || topic.empty()) { write_line(client_fd, json({{"ok",false},{"error","bad_request"}}).dump()); continue; }
-        if (limit <= 0) limit = 10; if (limit > 1000) limit = 1000;
+        if (limit == 0) limit = 10;
+        if (limit > 100000) limit = 100000;
+        if (max_bytes == 0 || max_bytes > (16u << 20)) max_bytes = 16u << 20;
 
-        uint64_t start = GlobalStore::instance().get_committed_offset(group, topic, partition);
-        auto batch = GlobalStore::instance().fetch(topic, partition, start, limit);
+        if (op == kFetchGroup) offset = store.get_committed_offset(group, topic, partition);
 
-        bool commit_ok = true;
-        uint64_t committed_after = start;
-        if (auto_commit) {
-          commit_ok = GlobalStore::instance().commit_offset(group, topic, partition, batch.next_offset);
-          committed_after = batch.next_offset;
+        auto range = store.locate_frames(topic, partition, offset, (int)limit, max_bytes);
+        if (!has_partition(topic, partition)) return fail(kBadRequest, "bad_partition");
+        // a range cut at a segment boundary is short but not at the end; it answers now
+        bool short_range = range.count == 0 ||
+                           (range.count < limit && range.len < std::min(min_bytes, max_bytes) &&
+                            range.next_offset >= store.end_offset(topic, partition));
+        if (short_range && should_park(wait, max_wait_ms, topic, partition, range.next_offset)) {
+          out.resize(at);
+          return;
         }
+        put_i32(out, partition);
+        if (range.batches && !(flags & kAcceptBatches)) {
+          // an older client: the records go out decompressed, one frame each
+          auto res = store.fetch(topic, partition, offset, (int)limit);
+          size_t head = out.size();
+          put_u64(out, res.records.empty() ? res.next_offset : res.records[0].offset);
+          put_u64(out, res.next_offset);
+          put_u32(out, 0);
+          size_t frames_at = out.size();
+          uint32_t n = 0;
+          uint64_t next = res.next_offset;
+          for (auto& rec : res.records) {
+            using record_format::kHeaderSize;
+            if (n && out.size() - frames_at + kHeaderSize + rec.key_len + rec.value_len > max_bytes) {
+              next = rec.offset;
+              std::memcpy(&out[head + 8], &next, 8);
+              break;
+            }
+            char header[kHeaderSize];
+            record_format::encode_header(header, rec.offset, rec.ts_ms, res.key(rec), res.value(rec));
+            out.append(header, sizeof(header));
+            out.append(res.key(rec));
+            out.append(res.value(rec));
+            n++;
+          }
+          std::memcpy(&out[head + 16], &n, 4);
+          // only what the reply carries: fetch() and max_bytes may cut it short of the range
+          if (op == kFetchGroup && auto_commit) store.commit_offset(group, topic, partition, next);
+          break;
+        }
+        if (op == kFetchGroup && auto_commit) store.commit_offset(group, topic, partition, range.next_offset);
+        put_u64(out, range.first_offset);
+        put_u64(out, range.next_offset);
+        put_u32(out, (uint32_t)range.frames);
 
-        write_line(client_fd, json({
-          {"ok",true},{"group",group},{"topic",topic},{"partition",partition},
-          {"start_offset",start},{"next_offset",batch.next_offset},
-          {"auto_commit",auto_commit},{"commit_ok",commit_ok},{"committed_offset_after",committed_after},
-          {"records",batch.records}
-        }).dump());
-        continue;
+        if (range.mem) { // from the tail buffer: copied, not sent from the file
+          out.append(range.mem.get() + range.pos, range.len);
+          break;
+        }
+        // the frame's length covers the log bytes that follow via sendfile
+        uint32_t len = (uint32_t)(out.size() - at - 4 + range.len);
+        std::memcpy(&out[at], &len, 4);
+        resp.append_file(range.file, range.pos, range.len);
+        return;
       }
 
-      if (type == "GROUP_STATS") {
-        std::string group = req.value("group","");
-        if (group.empty()) { write_line(client_fd, json({{"ok",false},{"error","missing_group"}}).dump()); continue; }
-        write_line(client_fd, json({{"ok",true},{"stats",GlobalStore::instance().group_stats(group)}}).dump());
-        continue;
+      case kCommit: {
+        std::string group(r.str16());
+        std::string topic(r.str16());
+        int partition = r.i32();
+        uint64_t next_offset = r.u64();
+        GroupMember member;
+        if (!r.done()) { member.given = true; member.id = r.str16(); member.generation = r.u64(); }
+        if (r.failed() || group.empty() || topic.empty()) return fail(kBadRequest, "bad_request");
+        if (const char* err = fence_error(member, group, topic, partition)) return fail(kBadRequest, err);
+        if (!store.commit_offset(group, topic, partition, next_offset)) return fail(kBadRequest, "commit_failed");
+        put_u64(out, store.get_committed_offset(group, topic, partition));
+        break;
       }
 
-      write_line(client_fd, json({{"ok",false},{"error","unknown_type"},{"got",type}}).dump());
+      case kJson: {
+        std::string resp;
+        handle_request(std::string(r.rest()), resp, wait);
+        if (wait && wait->parked) { out.resize(at); return; }
+        if (!resp.empty() && resp.back() == '\n') resp.pop_back();
+        out += resp;
+        break;
+      }
+
+      default:
+        return fail(kUnknownOp, "unknown_op");
     }
-  } catch (...) {}
-  ::close(client_fd);
+  } catch (const std::exception& e) {
+    return fail(kInternal, e.what());
+  }
+
+  finish_frame(out, at);
 }
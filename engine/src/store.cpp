@@ -1,8 +1,11 @@
 #include "store.h"
+#include "metrics.h"
 
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
-#include <fstream>
+#include <iostream>
+#include <string_view>
 
 namespace fs = std::filesystem;
 using json = nlohmann::json;
@@ -12,22 +15,21 @@ static uint64_t now_ms() {
   return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
 }
 
-static uint64_t fnv1a_64(const std::string& s) {
-  const uint64_t FNV_OFFSET = 1469598103934665603ULL;
-  const uint64_t FNV_PRIME  = 1099511628211ULL;
-  uint64_t h = FNV_OFFSET;
-  for (unsigned char c : s) { h ^= (uint64_t)c; h *= FNV_PRIME; }
-  return h;
+// Partition count of a topic directory: highest pN (segment directory or
+// pre-segment pN.log) plus one, or 0 if there are none.
+static int partitions_on_disk(const std::string& topic) {
+  std::error_code ec;
+  int count = 0;
+  for (auto& e : fs::directory_iterator(fs::path("data") / topic, ec)) {
+    std::string name = e.path().filename().string();
+    if (e.path().extension() == ".log") name = e.path().stem().string();
+    if (name.size() < 2 || name[0] != 'p' || name.size() > 5) continue;
+    if (!all_digits(std::string_view(name).substr(1))) continue;
+    count = std::max(count, std::atoi(name.c_str() + 1) + 1);
+  }
+  return count;
 }
 
-// binary record: [u64 ts][u32 klen][u32 vlen][k][v]
-static void write_u64(std::ofstream& out, uint64_t v){ out.write((const char*)&v, sizeof(v)); }
-static void write_u32(std::ofstream& out, uint32_t v){ out.write((const char*)&v, sizeof(v)); }
-static bool read_u64(std::ifstream& in, uint64_t& v){ in.read((char*)&v, sizeof(v)); return (bool)in; }
-static bool read_u32(std::ifstream& in, uint32_t& v){ in.read((char*)&v, sizeof(v)); return (bool)in; }
-
-static fs::path offsets_path(){ return fs::path("data") / "_offsets.json"; }
-
 GlobalStore& GlobalStore::instance() {
   static GlobalStore s;
   return s;
@@ -35,285 +37,547 @@ GlobalStore& GlobalStore::instance() {
 
 GlobalStore::GlobalStore() {
   fs::create_directories("data");
+  offsets_ = std::make_unique<OffsetStore>((fs::path("data") / "_offsets").string(),
+                                          (fs::path("data") / "_offsets.json").string());
+  groups_ = std::make_unique<GroupCoordinator>([this](const std::string& topic) { return partition_count(topic); });
+  recover_topics();
+  flusher_ = std::thread(&GlobalStore::flusher_loop, this);
+  cleaner_ = std::thread(&GlobalStore::cleaner_loop, this);
 }
 
-void GlobalStore::load_offsets_locked() {
-  if (offsets_loaded_) return;
-  offsets_loaded_ = true;
-
-  if (!fs::exists(offsets_path())) return;
-  std::ifstream in(offsets_path());
-  if (!in) return;
-
-  json j;
-  try { in >> j; } catch (...) { return; }
-  if (!j.is_object()) return;
+GlobalStore::~GlobalStore() {
+  {
+    std::lock_guard<std::mutex> lock(flusher_mu_);
+    stopping_ = true;
+  }
+  flusher_cv_.notify_all();
+  if (flusher_.joinable()) flusher_.join();
+  if (cleaner_.joinable()) cleaner_.join();
+}
 
-  committed_.clear();
-  for (auto& [group, gv] : j.items()) {
-    if (!gv.is_object()) continue;
-    for (auto& [topic, tv] : gv.items()) {
-      if (!tv.is_array()) continue;
-      std::vector<uint64_t> vec;
-      for (auto& x : tv) {
-        if (!x.is_number_unsigned()) { vec.clear(); break; }
-        vec.push_back(x.get<uint64_t>());
+// fsyncs partitions of Interval topics that have been written to since
+// their last sync, once their interval has elapsed; all that are due at
+// once, as one disk_io batch
+void GlobalStore::flusher_loop() {
+  while (true) {
+    uint64_t now = now_ms();
+    uint64_t next_due = now + 100;
+
+    auto topics = snapshot_topics();
+    std::vector<PartitionLog*> due;
+    std::vector<std::shared_ptr<LogFile>> files;
+    for (auto& [name, st] : topics) {
+      if (st->config.durability != Durability::Interval) continue;
+      for (auto& part : st->parts) {
+        if (auto file = part->sync_due(now, next_due)) { due.push_back(part.get()); files.push_back(std::move(file)); }
       }
-      if (!vec.empty()) committed_[group][topic] = std::move(vec);
     }
+    if (!files.empty()) {
+      std::vector<LogFile*> raw;
+      for (auto& f : files) raw.push_back(f.get());
+      std::vector<bool> ok(raw.size(), false);
+      try { ok = LogFile::sync_all(raw); } catch (...) {}
+      for (size_t i = 0; i < due.size(); i++) due[i]->sync_done(ok[i]);
+    }
+
+    std::unique_lock<std::mutex> lock(flusher_mu_);
+    if (flusher_cv_.wait_for(lock, std::chrono::milliseconds(next_due - std::min(next_due, now_ms())),
+                             [this] { return stopping_; })) return;
   }
 }
 
-void GlobalStore::persist_offsets_locked() {
-  fs::create_directories("data");
-  json j = json::object();
-
-  for (auto& [group, topics] : committed_) {
-    json tg = json::object();
-    for (auto& [topic, vec] : topics) {
-      json arr = json::array();
-      for (auto v : vec) arr.push_back(v);
-      tg[topic] = arr;
+// deletes segments past retention and compacts "compact" topics; works on
+// closed segments only, so appends are never held up for long. Also
+// snapshots the offset commit log once it has grown.
+void GlobalStore::cleaner_loop() {
+  while (true) {
+    for (auto& [name, st] : snapshot_topics()) {
+      for (auto& part : st->parts) {
+        try {
+          part->enforce_retention(now_ms());
+          part->compact();
+        } catch (const std::exception&) {
+          // retried on the next pass
+        }
+      }
+    }
+    try { offsets_->maybe_snapshot(); } catch (const std::exception&) {}
+    groups_->expire();
+
+    // close windows of operators whose topics went quiet
+    uint64_t now = now_ms();
+    for (auto& [name, st] : snapshot_topics()) {
+      for (auto& op : *st->operators.load()) {
+        std::vector<StreamOperator::Output> windows;
+        op->tick(now, windows);
+        emit(*op, windows);
+      }
     }
-    j[group] = tg;
-  }
 
-  auto tmp = offsets_path(); tmp += ".tmp";
-  { std::ofstream out(tmp); out << j.dump(2); }
-  std::error_code ec;
-  fs::rename(tmp, offsets_path(), ec);
-  if (ec) { std::ofstream out(offsets_path()); out << j.dump(2); }
+    std::unique_lock<std::mutex> lock(flusher_mu_);
+    if (flusher_cv_.wait_for(lock, std::chrono::seconds(1), [this] { return stopping_; })) return;
+  }
 }
 
-bool GlobalStore::create_topic(const std::string& topic, int partitions) {
-  if (topic.empty() || partitions <= 0 || partitions > 128) return false;
-
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
+std::shared_ptr<GlobalStore::TopicState> GlobalStore::prepare_topic(const std::string& topic, int partitions, const TopicConfig* cfg) {
+  auto st = std::make_shared<TopicState>();
+  st->partitions = partitions;
+  st->parts.resize(partitions);
+  st->recovery_ms.resize(partitions);
 
-  if (topics_.count(topic)) return false;
+  fs::path dir = fs::path("data") / topic;
+  fs::create_directories(dir);
 
-  TopicState st;
-  st.partitions = partitions;
+  if (cfg) { st->config = *cfg; save_topic_config(dir.string(), *cfg); }
+  else st->config = load_topic_config(dir.string());
+  TopicState* raw = st.get();
+  st->partitioner = std::make_unique<Partitioner>(st->config.partitioner, st->config.key_hash,
+                                                  st->config.sticky_bytes, partitions,
+                                                  [raw](int p) { return raw->parts[p]->queue_depth(); });
+
+  auto ops = std::make_shared<std::vector<std::shared_ptr<StreamOperator>>>();
+  for (auto& spec : load_operator_specs(dir.string())) ops->push_back(std::make_shared<StreamOperator>(std::move(spec)));
+  st->operators.store(std::move(ops));
+  return st;
+}
 
+// Opens (creating if needed) one partition log, recovering its segments.
+void GlobalStore::open_partition(TopicState& st, const std::string& topic, int partition) {
+  auto t0 = std::chrono::steady_clock::now();
   fs::path dir = fs::path("data") / topic;
-  fs::create_directories(dir);
+  std::string name = "p";
+  name += std::to_string(partition);
+  // data/<topic>/pN/ holds the segments; pN.log is the pre-segment layout
+  st.parts[partition] = std::make_unique<PartitionLog>((dir / name).string(), (dir / (name + ".log")).string(),
+                                                       st.config);
+  st.recovery_ms[partition] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Opens the partition logs of a topic. Runs without holding topics_mu_.
+std::shared_ptr<GlobalStore::TopicState> GlobalStore::load_topic(const std::string& topic, int partitions, const TopicConfig* cfg) {
+  auto st = prepare_topic(topic, partitions, cfg);
+  for (int p = 0; p < partitions; p++) open_partition(*st, topic, p);
+  return st;
+}
 
-  st.log_paths.resize(partitions);
-  st.index_pos.resize(partitions);
+// Opens every topic found under data/ before the engine serves requests.
+// Partitions recover independently, so they are spread over one thread per
+// core. A topic whose config or partitions fail to open is left out and
+// reported.
+void GlobalStore::recover_topics() {
+  auto t0 = std::chrono::steady_clock::now();
+
+  std::vector<std::pair<std::string, std::shared_ptr<TopicState>>> found;
+  std::vector<std::pair<size_t, int>> jobs; // (index into found, partition)
+  for (auto& e : fs::directory_iterator("data")) {
+    std::string topic = e.path().filename().string();
+    if (!e.is_directory() || topic.empty() || topic[0] == '_') continue;
+    int partitions = partitions_on_disk(topic);
+    if (partitions <= 0) continue;
+    std::shared_ptr<TopicState> st;
+    try { st = prepare_topic(topic, partitions, nullptr); }
+    catch (const std::exception& ex) {
+      std::cerr << "Skipping topic " << topic << ": " << ex.what() << "\n";
+      continue;
+    }
+    for (int p = 0; p < partitions; p++) jobs.emplace_back(found.size(), p);
+    found.emplace_back(topic, std::move(st));
+  }
 
-  for (int p = 0; p < partitions; p++) {
-    fs::path log = dir / ("p" + std::to_string(p) + ".log");
-    st.log_paths[p] = log.string();
-    std::ofstream out(st.log_paths[p], std::ios::binary | std::ios::app);
+  std::vector<std::string> errors(found.size());
+  std::mutex errors_mu;
+  std::atomic<size_t> next{0};
+  auto work = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < jobs.size();) {
+      auto [t, p] = jobs[i];
+      try { open_partition(*found[t].second, found[t].first, p); }
+      catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(errors_mu);
+        errors[t] = e.what();
+      }
+    }
+  };
+  size_t threads = std::min<size_t>(jobs.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> pool;
+  for (size_t i = 1; i < threads; i++) pool.emplace_back(work);
+  work();
+  for (auto& t : pool) t.join();
+
+  std::unique_lock<std::shared_mutex> lock(topics_mu_);
+  for (size_t t = 0; t < found.size(); t++) {
+    auto& [topic, st] = found[t];
+    if (!errors[t].empty()) {
+      std::cerr << "Skipping topic " << topic << ": " << errors[t] << "\n";
+      continue;
+    }
+    for (int p = 0; p < st->partitions; p++) {
+      if (st->recovery_ms[p] < recovery_.slowest_ms && !recovery_.slowest.empty()) continue;
+      recovery_.slowest = topic;
+      recovery_.slowest += "/p";
+      recovery_.slowest += std::to_string(p);
+      recovery_.slowest_ms = st->recovery_ms[p];
+    }
+    recovery_.topics++;
+    recovery_.partitions += st->partitions;
+    topics_[topic] = st;
   }
+  recovery_.total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
 
-  topics_[topic] = std::move(st);
-  return true;
+std::shared_ptr<GlobalStore::TopicState> GlobalStore::find_topic(std::string_view topic) {
+  std::shared_lock<std::shared_mutex> lock(topics_mu_);
+  auto it = topics_.find(topic);
+  return it == topics_.end() ? nullptr : it->second;
 }
 
-void GlobalStore::ensure_loaded_topic_locked(const std::string& topic) {
-  if (topics_.count(topic)) return;
+std::shared_ptr<GlobalStore::TopicState> GlobalStore::ensure_topic(std::string_view topic) {
+  if (auto st = find_topic(topic)) return st;
+  return add_topic(std::string(topic), 0, nullptr).first;
+}
 
-  // auto-create with 3 partitions
-  TopicState st;
-  st.partitions = 3;
+// Opens a topic that is not in topics_ yet and adds it; partitions 0 means
+// as many as are on disk, or 3. One thread opens a given name at a time, so
+// only one PartitionLog ever touches its files: threads after the same name
+// wait for it and then take its topic. Returns the topic and whether this
+// call opened it.
+std::pair<std::shared_ptr<GlobalStore::TopicState>, bool> GlobalStore::add_topic(const std::string& topic, int partitions,
+                                                                                   const TopicConfig* cfg) {
+  {
+    std::unique_lock<std::mutex> lock(loading_mu_);
+    while (true) {
+      if (auto st = find_topic(topic)) return {st, false};
+      if (loading_.insert(topic).second) break;
+      loading_cv_.wait(lock);
+    }
+  }
+  auto done = [&] {
+    std::lock_guard<std::mutex> lock(loading_mu_);
+    loading_.erase(topic);
+    loading_cv_.notify_all();
+  };
+
+  std::shared_ptr<TopicState> st;
+  try {
+    if (partitions <= 0) partitions = partitions_on_disk(topic);
+    st = load_topic(topic, partitions > 0 ? partitions : 3, cfg);
+  } catch (...) {
+    done();
+    throw;
+  }
+  {
+    std::unique_lock<std::shared_mutex> lock(topics_mu_);
+    topics_[topic] = st;
+  }
+  done();
+  return {st, true};
+}
 
-  fs::path dir = fs::path("data") / topic;
-  fs::create_directories(dir);
+std::vector<std::pair<std::string, std::shared_ptr<GlobalStore::TopicState>>> GlobalStore::snapshot_topics() {
+  std::shared_lock<std::shared_mutex> lock(topics_mu_);
+  return {topics_.begin(), topics_.end()};
+}
 
-  st.log_paths.resize(st.partitions);
-  st.index_pos.resize(st.partitions);
+bool GlobalStore::create_topic(const std::string& topic, int partitions, const TopicConfig& cfg) {
+  if (topic.empty() || partitions <= 0 || partitions > 128) return false;
+  if (find_topic(topic)) return false;
+  return add_topic(topic, partitions, &cfg).second;
+}
 
-  for (int p = 0; p < st.partitions; p++) {
-    fs::path log = dir / ("p" + std::to_string(p) + ".log");
-    st.log_paths[p] = log.string();
-    std::ofstream out(st.log_paths[p], std::ios::binary | std::ios::app);
+std::pair<int, uint64_t> GlobalStore::produce(std::string_view topic,
+                                              std::string_view key,
+                                              std::string_view value,
+                                              int partition) {
+  metrics::Timer timer(metrics::kProduce);
+  auto st = ensure_topic(topic);
+  int partitions = st->partitions;
+
+  if (partition == -1) {
+    if (st->partitioner->needs_partition()) return {-1, 0};
+    partition = key.empty() ? st->partitioner->for_keyless(record_format::kHeaderSize + value.size())
+                            : st->partitioner->for_key(key);
+  } else if (partition < 0 || partition >= partitions) {
+    return {-1, 0};
   }
 
-  // rebuild index by scanning disk
-  for (int p = 0; p < st.partitions; p++) {
-    std::ifstream in(st.log_paths[p], std::ios::binary);
-    uint64_t pos = 0;
-    while (true) {
-      uint64_t ts; uint32_t klen, vlen;
-      in.seekg((std::streamoff)pos, std::ios::beg);
-      if (!read_u64(in, ts)) break;
-      if (!read_u32(in, klen)) break;
-      if (!read_u32(in, vlen)) break;
-
-      if (klen > 10*1024*1024 || vlen > 50*1024*1024) break;
-      in.seekg((std::streamoff)(klen + vlen), std::ios::cur);
-      if (!in) break;
-
-      st.index_pos[p].push_back(pos);
-      pos = (uint64_t)in.tellg();
-      if (pos == (uint64_t)-1) break;
+  KeyValue rec{key, value};
+  uint64_t offset = st->parts[partition]->append(&rec, 1);
+  metrics::add(metrics::kProduceRecords);
+  metrics::add(metrics::kProduceBytes, key.size() + value.size());
+  run_operators(*st, &rec, 1);
+  return {partition, offset};
+}
+
+std::vector<AppendedRange> GlobalStore::produce_batch(std::string_view topic,
+                                                      const std::vector<KeyValue>& records,
+                                                      int partition) {
+  std::vector<AppendedRange> out;
+  if (records.empty()) return out;
+
+  metrics::Timer timer(metrics::kProduce);
+  auto st = ensure_topic(topic);
+  int partitions = st->partitions;
+
+  // group records by partition, keeping their relative order
+  std::vector<std::vector<KeyValue>> by_part(partitions);
+  if (partition != -1) {
+    if (partition < 0 || partition >= partitions) return out;
+    by_part[partition] = records;
+  } else {
+    if (st->partitioner->needs_partition()) return out;
+    // the keyless records of the batch stay together, on one partition
+    uint64_t keyless_bytes = 0;
+    for (auto& r : records) {
+      if (r.key.empty()) keyless_bytes += record_format::kHeaderSize + r.value.size();
     }
+    int keyless = keyless_bytes ? st->partitioner->for_keyless(keyless_bytes) : -1;
+    for (auto& r : records) by_part[r.key.empty() ? keyless : st->partitioner->for_key(r.key)].push_back(r);
   }
 
-  topics_[topic] = std::move(st);
+  uint64_t bytes = 0;
+  for (int p = 0; p < partitions; p++) {
+    auto& recs = by_part[p];
+    if (recs.empty()) continue;
+    uint64_t base = st->parts[p]->append(recs.data(), recs.size());
+    out.push_back({p, base, (uint64_t)recs.size()});
+    for (auto& r : recs) bytes += r.key.size() + r.value.size();
+  }
+  metrics::add(metrics::kProduceRecords, records.size());
+  metrics::add(metrics::kProduceBytes, bytes);
+  run_operators(*st, records.data(), records.size());
+  return out;
 }
 
-std::pair<int, uint64_t> GlobalStore::produce(const std::string& topic,
-                                              const std::string& key,
-                                              const std::string& value) {
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
-  ensure_loaded_topic_locked(topic);
+void GlobalStore::run_operators(const TopicState& st, const KeyValue* recs, size_t n) {
+  auto ops = st.operators.load(std::memory_order_acquire);
+  if (ops->empty()) return;
 
-  auto& st = topics_[topic];
-  int partitions = st.partitions;
+  uint64_t now = now_ms();
+  for (auto& op : *ops) {
+    std::vector<StreamOperator::Output> windows;
+    op->add(recs, n, now, windows);
+    emit(*op, windows);
+  }
+}
 
-  int partition = 0;
-  if (!key.empty()) partition = (int)(fnv1a_64(key) % (uint64_t)partitions);
-  else partition = (int)((st.rr_counter++) % (uint64_t)partitions);
+// Appends closed windows to the operator's output topic. The records that
+// closed them are already stored, so a failure here is only reported.
+void GlobalStore::emit(const StreamOperator& op, const std::vector<StreamOperator::Output>& windows) {
+  if (windows.empty()) return;
+  std::vector<KeyValue> records;
+  records.reserve(windows.size());
+  for (auto& w : windows) records.push_back({w.key, w.value});
+  try {
+    if (produce_batch(op.spec().output_topic, records).empty()) {
+      std::cerr << "operator " << op.spec().name << ": " << op.spec().output_topic << " takes explicit partitions only\n";
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "operator " << op.spec().name << ": emit to " << op.spec().output_topic << " failed: " << e.what() << "\n";
+  }
+}
 
-  uint64_t offset = (uint64_t)st.index_pos[partition].size();
+bool GlobalStore::create_operator(const std::string& topic, const OperatorSpec& spec, std::string& err) {
+  auto st = find_topic(topic);
+  if (!st) { err = "unknown_topic"; return false; }
+  if (spec.output_topic == topic) { err = "output_is_input"; return false; }
 
-  std::ofstream out(st.log_paths[partition], std::ios::binary | std::ios::app);
-  if (!out) throw std::runtime_error("open log append failed");
+  std::lock_guard<std::mutex> lock(st->operators_mu);
+  auto cur = st->operators.load();
+  for (auto& op : *cur) {
+    if (op->spec().name == spec.name) { err = "operator_exists"; return false; }
+  }
+  auto next = std::make_shared<std::vector<std::shared_ptr<StreamOperator>>>(*cur);
+  next->push_back(std::make_shared<StreamOperator>(spec));
 
-  uint64_t file_pos = (uint64_t)out.tellp();
-  st.index_pos[partition].push_back(file_pos);
+  std::vector<OperatorSpec> specs;
+  for (auto& op : *next) specs.push_back(op->spec());
+  save_operator_specs((fs::path("data") / topic).string(), specs);
+  st->operators.store(std::move(next), std::memory_order_release);
+  return true;
+}
 
-  uint64_t ts = now_ms();
-  uint32_t klen = (uint32_t)key.size();
-  uint32_t vlen = (uint32_t)value.size();
+bool GlobalStore::drop_operator(const std::string& topic, const std::string& name) {
+  auto st = find_topic(topic);
+  if (!st) return false;
 
-  write_u64(out, ts);
-  write_u32(out, klen);
-  write_u32(out, vlen);
-  out.write(key.data(), key.size());
-  out.write(value.data(), value.size());
-  out.flush();
+  std::lock_guard<std::mutex> lock(st->operators_mu);
+  auto next = std::make_shared<std::vector<std::shared_ptr<StreamOperator>>>(*st->operators.load());
+  auto it = std::find_if(next->begin(), next->end(), [&](auto& op) { return op->spec().name == name; });
+  if (it == next->end()) return false;
+  next->erase(it);
 
-  return {partition, offset};
+  std::vector<OperatorSpec> specs;
+  for (auto& op : *next) specs.push_back(op->spec());
+  save_operator_specs((fs::path("data") / topic).string(), specs);
+  st->operators.store(std::move(next), std::memory_order_release);
+  return true;
 }
 
-FetchResult GlobalStore::fetch(const std::string& topic, int partition, uint64_t offset, int limit) {
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
-  ensure_loaded_topic_locked(topic);
+json GlobalStore::query_operator(const std::string& topic, const std::string& name) {
+  auto st = find_topic(topic);
+  if (!st) return nullptr;
+  for (auto& op : *st->operators.load()) {
+    if (op->spec().name == name) return op->query(now_ms());
+  }
+  return nullptr;
+}
 
+json GlobalStore::list_operators(const std::string& topic) {
+  json arr = json::array();
+  auto st = find_topic(topic);
+  if (!st) return arr;
+  for (auto& op : *st->operators.load()) arr.push_back(operator_spec_to_json(op->spec()));
+  return arr;
+}
+
+FetchResult GlobalStore::fetch(std::string_view topic, int partition, uint64_t offset, int limit,
+                               const RecordFilter* filter, bool verify) {
   FetchResult out;
-  out.records = json::array();
-  out.next_offset = offset;
+  fetch(topic, partition, offset, limit, out, filter, verify);
+  return out;
+}
+
+void GlobalStore::fetch(std::string_view topic, int partition, uint64_t offset, int limit, FetchResult& out,
+                        const RecordFilter* filter, bool verify) {
+  metrics::Timer timer(metrics::kFetch);
+  auto st = ensure_topic(topic);
 
-  auto& st = topics_[topic];
-  if (partition < 0 || partition >= st.partitions) return out;
+  out.records.clear();
+  out.data.clear();
+  out.next_offset = offset;
+  out.keys = out.values = true;
+  out.corrupt = false;
 
-  auto& idx = st.index_pos[partition];
-  uint64_t end_offset = (uint64_t)idx.size();
-  if (offset >= end_offset) { out.next_offset = end_offset; return out; }
+  if (partition < 0 || partition >= st->partitions) return;
 
   if (limit <= 0) limit = 10;
   if (limit > 1000) limit = 1000;
+  st->parts[partition]->read(offset, limit, out, filter, verify);
+  metrics::add(metrics::kFetchRecords, out.records.size());
+  metrics::add(metrics::kFetchBytes, out.data.size());
+}
 
-  std::ifstream in(st.log_paths[partition], std::ios::binary);
-  if (!in) throw std::runtime_error("open log read failed");
+FrameRange GlobalStore::locate_frames(const std::string& topic, int partition, uint64_t offset,
+                                      int limit, uint64_t max_bytes) {
+  metrics::Timer timer(metrics::kFetch);
+  auto st = ensure_topic(topic);
 
-  int count = 0;
-  uint64_t i = offset;
-  while (i < end_offset && count < limit) {
-    uint64_t pos = idx[(size_t)i];
-    in.seekg((std::streamoff)pos, std::ios::beg);
-
-    uint64_t ts; uint32_t klen, vlen;
-    if (!read_u64(in, ts)) break;
-    if (!read_u32(in, klen)) break;
-    if (!read_u32(in, vlen)) break;
-    if (klen > 10*1024*1024 || vlen > 50*1024*1024) break;
-
-    std::string k(klen, '\0'), v(vlen, '\0');
-    if (klen) in.read(&k[0], klen);
-    if (vlen) in.read(&v[0], vlen);
-    if (!in) break;
-
-    out.records.push_back({
-      {"partition", partition},
-      {"offset", i},
-      {"ts_ms", ts},
-      {"key", k},
-      {"value", v}
-    });
+  FrameRange res;
+  res.first_offset = res.next_offset = offset;
+  if (partition < 0 || partition >= st->partitions) return res;
 
-    i++; count++;
-  }
+  if (limit <= 0) limit = 10;
+  res = st->parts[partition]->locate(offset, limit, max_bytes);
+  metrics::add(metrics::kFetchRecords, res.count);
+  metrics::add(metrics::kFetchBytes, res.len);
+  return res;
+}
 
-  out.next_offset = i;
-  return out;
+int GlobalStore::partition_count(std::string_view topic) {
+  auto st = find_topic(topic);
+  return st ? st->partitions : 0;
 }
 
-bool GlobalStore::commit_offset(const std::string& group, const std::string& topic, int partition, uint64_t next_offset) {
-  if (group.empty() || topic.empty()) return false;
+uint64_t GlobalStore::start_offset(const std::string& topic, int partition) {
+  auto st = find_topic(topic);
+  if (!st || partition < 0 || partition >= st->partitions) return 0;
+  return st->parts[partition]->start_offset();
+}
 
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
-  ensure_loaded_topic_locked(topic);
+uint64_t GlobalStore::end_offset(std::string_view topic, int partition) {
+  auto st = find_topic(topic);
+  if (!st || partition < 0 || partition >= st->partitions) return 0;
+  return st->parts[partition]->end_offset();
+}
+
+uint64_t GlobalStore::offset_for_time(const std::string& topic, int partition, uint64_t ts_ms) {
+  auto st = find_topic(topic);
+  if (!st || partition < 0 || partition >= st->partitions) return 0;
+  return st->parts[partition]->offset_for_time(ts_ms);
+}
 
-  auto& st = topics_[topic];
-  if (partition < 0 || partition >= st.partitions) return false;
+uint64_t GlobalStore::watch(const std::string& topic, int partition, uint64_t after_offset, std::function<void()> fn) {
+  auto st = find_topic(topic);
+  if (!st || partition < 0 || partition >= st->partitions) return 0;
+  return st->parts[partition]->watch(after_offset, std::move(fn));
+}
 
-  auto& vec = committed_[group][topic];
-  if ((int)vec.size() < st.partitions) vec.resize(st.partitions, 0);
+void GlobalStore::unwatch(const std::string& topic, int partition, uint64_t token) {
+  if (token == 0) return;
+  auto st = find_topic(topic);
+  if (st && partition >= 0 && partition < st->partitions) st->parts[partition]->unwatch(token);
+}
 
-  uint64_t end_offset = (uint64_t)st.index_pos[partition].size();
+bool GlobalStore::commit_offset(std::string_view group, std::string_view topic, int partition, uint64_t next_offset) {
+  if (group.empty() || topic.empty()) return false;
+
+  metrics::Timer timer(metrics::kCommit);
+  auto st = ensure_topic(topic);
+  if (partition < 0 || partition >= st->partitions) return false;
+
+  uint64_t end_offset = st->parts[partition]->end_offset();
   if (next_offset > end_offset) next_offset = end_offset;
 
-  vec[partition] = next_offset;
-  persist_offsets_locked();
-  return true;
+  metrics::add(metrics::kCommits);
+  return offsets_->commit(group, topic, partition, next_offset);
 }
 
-uint64_t GlobalStore::get_committed_offset(const std::string& group, const std::string& topic, int partition) {
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
-  ensure_loaded_topic_locked(topic);
+uint64_t GlobalStore::get_committed_offset(std::string_view group, std::string_view topic, int partition) {
+  ensure_topic(topic);
+  return offsets_->get(group, topic, partition);
+}
 
-  auto itg = committed_.find(group);
-  if (itg == committed_.end()) return 0;
-  auto itt = itg->second.find(topic);
-  if (itt == itg->second.end()) return 0;
-  auto& vec = itt->second;
-  if (partition < 0 || partition >= (int)vec.size()) return 0;
-  return vec[partition];
+uint64_t GlobalStore::append_queue_depth() {
+  uint64_t n = 0;
+  for (auto& [name, st] : snapshot_topics()) {
+    for (auto& part : st->parts) n += part->queue_depth();
+  }
+  return n;
 }
 
-json GlobalStore::list_topics() {
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
+uint64_t GlobalStore::tail_cache_bytes() {
+  uint64_t n = 0;
+  for (auto& [name, st] : snapshot_topics()) {
+    for (auto& part : st->parts) n += part->tail_bytes();
+  }
+  return n;
+}
 
+json GlobalStore::list_topics() {
   json arr = json::array();
-  for (auto& [name, st] : topics_) {
+  for (auto& [name, st] : snapshot_topics()) {
     json parts = json::array();
-    for (int p = 0; p < st.partitions; p++) {
+    for (int p = 0; p < st->partitions; p++) {
+      auto& part = *st->parts[p];
       parts.push_back({
         {"partition", p},
-        {"end_offset", (uint64_t)st.index_pos[p].size()}
+        {"start_offset", part.start_offset()},
+        {"end_offset", part.end_offset()},
+        {"segments", part.segment_count()},
+        {"size_bytes", part.size_bytes()},
+        {"recovery_ms", st->recovery_ms[p]}
       });
     }
-    arr.push_back({{"topic", name}, {"partitions", st.partitions}, {"partition_stats", parts}});
+    json t = {{"topic", name}, {"partitions", st->partitions}};
+    t.update(topic_config_to_json(st->config));
+    t["partition_stats"] = parts;
+    arr.push_back(t);
   }
   return arr;
 }
 
 json GlobalStore::group_stats(const std::string& group) {
-  std::lock_guard<std::mutex> lock(mu_);
-  load_offsets_locked();
+  auto topics_snap = snapshot_topics();
+
+  auto group_committed = offsets_->group(group);
 
   json topics = json::array();
-  for (auto& [topic, st] : topics_) {
+  for (auto& [topic, st] : topics_snap) {
+    auto itt = group_committed.find(topic);
     json parts = json::array();
-    for (int p = 0; p < st.partitions; p++) {
-      uint64_t end_offset = (uint64_t)st.index_pos[p].size();
+    for (int p = 0; p < st->partitions; p++) {
+      uint64_t end_offset = st->parts[p]->end_offset();
       uint64_t committed = 0;
-
-      auto itg = committed_.find(group);
-      if (itg != committed_.end()) {
-        auto itt = itg->second.find(topic);
-        if (itt != itg->second.end() && p < (int)itt->second.size()) committed = itt->second[p];
-      }
+      if (itt != group_committed.end() && p < (int)itt->second.size()) committed = itt->second[p];
 
       if (committed > end_offset) committed = end_offset;
 
@@ -327,10 +591,10 @@ json GlobalStore::group_stats(const std::string& group) {
 
     topics.push_back({
       {"topic", topic},
-      {"partitions", st.partitions},
+      {"partitions", st->partitions},
       {"partitions_stats", parts}
     });
   }
 
-  return json({{"group", group}, {"topics", topics}});
+  return json({{"group", group}, {"topics", topics}, {"membership", groups_->describe(group)}});
 }
@@ -0,0 +1,113 @@
+#include "topic_config.h"
+#include "log_file.h"
+#include "record_batch.h"
+
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+bool parse_durability(const std::string& s, Durability& out) {
+  if (s == "none") { out = Durability::None; return true; }
+  if (s == "interval") { out = Durability::Interval; return true; }
+  if (s == "batch") { out = Durability::Batch; return true; }
+  return false;
+}
+
+const char* durability_name(Durability d) {
+  switch (d) {
+    case Durability::Interval: return "interval";
+    case Durability::Batch: return "batch";
+    default: return "none";
+  }
+}
+
+bool topic_config_from_json(const json& j, TopicConfig& cfg, std::string& err) {
+  try {
+    if (j.contains("durability") && !parse_durability(j["durability"].get<std::string>(), cfg.durability)) {
+      err = "bad_durability"; return false;
+    }
+    cfg.fsync_interval_ms = j.value("fsync_interval_ms", cfg.fsync_interval_ms);
+    if (cfg.fsync_interval_ms == 0) cfg.fsync_interval_ms = 1;
+
+    cfg.segment_bytes = j.value("segment_bytes", cfg.segment_bytes);
+    if (cfg.segment_bytes < 4096) { err = "bad_segment_bytes"; return false; }
+    cfg.retention_ms = j.value("retention_ms", cfg.retention_ms);
+    cfg.retention_bytes = j.value("retention_bytes", cfg.retention_bytes);
+
+    if (j.contains("cleanup_policy")) {
+      std::string policy = j["cleanup_policy"].get<std::string>();
+      if (policy == "compact") cfg.compact = true;
+      else if (policy == "delete") cfg.compact = false;
+      else { err = "bad_cleanup_policy"; return false; }
+    }
+    if (j.contains("compression") && !parse_codec(j["compression"].get<std::string>(), cfg.compression)) {
+      err = "bad_compression"; return false;
+    }
+    cfg.tail_cache_bytes = j.value("tail_cache_bytes", cfg.tail_cache_bytes);
+    if (j.contains("partitioner") && !parse_partitioning(j["partitioner"].get<std::string>(), cfg.partitioner)) {
+      err = "bad_partitioner"; return false;
+    }
+    if (j.contains("key_hash") && !parse_key_hash(j["key_hash"].get<std::string>(), cfg.key_hash)) {
+      err = "bad_key_hash"; return false;
+    }
+    cfg.sticky_bytes = j.value("sticky_bytes", cfg.sticky_bytes);
+    if (cfg.sticky_bytes == 0) { err = "bad_sticky_bytes"; return false; }
+  } catch (const json::exception&) {
+    err = "bad_topic_config";
+    return false;
+  }
+  return true;
+}
+
+json topic_config_to_json(const TopicConfig& cfg) {
+  return {
+    {"durability", durability_name(cfg.durability)},
+    {"fsync_interval_ms", cfg.fsync_interval_ms},
+    {"segment_bytes", cfg.segment_bytes},
+    {"retention_ms", cfg.retention_ms},
+    {"retention_bytes", cfg.retention_bytes},
+    {"cleanup_policy", cfg.compact ? "compact" : "delete"},
+    {"compression", codec_name(cfg.compression)},
+    {"tail_cache_bytes", cfg.tail_cache_bytes},
+    {"partitioner", partitioning_name(cfg.partitioner)},
+    {"key_hash", key_hash_name(cfg.key_hash)},
+    {"sticky_bytes", cfg.sticky_bytes}
+  };
+}
+
+TopicConfig load_topic_config(const std::string& topic_dir) {
+  TopicConfig cfg;
+  fs::path path = fs::path(topic_dir) / "_topic.json";
+  std::ifstream in(path);
+  if (!in) {
+    if (fs::exists(path)) throw std::runtime_error("cannot read topic config " + path.string());
+    return cfg; // a topic from before configs were stored
+  }
+
+  json j;
+  std::string err = "not a json object";
+  try { in >> j; } catch (const json::exception&) { err = "not valid json"; }
+  if (!j.is_object() || !topic_config_from_json(j, cfg, err)) {
+    throw std::runtime_error("bad topic config " + path.string() + ": " + err);
+  }
+  return cfg;
+}
+
+void save_topic_config(const std::string& topic_dir, const TopicConfig& cfg) {
+  // written aside and renamed into place, so a crash leaves the old config or the new one
+  fs::path path = fs::path(topic_dir) / "_topic.json";
+  std::string tmp = path.string() + ".tmp";
+  std::error_code ec;
+  fs::remove(tmp, ec); // left by a crash; the file is opened for appending
+  {
+    LogFile out(tmp);
+    std::string text = topic_config_to_json(cfg).dump(2);
+    out.append(text.data(), text.size());
+    out.flush();
+    out.sync();
+  }
+  fs::rename(tmp, path);
+}
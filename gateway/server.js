@@ -16,12 +16,19 @@ const ENGINE_PORT = Number(process.env.ENGINE_PORT || 9000);
 const WS_PORT = Number(process.env.WS_PORT || 8080);
 const PRODUCER_PORT = Number(process.env.PRODUCER_PORT || 9001);
 
+// Topics to stream from the engine at startup (comma separated); topics
+// seen on the producer port are subscribed to as they show up.
+const ENGINE_TOPICS = (process.env.ENGINE_TOPICS || "").split(",").map((t) => t.trim()).filter(Boolean);
+// Records the engine may push ahead of us; granted back as they are handled.
+const SUBSCRIBE_CREDIT = Number(process.env.SUBSCRIBE_CREDIT || 10000);
+
 // ---- State used to build SNAPSHOT ----
 let group = "g1";
 let totalEnd = 0;           
 let eventsThisSecond = 0;  
 const topicEnds = new Map(); 
 const topicPartitions = new Map(); 
+let engineMetrics = null;   // last METRICS reply
 
 // ---- WebSocket (UI) ----
 const wss = new WebSocketServer({ port: WS_PORT });
@@ -45,11 +52,54 @@ wss.on("connection", (ws) => {
   });
 });
 
-// ---- Engine connection (optional forward, and/or to read engine output if it streams) ----
+// ---- Engine connection: subscriptions stream records to us as they are appended ----
 let engineSock = null;
+const subscribed = new Set();
+// replies we still expect, in request order (pushed RECORDS lines are not replies)
+const pendingReplies = [];
+
+function engineSend(obj, expectReply = true) {
+  if (!engineSock || engineSock.destroyed) return false;
+  if (expectReply) pendingReplies.push(obj);
+  engineSock.write(JSON.stringify(obj) + "\n");
+  return true;
+}
+
+function subscribe(topic, from = "end") {
+  if (subscribed.has(topic)) return;
+  if (engineSend({ type: "SUBSCRIBE", topic, from, credit: SUBSCRIBE_CREDIT })) subscribed.add(topic);
+}
+
+function onEngineLine(line) {
+  let msg;
+  try { msg = JSON.parse(line); } catch { return; }
+
+  if (msg.type === "RECORDS") {
+    for (const r of msg.records || []) ingestRecord(msg.topic, r.partition, r.offset);
+    const n = (msg.records || []).length;
+    if (n > 0) engineSend({ type: "CREDIT", records: n }, false);
+    return;
+  }
+
+  const req = pendingReplies.shift();
+  if (req && req.type === "METRICS" && msg.ok) engineMetrics = msg;
+  if (req && req.type === "SUBSCRIBE" && !msg.ok) {
+    // topic does not exist yet: the produce we forward next creates it, so
+    // subscribe again from the start once that has gone through
+    subscribed.delete(req.topic);
+    if (msg.error === "unknown_topic") pendingReplies.push({ type: "RESUBSCRIBE", topic: req.topic });
+    else console.error(`[gateway] subscribe ${req.topic} failed: ${msg.error}`);
+  }
+  while (pendingReplies.length && pendingReplies[0].type === "RESUBSCRIBE") {
+    // placeholder entries resolve as soon as everything before them has replied
+    subscribe(pendingReplies.shift().topic, "start");
+  }
+}
+
 try {
   engineSock = net.createConnection({ host: ENGINE_HOST, port: ENGINE_PORT }, () => {
     console.log(`[gateway] connected to engine ${ENGINE_HOST}:${ENGINE_PORT}`);
+    for (const topic of ENGINE_TOPICS) subscribe(topic);
   });
 
   engineSock.setEncoding("utf8");
@@ -64,7 +114,7 @@ try {
       buf = buf.slice(idx + 1);
       if (!line) continue;
       
-      ingestEventLine(line,true);
+      onEngineLine(line);
     }
   });
 
@@ -94,13 +144,14 @@ const producerServer = net.createServer((client) => {
       buf = buf.slice(idx + 1);
       if (!line) continue;
 
-      ingestEventLine(line, false);
-
+      // with the engine up, counters come from the records it streams back
+      let forwarded = false;
       try {
-        if (engineSock && !engineSock.destroyed) {
-          engineSock.write(line + "\n");
-        }
+        const obj = JSON.parse(line);
+        if (typeof obj.topic === "string" && obj.topic.length) subscribe(obj.topic);
+        forwarded = engineSend(obj);
       } catch {}
+      if (!forwarded) ingestEventLine(line);
     }
   });
 });
@@ -110,10 +161,18 @@ producerServer.listen(PRODUCER_PORT, "127.0.0.1", () => {
 });
 
 // ---- Event ingestion / counters ----
-function ingestEventLine(line, fromEngine) {
+function ingestRecord(topic, partition, offset) {
   totalEnd += 1;
   eventsThisSecond += 1;
 
+  if (!topicPartitions.has(topic)) topicPartitions.set(topic, new Map());
+  const parts = topicPartitions.get(topic);
+  parts.set(partition, Math.max(parts.get(partition) || 0, offset + 1));
+  topicEnds.set(topic, (topicEnds.get(topic) || 0) + 1);
+}
+
+// producer line the engine did not get: count it locally
+function ingestEventLine(line) {
   let topic = "demo";
   let partition = 0;
 
@@ -127,11 +186,8 @@ function ingestEventLine(line, fromEngine) {
   } catch {
   }
 
-  topicEnds.set(topic, (topicEnds.get(topic) || 0) + 1);
-
-  if (!topicPartitions.has(topic)) topicPartitions.set(topic, new Set());
-  topicPartitions.get(topic).add(partition);
-
+  const parts = topicPartitions.get(topic);
+  ingestRecord(topic, partition, parts ? parts.get(partition) || 0 : 0);
 }
 
 setInterval(() => {
@@ -140,11 +196,11 @@ setInterval(() => {
   eventsThisSecond = 0;
 
   const topics = [];
-  for (const [topic, end] of topicEnds.entries()) {
-    const parts = Array.from(topicPartitions.get(topic) || new Set([0])).sort((a, b) => a - b);
+  for (const topic of topicEnds.keys()) {
+    const parts = Array.from(topicPartitions.get(topic) || new Map([[0, 0]])).sort((a, b) => a[0] - b[0]);
     topics.push({
       topic,
-      partition_stats: parts.map((p) => ({
+      partition_stats: parts.map(([p, end]) => ({
         partition: p,
         end_offset: end,
       })),
@@ -175,6 +231,15 @@ setInterval(() => {
     topics,
     groupStats,
   };
+  // the engine's own counters, latencies and queue depths, one second behind
+  if (engineMetrics) {
+    snapshot.engine = {
+      counters: engineMetrics.counters,
+      gauges: engineMetrics.gauges,
+      latency_us: engineMetrics.latency_us,
+    };
+  }
 
   broadcast(snapshot);
+  engineSend({ type: "METRICS" });
 }, 1000);